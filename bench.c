@@ -0,0 +1,821 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "framebuffer.h"
+#include "density.h"
+#include "png.h"
+#include "qoi.h"
+#include "jpeg.h"
+
+// raster benchmark, times draw_aaline and the kernels it dispatches to
+// over random lines drawn from configurable length, slope and canvas
+// size distributions
+//
+//   aaline_bench [--kernel a,b,...] [--canvas WxH,...] [--lines N]
+//                [--length MIN:MAX] [--length-dist uniform|log]
+//                [--slope MIN:MAX] [--thickness N] [--threads N]
+//                [--warmup N] [--reps N] [--seed N] [--json]
+//                [--encode a,b,...]
+//
+// slope is |minor / major| in [0, 1]. every kernel gets lines of its own
+// flavor, so shallow and steep see the same slopes on swapped axes. the
+// pixel count is the pixels a kernel writes, two per step for the Wu
+// kernels, one per step for the axis aligned ones and the covered area
+// for strokes
+//
+// --encode times the checksum and compression back ends of the image
+// writers instead, in bytes per second, on the raw rgba bytes of a frame
+// of the same lines drawn over white. the *_scalar encoders are the plain
+// loops the SIMD ones replace and stb_zlib is stb_image_write's deflate.
+// qoi, jpeg*, stb_png, stb_bmp and stb_jpg encode the whole frame in
+// memory, and the frame must come back unchanged through qoi_decode before
+// anything is timed. ycc and fdct are the color conversion and DCT of the
+// jpeg writer on their own, jpeg_mt encodes on --threads threads.
+// png_fastest, png_balanced and png_smallest write the frame as a png file
+// with each profile, png_mt with the default profile on --threads threads.
+// the file goes to the temp directory and its size is the output
+
+// kernels main.c does not export through framebuffer.h
+int draw_line_vertical(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2, const rect_t* clip);
+int draw_line_horizontal(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2, const rect_t* clip);
+int draw_aaline_shallow(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2, const rect_t* clip);
+int draw_aaline_steep(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2, const rect_t* clip);
+int draw_aaline_shallow_double(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2);
+int draw_aaline_steep_double(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2);
+int draw_aaline_thick(framebuffer_t* fb, unsigned color, unsigned thickness, point_t* p1, point_t* p2);
+
+// from the stb_image_write main.c builds, its header only declares the writers
+unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+
+enum {
+	LINES_ANY,
+	LINES_VERTICAL,
+	LINES_HORIZONTAL,
+	LINES_SHALLOW,
+	LINES_STEEP
+};
+
+typedef struct {
+	int length_min;
+	int length_max;
+	int log_length;
+	double slope_min;
+	double slope_max;
+	unsigned thickness;
+	threadpool_t* pool;
+	density_t* density; /**< plane for the density kernels, the size of the canvas */
+	framebuffer_t* linear; /**< FB_LINEAR canvas for the *_linear kernels, the size of the canvas */
+	framebuffer_t* rgba16; /**< FB_RGBA16 canvas for the *_rgba16 kernels */
+	framebuffer_t* rgba32f; /**< FB_RGBA32F canvas for the *_f32 kernels */
+} bench_opts_t;
+
+typedef struct {
+	const char* name;
+	int lines; /**< LINES_* flavor the kernel is fed */
+	void (*run)(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts);
+} bench_kernel_t;
+
+static void run_aaline(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	for(size_t i = 0; i < n; i++) {
+		point_t p1 = segs[i].p1, p2 = segs[i].p2;
+		draw_aaline(fb, segs[i].color, &p1, &p2);
+	}
+}
+
+static void run_fx(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	// the same lines with a quarter pixel offset so the endpoint code runs
+	for(size_t i = 0; i < n; i++) {
+		pointfx_t p1 = {TO_FX(segs[i].p1.x + 0.25), TO_FX(segs[i].p1.y + 0.25)};
+		pointfx_t p2 = {TO_FX(segs[i].p2.x + 0.25), TO_FX(segs[i].p2.y + 0.25)};
+		draw_aaline_fx(fb, segs[i].color, &p1, &p2);
+	}
+}
+
+static void run_vertical(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	rect_t clip = {0, 0, fb->width, fb->height};
+	for(size_t i = 0; i < n; i++) {
+		point_t p1 = segs[i].p1, p2 = segs[i].p2;
+		draw_line_vertical(fb, segs[i].color, &p1, &p2, &clip);
+	}
+}
+
+static void run_horizontal(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	rect_t clip = {0, 0, fb->width, fb->height};
+	for(size_t i = 0; i < n; i++) {
+		point_t p1 = segs[i].p1, p2 = segs[i].p2;
+		draw_line_horizontal(fb, segs[i].color, &p1, &p2, &clip);
+	}
+}
+
+static void run_shallow(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	rect_t clip = {0, 0, fb->width, fb->height};
+	for(size_t i = 0; i < n; i++) {
+		point_t p1 = segs[i].p1, p2 = segs[i].p2;
+		draw_aaline_shallow(fb, segs[i].color, &p1, &p2, &clip);
+	}
+}
+
+static void run_steep(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	rect_t clip = {0, 0, fb->width, fb->height};
+	for(size_t i = 0; i < n; i++) {
+		point_t p1 = segs[i].p1, p2 = segs[i].p2;
+		draw_aaline_steep(fb, segs[i].color, &p1, &p2, &clip);
+	}
+}
+
+static void run_shallow_double(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	for(size_t i = 0; i < n; i++) {
+		point_t p1 = segs[i].p1, p2 = segs[i].p2;
+		draw_aaline_shallow_double(fb, segs[i].color, &p1, &p2);
+	}
+}
+
+static void run_steep_double(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	for(size_t i = 0; i < n; i++) {
+		point_t p1 = segs[i].p1, p2 = segs[i].p2;
+		draw_aaline_steep_double(fb, segs[i].color, &p1, &p2);
+	}
+}
+
+static void run_thick(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	for(size_t i = 0; i < n; i++) {
+		point_t p1 = segs[i].p1, p2 = segs[i].p2;
+		draw_aaline_thick(fb, segs[i].color, opts->thickness, &p1, &p2);
+	}
+}
+
+static void run_batch(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	draw_aaline_batch(fb, segs, n);
+}
+
+static void run_batch_mt(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	draw_aaline_batch_mt(fb, segs, n, opts->pool);
+}
+
+static void run_density(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	density_batch(opts->density, segs, n);
+}
+
+static void run_density_mt(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	density_batch_mt(opts->density, segs, n, opts->pool);
+}
+
+// the linear kernels draw the same lines as their plain counterparts
+// into an FB_LINEAR canvas, the difference is the cost of blending in
+// linear light. that canvas is not cleared between reps, which only
+// changes the values the tables are read with
+
+static void run_aaline_linear(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	run_aaline(opts->linear, segs, n, opts);
+}
+
+static void run_thick_linear(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	run_thick(opts->linear, segs, n, opts);
+}
+
+// the same again for the wide formats
+
+static void run_aaline_rgba16(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	run_aaline(opts->rgba16, segs, n, opts);
+}
+
+static void run_thick_rgba16(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	run_thick(opts->rgba16, segs, n, opts);
+}
+
+static void run_aaline_f32(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	run_aaline(opts->rgba32f, segs, n, opts);
+}
+
+static void run_thick_f32(framebuffer_t* fb, const segment_t* segs, size_t n, const bench_opts_t* opts) {
+	run_thick(opts->rgba32f, segs, n, opts);
+}
+
+static const bench_kernel_t kernels[] = {
+	{"aaline", LINES_ANY, run_aaline},
+	{"fx", LINES_ANY, run_fx},
+	{"vertical", LINES_VERTICAL, run_vertical},
+	{"horizontal", LINES_HORIZONTAL, run_horizontal},
+	{"shallow", LINES_SHALLOW, run_shallow},
+	{"steep", LINES_STEEP, run_steep},
+	{"shallow_double", LINES_SHALLOW, run_shallow_double},
+	{"steep_double", LINES_STEEP, run_steep_double},
+	{"thick", LINES_ANY, run_thick},
+	{"batch", LINES_ANY, run_batch},
+	{"batch_mt", LINES_ANY, run_batch_mt},
+	{"density", LINES_ANY, run_density},
+	{"density_mt", LINES_ANY, run_density_mt},
+	{"aaline_linear", LINES_ANY, run_aaline_linear},
+	{"thick_linear", LINES_ANY, run_thick_linear},
+	{"aaline_rgba16", LINES_ANY, run_aaline_rgba16},
+	{"thick_rgba16", LINES_ANY, run_thick_rgba16},
+	{"aaline_f32", LINES_ANY, run_aaline_f32},
+	{"thick_f32", LINES_ANY, run_thick_f32}
+};
+
+#define NKERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+typedef struct {
+	const uint8_t* data; /**< rgba32 pixels */
+	size_t bytes;
+	int w;
+	int h;
+	const uint8_t* qoi; /**< the same pixels encoded by qoi_encode, for qoi_decode */
+	size_t qoi_len;
+	float* ycc; /**< w * h floats each of y, cb and cr, written by the ycc encoders and read by fdct */
+	threadpool_t* pool; /**< for jpeg_mt and png_mt */
+	framebuffer_t* fb; /**< the frame itself, for the png writers */
+	const char* path; /**< file the png writers write */
+} bench_frame_t;
+
+typedef struct {
+	const char* name;
+	size_t (*run)(const bench_frame_t* frame); /**< returns the number of bytes produced */
+} bench_encoder_t;
+
+// keeps the checksums from being optimized away
+static volatile uint32_t checksum_sink;
+
+static size_t run_crc32_scalar(const bench_frame_t* frame) {
+	checksum_sink = crc32_scalar(0, frame->data, frame->bytes);
+	return 4;
+}
+
+static size_t run_crc32(const bench_frame_t* frame) {
+	checksum_sink = crc32(0, frame->data, frame->bytes);
+	return 4;
+}
+
+static size_t run_adler32_scalar(const bench_frame_t* frame) {
+	checksum_sink = adler32_scalar(1, frame->data, frame->bytes);
+	return 4;
+}
+
+static size_t run_adler32(const bench_frame_t* frame) {
+	checksum_sink = adler32(1, frame->data, frame->bytes);
+	return 4;
+}
+
+static size_t run_deflate(const uint8_t* data, size_t n, int level) {
+	// fed and drained PNG_IDAT_SIZE bytes at a time, like the png writer
+	deflate_t* z = deflate_init(level);
+	size_t total = 0;
+	for(size_t i = 0; z && i < n; i += PNG_IDAT_SIZE) {
+		if(!deflate_write(z, data + i, n - i < PNG_IDAT_SIZE ? n - i : PNG_IDAT_SIZE))
+			break;
+		total += z->out_len;
+		z->out_len = 0;
+	}
+	if(z && deflate_finish(z))
+		total += z->out_len;
+	deflate_free(z);
+	return total;
+}
+
+static size_t run_deflate1(const bench_frame_t* frame) {
+	return run_deflate(frame->data, frame->bytes, 1);
+}
+
+static size_t run_deflate6(const bench_frame_t* frame) {
+	return run_deflate(frame->data, frame->bytes, 6);
+}
+
+static size_t run_deflate9(const bench_frame_t* frame) {
+	return run_deflate(frame->data, frame->bytes, 9);
+}
+
+static size_t run_stb_zlib(const bench_frame_t* frame) {
+	// stb_image_write's default png compression level
+	int len = 0;
+	free(stbi_zlib_compress((unsigned char*) frame->data, (int) frame->bytes, &len, 8));
+	return (size_t) len;
+}
+
+static size_t run_qoi(const bench_frame_t* frame) {
+	size_t len = 0;
+	free(qoi_encode(frame->w, frame->h, (const unsigned*) frame->data, &len));
+	return len;
+}
+
+static size_t run_qoi_decode(const bench_frame_t* frame) {
+	// MB/s of pixels out, like the encoders count pixels in
+	int w, h;
+	unsigned* pixels = qoi_decode(frame->qoi, frame->qoi_len, &w, &h);
+	free(pixels);
+	return pixels ? frame->bytes : 0;
+}
+
+static void count_bytes(void* context, void* data, int size) {
+	*(size_t*) context += size;
+}
+
+static size_t run_stb_png(const bench_frame_t* frame) {
+	size_t len = 0;
+	stbi_write_png_to_func(count_bytes, &len, frame->w, frame->h, 4, frame->data, frame->w * 4);
+	return len;
+}
+
+static size_t run_stb_bmp(const bench_frame_t* frame) {
+	size_t len = 0;
+	stbi_write_bmp_to_func(count_bytes, &len, frame->w, frame->h, 4, frame->data);
+	return len;
+}
+
+static size_t run_ycc_scalar(const bench_frame_t* frame) {
+	size_t n = (size_t) frame->w * frame->h;
+	jpeg_ycc_scalar((const unsigned*) frame->data, n, frame->ycc, frame->ycc + n, frame->ycc + 2 * n);
+	return n * 3 * sizeof(float);
+}
+
+static size_t run_ycc(const bench_frame_t* frame) {
+	size_t n = (size_t) frame->w * frame->h;
+	jpeg_ycc((const unsigned*) frame->data, n, frame->ycc, frame->ycc + n, frame->ycc + 2 * n);
+	return n * 3 * sizeof(float);
+}
+
+static size_t run_fdct(const bench_frame_t* frame, void (*fdct)(const float*, size_t, const float*, int16_t*)) {
+	// every whole block of the luma plane, with one quantizer step for all
+	float scale[64];
+	for(int i = 0; i < 64; i++)
+		scale[i] = 1.0f / 128;
+	int16_t coef[64];
+	int16_t sum = 0;
+	size_t blocks = 0;
+	for(int y = 0; y + 8 <= frame->h; y += 8) {
+		for(int x = 0; x + 8 <= frame->w; x += 8, blocks++) {
+			fdct(frame->ycc + (size_t) frame->w * y + x, frame->w, scale, coef);
+			sum += coef[0];
+		}
+	}
+	checksum_sink = sum;
+	return blocks * sizeof(coef);
+}
+
+static size_t run_fdct_scalar(const bench_frame_t* frame) {
+	return run_fdct(frame, jpeg_fdct_scalar);
+}
+
+static size_t run_fdct_simd(const bench_frame_t* frame) {
+	return run_fdct(frame, jpeg_fdct);
+}
+
+static size_t run_jpeg(const bench_frame_t* frame) {
+	size_t len = 0;
+	free(jpeg_encode(frame->w, frame->h, (const unsigned*) frame->data, JPEG_QUALITY, JPEG_444, NULL, &len));
+	return len;
+}
+
+static size_t run_jpeg420(const bench_frame_t* frame) {
+	size_t len = 0;
+	free(jpeg_encode(frame->w, frame->h, (const unsigned*) frame->data, JPEG_QUALITY, JPEG_420, NULL, &len));
+	return len;
+}
+
+static size_t run_jpeg_mt(const bench_frame_t* frame) {
+	size_t len = 0;
+	free(jpeg_encode(frame->w, frame->h, (const unsigned*) frame->data, JPEG_QUALITY, JPEG_444, frame->pool, &len));
+	return len;
+}
+
+static size_t run_stb_jpg(const bench_frame_t* frame) {
+	size_t len = 0;
+	stbi_write_jpg_to_func(count_bytes, &len, frame->w, frame->h, 4, frame->data, JPEG_QUALITY);
+	return len;
+}
+
+static size_t file_size(const char* path) {
+	struct stat st;
+	return stat(path, &st) == 0 ? (size_t) st.st_size : 0;
+}
+
+static size_t run_png(const bench_frame_t* frame, int profile) {
+	return png_write_framebuffer(frame->fb, frame->path, profile) ? file_size(frame->path) : 0;
+}
+
+static size_t run_png_fastest(const bench_frame_t* frame) {
+	return run_png(frame, PNG_FASTEST);
+}
+
+static size_t run_png_balanced(const bench_frame_t* frame) {
+	return run_png(frame, PNG_BALANCED);
+}
+
+static size_t run_png_smallest(const bench_frame_t* frame) {
+	return run_png(frame, PNG_SMALLEST);
+}
+
+static size_t run_png_mt(const bench_frame_t* frame) {
+	return png_write_framebuffer_mt(frame->fb, frame->path, PNG_PROFILE, frame->pool) ? file_size(frame->path) : 0;
+}
+
+static const bench_encoder_t encoders[] = {
+	{"crc32_scalar", run_crc32_scalar},
+	{"crc32", run_crc32},
+	{"adler32_scalar", run_adler32_scalar},
+	{"adler32", run_adler32},
+	{"deflate1", run_deflate1},
+	{"deflate6", run_deflate6},
+	{"deflate9", run_deflate9},
+	{"stb_zlib", run_stb_zlib},
+	{"qoi", run_qoi},
+	{"qoi_decode", run_qoi_decode},
+	{"stb_png", run_stb_png},
+	{"stb_bmp", run_stb_bmp},
+	{"ycc_scalar", run_ycc_scalar},
+	{"ycc", run_ycc},
+	{"fdct_scalar", run_fdct_scalar},
+	{"fdct", run_fdct_simd},
+	{"jpeg", run_jpeg},
+	{"jpeg420", run_jpeg420},
+	{"jpeg_mt", run_jpeg_mt},
+	{"stb_jpg", run_stb_jpg},
+	{"png_fastest", run_png_fastest},
+	{"png_balanced", run_png_balanced},
+	{"png_smallest", run_png_smallest},
+	{"png_mt", run_png_mt}
+};
+
+#define NENCODERS (sizeof(encoders) / sizeof(encoders[0]))
+
+static uint64_t rng_next(uint64_t* state) {
+	// splitmix64, the same lines on every machine for a given seed
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+static double rng_unit(uint64_t* state) {
+	return (rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int rng_range(uint64_t* state, int lo, int hi) {
+	// inclusive, hi >= lo
+	return lo + (int) (rng_next(state) % (uint64_t) (hi - lo + 1));
+}
+
+static size_t make_lines(segment_t* segs, size_t n, int flavor, int w, int h, const bench_opts_t* opts, uint64_t seed) {
+	// returns the number of pixels the lines write, counted as two per
+	// major step for Wu lines and one for axis aligned lines
+	uint64_t rng = seed;
+	size_t pixels = 0;
+	for(size_t i = 0; i < n; i++) {
+		int steep;
+		if(flavor == LINES_ANY)
+			steep = (int) (rng_next(&rng) & 1);
+		else
+			steep = flavor == LINES_STEEP || flavor == LINES_VERTICAL;
+		int major_size = steep ? h : w;
+		int minor_size = steep ? w : h;
+		double u = rng_unit(&rng);
+		double len;
+		if(opts->log_length)
+			len = opts->length_min * pow((double) opts->length_max / opts->length_min, u);
+		else
+			len = opts->length_min + u * (opts->length_max - opts->length_min);
+		int major = (int) len;
+		double slope = opts->slope_min + rng_unit(&rng) * (opts->slope_max - opts->slope_min);
+		if(flavor == LINES_VERTICAL || flavor == LINES_HORIZONTAL)
+			slope = 0;
+		if(major > major_size - 1)
+			major = major_size - 1;
+		int minor = (int) lround(major * slope);
+		if(minor > minor_size - 1) {
+			// too steep to fit at this length, shorten the line
+			minor = minor_size - 1;
+			if(slope > 0)
+				major = (int) (minor / slope);
+		}
+		if(flavor == LINES_SHALLOW && minor >= major && major > 0)
+			minor = major - 1;
+		int m0 = rng_range(&rng, 0, major_size - 1 - major);
+		int n0 = rng_range(&rng, 0, minor_size - 1 - minor);
+		int down = (int) (rng_next(&rng) & 1);
+		int a0 = n0 + (down ? minor : 0);
+		int a1 = n0 + (down ? 0 : minor);
+		// the axis kernels are called directly and want ordered endpoints,
+		// the dispatching ones get both directions
+		int flip = flavor == LINES_ANY && (rng_next(&rng) & 1);
+		point_t p1, p2;
+		if(steep) {
+			p1 = (point_t) {a0, m0};
+			p2 = (point_t) {a1, m0 + major};
+		}
+		else {
+			p1 = (point_t) {m0, a0};
+			p2 = (point_t) {m0 + major, a1};
+		}
+		segs[i].p1 = flip ? p2 : p1;
+		segs[i].p2 = flip ? p1 : p2;
+		segs[i].color = rgba32(rng_next(&rng), rng_next(&rng), rng_next(&rng), 128 + (rng_next(&rng) & 127));
+		pixels += (size_t) (major + 1) * (minor == 0 ? 1 : 2);
+	}
+	return pixels;
+}
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_double(const void* a, const void* b) {
+	double x = *(const double*) a, y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+static int parse_range(const char* s, double* lo, double* hi) {
+	char* end;
+	*lo = strtod(s, &end);
+	if(end == s)
+		return 0;
+	if(*end == '\0') {
+		*hi = *lo;
+		return 1;
+	}
+	if(*end != ':')
+		return 0;
+	s = end + 1;
+	*hi = strtod(s, &end);
+	return end != s && *end == '\0' && *hi >= *lo;
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "usage: %s [--kernel a,b,...] [--canvas WxH,...] [--lines N]\n"
+		"\t[--length MIN:MAX] [--length-dist uniform|log] [--slope MIN:MAX]\n"
+		"\t[--thickness N] [--threads N] [--warmup N] [--reps N] [--seed N] [--json]\n"
+		"\t[--encode a,b,...]\n"
+		"kernels:", name);
+	for(size_t k = 0; k < NKERNELS; k++)
+		fprintf(stderr, " %s", kernels[k].name);
+	fprintf(stderr, "\nencoders:");
+	for(size_t k = 0; k < NENCODERS; k++)
+		fprintf(stderr, " %s", encoders[k].name);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+	const char* kernel_list = NULL;
+	const char* encode_list = NULL;
+	const char* canvas_list = "1024x1024";
+	size_t nlines = 20000;
+	int warmup = 1, reps = 5, json = 0, threads = 0;
+	uint64_t seed = 1;
+	double lo, hi;
+	bench_opts_t opts = {.length_min = 1, .length_max = 256, .slope_min = 0, .slope_max = 1, .thickness = 3};
+	for(int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* val = i + 1 < argc ? argv[i + 1] : NULL;
+		if(strcmp(arg, "--json") == 0) {
+			json = 1;
+			continue;
+		}
+		if(!val) {
+			usage(argv[0]);
+			return 1;
+		}
+		i++;
+		if(strcmp(arg, "--kernel") == 0) {
+			kernel_list = val;
+		}
+		else if(strcmp(arg, "--encode") == 0) {
+			encode_list = val;
+		}
+		else if(strcmp(arg, "--canvas") == 0) {
+			canvas_list = val;
+		}
+		else if(strcmp(arg, "--lines") == 0) {
+			nlines = strtoul(val, NULL, 10);
+		}
+		else if(strcmp(arg, "--length") == 0 && parse_range(val, &lo, &hi) && lo >= 1) {
+			opts.length_min = (int) lo;
+			opts.length_max = (int) hi;
+		}
+		else if(strcmp(arg, "--length-dist") == 0 && (strcmp(val, "uniform") == 0 || strcmp(val, "log") == 0)) {
+			opts.log_length = strcmp(val, "log") == 0;
+		}
+		else if(strcmp(arg, "--slope") == 0 && parse_range(val, &lo, &hi) && lo >= 0 && hi <= 1) {
+			opts.slope_min = lo;
+			opts.slope_max = hi;
+		}
+		else if(strcmp(arg, "--thickness") == 0) {
+			opts.thickness = (unsigned) atoi(val);
+		}
+		else if(strcmp(arg, "--threads") == 0) {
+			threads = atoi(val);
+		}
+		else if(strcmp(arg, "--warmup") == 0) {
+			warmup = atoi(val);
+		}
+		else if(strcmp(arg, "--reps") == 0 && atoi(val) > 0) {
+			reps = atoi(val);
+		}
+		else if(strcmp(arg, "--seed") == 0) {
+			seed = strtoull(val, NULL, 10);
+		}
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// every kernel runs by default, unless only encoders were asked for
+	int selected[NKERNELS] = {0};
+	int any_kernel = 0, any_encoder = 0;
+	for(size_t k = 0; k < NKERNELS; k++)
+		selected[k] = kernel_list == NULL && encode_list == NULL;
+	for(const char* s = kernel_list; s && *s;) {
+		size_t len = strcspn(s, ",");
+		size_t k;
+		for(k = 0; k < NKERNELS; k++)
+			if(strlen(kernels[k].name) == len && strncmp(kernels[k].name, s, len) == 0)
+				break;
+		if(k == NKERNELS) {
+			fprintf(stderr, "unknown kernel %.*s\n", (int) len, s);
+			usage(argv[0]);
+			return 1;
+		}
+		selected[k] = 1;
+		s += len + (s[len] == ',');
+	}
+	int encode_selected[NENCODERS] = {0};
+	for(const char* s = encode_list; s && *s;) {
+		size_t len = strcspn(s, ",");
+		size_t k;
+		for(k = 0; k < NENCODERS; k++)
+			if(strlen(encoders[k].name) == len && strncmp(encoders[k].name, s, len) == 0)
+				break;
+		if(k == NENCODERS) {
+			fprintf(stderr, "unknown encoder %.*s\n", (int) len, s);
+			usage(argv[0]);
+			return 1;
+		}
+		encode_selected[k] = 1;
+		s += len + (s[len] == ',');
+	}
+	for(size_t k = 0; k < NKERNELS; k++)
+		any_kernel |= selected[k];
+	for(size_t k = 0; k < NENCODERS; k++)
+		any_encoder |= encode_selected[k];
+
+	opts.pool = threadpool_init(threads);
+	// the png encoders write here, one file per run of the bench
+	char png_path[256];
+	const char* tmp = getenv("TMPDIR");
+	snprintf(png_path, sizeof(png_path), "%s/aaline_bench_%ld.png", tmp && *tmp ? tmp : "/tmp", (long) getpid());
+	segment_t* segs = malloc(nlines * sizeof(segment_t));
+	double* times = malloc(reps * sizeof(double));
+	if(!opts.pool || !segs || !times) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	if(json)
+		printf("[");
+	else if(any_kernel)
+		printf("%-16s %11s %10s %12s %12s %10s %14s %14s\n", "kernel", "canvas", "lines", "pixels",
+			"median ms", "ns/pixel", "lines/s", "pixels/s");
+	int first = 1, first_encoder = 1;
+	for(const char* s = canvas_list; *s;) {
+		int w, h, used;
+		if(sscanf(s, "%dx%d%n", &w, &h, &used) != 2 || w < 1 || h < 1) {
+			fprintf(stderr, "bad canvas %s\n", s);
+			return 1;
+		}
+		s += used + (s[used] == ',');
+		framebuffer_t* fb = framebuffer_init(w, h);
+		opts.density = density_init(w, h);
+		opts.linear = framebuffer_init_flags(w, h, FB_LINEAR);
+		opts.rgba16 = framebuffer_init_flags(w, h, FB_RGBA16);
+		opts.rgba32f = framebuffer_init_flags(w, h, FB_RGBA32F);
+		if(!fb || !opts.density || !opts.linear || !opts.rgba16 || !opts.rgba32f) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		for(size_t k = 0; k < NKERNELS; k++) {
+			if(!selected[k])
+				continue;
+			const bench_kernel_t* kernel = &kernels[k];
+			size_t pixels = make_lines(segs, nlines, kernel->lines, w, h, &opts, seed);
+			// a stroke covers about thickness + 1 pixels per major step
+			// where a Wu line writes two
+			if(kernel->run == run_thick || kernel->run == run_thick_linear || kernel->run == run_thick_rgba16
+				|| kernel->run == run_thick_f32)
+				pixels = pixels * (opts.thickness + 1) / 2;
+			for(int r = 0; r < warmup; r++)
+				kernel->run(fb, segs, nlines, &opts);
+			for(int r = 0; r < reps; r++) {
+				// blending cost does not depend on the destination much, the
+				// clear just keeps the frame from saturating
+				framebuffer_fill(fb, 0);
+				double t0 = now_ns();
+				kernel->run(fb, segs, nlines, &opts);
+				times[r] = now_ns() - t0;
+			}
+			qsort(times, reps, sizeof(double), compare_double);
+			double median = times[reps / 2];
+			double ns_per_pixel = pixels ? median / pixels : 0;
+			double lines_per_s = nlines / (median * 1e-9);
+			double pixels_per_s = pixels / (median * 1e-9);
+			if(json) {
+				printf("%s\n  {\"kernel\": \"%s\", \"width\": %d, \"height\": %d, \"lines\": %zu, \"pixels\": %zu, "
+					"\"reps\": %d, \"min_ns\": %.0f, \"median_ns\": %.0f, \"max_ns\": %.0f, "
+					"\"ns_per_pixel\": %.4f, \"lines_per_s\": %.0f, \"pixels_per_s\": %.0f}",
+					first ? "" : ",", kernel->name, w, h, nlines, pixels, reps, times[0], median,
+					times[reps - 1], ns_per_pixel, lines_per_s, pixels_per_s);
+			}
+			else {
+				char canvas[32];
+				snprintf(canvas, sizeof(canvas), "%dx%d", w, h);
+				printf("%-16s %11s %10zu %12zu %12.3f %10.3f %14.0f %14.0f\n", kernel->name, canvas, nlines,
+					pixels, median * 1e-6, ns_per_pixel, lines_per_s, pixels_per_s);
+			}
+			first = 0;
+		}
+		if(any_encoder) {
+			// a frame like the ones the writers see, mostly background
+			framebuffer_fill(fb, 0xffffffffu);
+			make_lines(segs, nlines, LINES_ANY, w, h, &opts, seed);
+			run_aaline(fb, segs, nlines, &opts);
+		}
+		bench_frame_t frame = {.data = (const uint8_t*) fb->fb, .bytes = (size_t) w * h * 4, .w = w, .h = h};
+		uint8_t* qoi = NULL;
+		if(any_encoder) {
+			int qw = 0, qh = 0;
+			qoi = qoi_encode(w, h, (const unsigned*) frame.data, &frame.qoi_len);
+			unsigned* back = qoi ? qoi_decode(qoi, frame.qoi_len, &qw, &qh) : NULL;
+			int same = back && qw == w && qh == h && memcmp(back, frame.data, frame.bytes) == 0;
+			free(back);
+			if(!same) {
+				fprintf(stderr, "qoi round trip of %dx%d failed\n", w, h);
+				return 1;
+			}
+			frame.qoi = qoi;
+			frame.ycc = malloc((size_t) w * h * 3 * sizeof(float));
+			if(!frame.ycc) {
+				fprintf(stderr, "out of memory\n");
+				return 1;
+			}
+			run_ycc(&frame);
+			frame.pool = opts.pool;
+			frame.fb = fb;
+			frame.path = png_path;
+		}
+		size_t bytes = frame.bytes;
+		for(size_t k = 0; k < NENCODERS; k++) {
+			if(!encode_selected[k])
+				continue;
+			const bench_encoder_t* encoder = &encoders[k];
+			size_t out = 0;
+			for(int r = 0; r < warmup; r++)
+				encoder->run(&frame);
+			for(int r = 0; r < reps; r++) {
+				double t0 = now_ns();
+				out = encoder->run(&frame);
+				times[r] = now_ns() - t0;
+			}
+			qsort(times, reps, sizeof(double), compare_double);
+			double median = times[reps / 2];
+			double bytes_per_s = bytes / (median * 1e-9);
+			if(json) {
+				printf("%s\n  {\"encoder\": \"%s\", \"width\": %d, \"height\": %d, \"bytes\": %zu, \"out_bytes\": %zu, "
+					"\"reps\": %d, \"min_ns\": %.0f, \"median_ns\": %.0f, \"max_ns\": %.0f, \"bytes_per_s\": %.0f}",
+					first ? "" : ",", encoder->name, w, h, bytes, out, reps, times[0], median, times[reps - 1],
+					bytes_per_s);
+			}
+			else {
+				if(first_encoder)
+					printf("%s%-16s %11s %12s %12s %12s %12s\n", any_kernel ? "\n" : "", "encoder", "canvas", "bytes",
+						"out bytes", "median ms", "MB/s");
+				char canvas[32];
+				snprintf(canvas, sizeof(canvas), "%dx%d", w, h);
+				printf("%-16s %11s %12zu %12zu %12.3f %12.1f\n", encoder->name, canvas, bytes, out, median * 1e-6,
+					bytes_per_s * 1e-6);
+			}
+			first = 0;
+			first_encoder = 0;
+		}
+		free(qoi);
+		free(frame.ycc);
+		if(frame.path)
+			remove(frame.path);
+		framebuffer_free(fb);
+		density_free(opts.density);
+		framebuffer_free(opts.linear);
+		framebuffer_free(opts.rgba16);
+		framebuffer_free(opts.rgba32f);
+	}
+	if(json)
+		printf("\n]\n");
+	free(segs);
+	free(times);
+	threadpool_free(opts.pool);
+	return 0;
+}
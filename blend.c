@@ -0,0 +1,672 @@
+#include "blend.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLEND_X86 1
+#include <immintrin.h>
+#endif
+
+void blend_span_scalar(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	for(size_t i = 0; i < n; i++)
+		dst[i] = blend_px(dst[i], color, coverage ? coverage[i] : 255);
+}
+
+void blend_span_image_scalar(unsigned* dst, const unsigned* src, size_t n) {
+	for(size_t i = 0; i < n; i++)
+		dst[i] = blend_px(dst[i], src[i], 255);
+}
+
+void blend_span_premul_scalar(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	for(size_t i = 0; i < n; i++)
+		dst[i] = blend_px_premul(dst[i], color, coverage ? coverage[i] : 255);
+}
+
+void blend_span_image_premul_scalar(unsigned* dst, const unsigned* src, size_t n) {
+	for(size_t i = 0; i < n; i++)
+		dst[i] = blend_px_premul(dst[i], src[i], 255);
+}
+
+void blend_span_linear_scalar(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	// the color is decoded once, only the destination is per pixel
+	unsigned ca = color >> 24;
+	unsigned lr = srgb_decode[color & 0xff];
+	unsigned lg = srgb_decode[(color >> 8) & 0xff];
+	unsigned lb = srgb_decode[(color >> 16) & 0xff];
+	for(size_t i = 0; i < n; i++) {
+		unsigned a = div255(ca * (coverage ? coverage[i] : 255));
+		unsigned w = a + (a >> 7), nw = 256 - w;
+		unsigned d = dst[i];
+		unsigned r = srgb_encode[(lr * w + srgb_decode[d & 0xff] * nw + 2048) >> 12];
+		unsigned g = srgb_encode[(lg * w + srgb_decode[(d >> 8) & 0xff] * nw + 2048) >> 12];
+		unsigned b = srgb_encode[(lb * w + srgb_decode[(d >> 16) & 0xff] * nw + 2048) >> 12];
+		dst[i] = 0xff000000u | b << 16 | g << 8 | r;
+	}
+}
+
+void blend_span_image_linear(unsigned* dst, const unsigned* src, size_t n) {
+	for(size_t i = 0; i < n; i++)
+		dst[i] = blend_px_linear(dst[i], src[i], 255);
+}
+
+void blend_span_rgba16(uint16_t* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	for(size_t i = 0; i < n; i++)
+		blend_px_rgba16(dst + 4 * i, color, coverage ? coverage[i] : 255);
+}
+
+void blend_span_f32_scalar(float* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	for(size_t i = 0; i < n; i++)
+		blend_px_f32(dst + 4 * i, color, coverage ? coverage[i] : 255);
+}
+
+void blend_span_image_f32(float* dst, const float* src, size_t n) {
+	for(size_t i = 0; i < n; i++) {
+		float a = src[4 * i + 3];
+		for(int c = 0; c < 3; c++)
+			dst[4 * i + c] += (src[4 * i + c] - dst[4 * i + c]) * a;
+		dst[4 * i + 3] = 1.0f;
+	}
+}
+
+void pack_bgra_scalar(uint8_t* dst, const unsigned* src, size_t n) {
+	for(size_t i = 0; i < n; i++) {
+		unsigned c = src[i];
+		dst[4 * i] = (uint8_t) (c >> 16);
+		dst[4 * i + 1] = (uint8_t) (c >> 8);
+		dst[4 * i + 2] = (uint8_t) c;
+		dst[4 * i + 3] = (uint8_t) (c >> 24);
+	}
+}
+
+static inline uint8_t over_background(unsigned c, unsigned bg, int shift) {
+	int k = (bg >> shift) & 0xff;
+	return (uint8_t) (k + ((int) ((c >> shift) & 0xff) - k) * (int) (c >> 24) / 255);
+}
+
+void pack_bgr_scalar(uint8_t* dst, const unsigned* src, size_t n, unsigned background) {
+	for(size_t i = 0; i < n; i++) {
+		dst[3 * i] = over_background(src[i], background, 16);
+		dst[3 * i + 1] = over_background(src[i], background, 8);
+		dst[3 * i + 2] = over_background(src[i], background, 0);
+	}
+}
+
+#if defined(BLEND_X86) && defined(__SSE2__)
+
+static inline __m128i div255_epi16(__m128i x) {
+	// same rounding as div255, every lane stays below 65536
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static inline __m128i blend2_sse2(__m128i dst, __m128i src, __m128i a) {
+	// dst, src and a hold two pixels as 16-bit channels
+	__m128i na = _mm_sub_epi16(_mm_set1_epi16(255), a);
+	__m128i x = _mm_add_epi16(_mm_mullo_epi16(src, a), _mm_mullo_epi16(dst, na));
+	return div255_epi16(x);
+}
+
+void blend_span_sse2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i opaque = _mm_set1_epi32((int) 0xff000000u);
+	__m128i src = _mm_unpacklo_epi8(_mm_set1_epi32((int) color), zero);
+	__m128i ca = _mm_set1_epi16((short) (color >> 24));
+	__m128i full = _mm_set1_epi16(255);
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m128i cov = full;
+		if(coverage) {
+			int32_t c4;
+			__builtin_memcpy(&c4, coverage + i, 4);
+			cov = _mm_unpacklo_epi8(_mm_cvtsi32_si128(c4), zero);
+		}
+		// per pixel alpha, then spread each one over its four channels
+		__m128i a = div255_epi16(_mm_mullo_epi16(ca, cov));
+		a = _mm_unpacklo_epi16(a, a);
+		__m128i a01 = _mm_unpacklo_epi32(a, a);
+		__m128i a23 = _mm_unpackhi_epi32(a, a);
+		__m128i d = _mm_loadu_si128((__m128i*) (dst + i));
+		__m128i lo = blend2_sse2(_mm_unpacklo_epi8(d, zero), src, a01);
+		__m128i hi = blend2_sse2(_mm_unpackhi_epi8(d, zero), src, a23);
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+	}
+	blend_span_scalar(dst + i, coverage ? coverage + i : NULL, n - i, color);
+}
+
+static inline __m128i spread_alpha_sse2(__m128i px) {
+	// px holds two pixels as 16-bit channels, copy each alpha to all four
+	px = _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm_shufflehi_epi16(px, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+void blend_span_image_sse2(unsigned* dst, const unsigned* src, size_t n) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i opaque = _mm_set1_epi32((int) 0xff000000u);
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+		__m128i d = _mm_loadu_si128((__m128i*) (dst + i));
+		__m128i s_lo = _mm_unpacklo_epi8(s, zero);
+		__m128i s_hi = _mm_unpackhi_epi8(s, zero);
+		// blend_px(d, s, 255) scales alpha by div255(a * 255), which is a
+		__m128i lo = blend2_sse2(_mm_unpacklo_epi8(d, zero), s_lo, spread_alpha_sse2(s_lo));
+		__m128i hi = blend2_sse2(_mm_unpackhi_epi8(d, zero), s_hi, spread_alpha_sse2(s_hi));
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+	}
+	blend_span_image_scalar(dst + i, src + i, n - i);
+}
+
+static inline __m128i blend2_premul_sse2(__m128i dst, __m128i src, __m128i c, __m128i na) {
+	// two pixels as 16-bit channels, c is the coverage and na is 255 minus
+	// the covered alpha, both spread over the channels. the sum stays
+	// below 65536 and its quotient at or below 255
+	__m128i x = _mm_add_epi16(_mm_mullo_epi16(src, c), _mm_mullo_epi16(dst, na));
+	return div255_epi16(x);
+}
+
+void blend_span_premul_sse2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i src = _mm_unpacklo_epi8(_mm_set1_epi32((int) color), zero);
+	__m128i ca = _mm_set1_epi16((short) (color >> 24));
+	__m128i full = _mm_set1_epi16(255);
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m128i cov = full;
+		if(coverage) {
+			int32_t c4;
+			__builtin_memcpy(&c4, coverage + i, 4);
+			cov = _mm_unpacklo_epi8(_mm_cvtsi32_si128(c4), zero);
+		}
+		__m128i na = _mm_sub_epi16(full, div255_epi16(_mm_mullo_epi16(ca, cov)));
+		// spread coverage and na over the four channels of each pixel
+		cov = _mm_unpacklo_epi16(cov, cov);
+		na = _mm_unpacklo_epi16(na, na);
+		__m128i d = _mm_loadu_si128((__m128i*) (dst + i));
+		__m128i lo = blend2_premul_sse2(_mm_unpacklo_epi8(d, zero), src, _mm_unpacklo_epi32(cov, cov), _mm_unpacklo_epi32(na, na));
+		__m128i hi = blend2_premul_sse2(_mm_unpackhi_epi8(d, zero), src, _mm_unpackhi_epi32(cov, cov), _mm_unpackhi_epi32(na, na));
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(lo, hi));
+	}
+	blend_span_premul_scalar(dst + i, coverage ? coverage + i : NULL, n - i, color);
+}
+
+void blend_span_image_premul_sse2(unsigned* dst, const unsigned* src, size_t n) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16(255);
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+		__m128i d = _mm_loadu_si128((__m128i*) (dst + i));
+		__m128i s_lo = _mm_unpacklo_epi8(s, zero);
+		__m128i s_hi = _mm_unpackhi_epi8(s, zero);
+		// blend_px_premul(d, s, 255)
+		__m128i lo = blend2_premul_sse2(_mm_unpacklo_epi8(d, zero), s_lo, full, _mm_sub_epi16(full, spread_alpha_sse2(s_lo)));
+		__m128i hi = blend2_premul_sse2(_mm_unpackhi_epi8(d, zero), s_hi, full, _mm_sub_epi16(full, spread_alpha_sse2(s_hi)));
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(lo, hi));
+	}
+	blend_span_image_premul_scalar(dst + i, src + i, n - i);
+}
+
+void fill_span(unsigned* dst, size_t n, unsigned color, int stream) {
+	__m128i c = _mm_set1_epi32((int) color);
+	size_t i = 0;
+	// get dst 16 byte aligned, the streaming store requires it
+	for(; i < n && ((uintptr_t) (dst + i) & 15); i++)
+		dst[i] = color;
+	if(stream) {
+		for(; i + 16 <= n; i += 16) {
+			_mm_stream_si128((__m128i*) (dst + i), c);
+			_mm_stream_si128((__m128i*) (dst + i + 4), c);
+			_mm_stream_si128((__m128i*) (dst + i + 8), c);
+			_mm_stream_si128((__m128i*) (dst + i + 12), c);
+		}
+		_mm_sfence();
+	}
+	for(; i + 16 <= n; i += 16) {
+		_mm_store_si128((__m128i*) (dst + i), c);
+		_mm_store_si128((__m128i*) (dst + i + 4), c);
+		_mm_store_si128((__m128i*) (dst + i + 8), c);
+		_mm_store_si128((__m128i*) (dst + i + 12), c);
+	}
+	for(; i < n; i++)
+		dst[i] = color;
+}
+
+void blend_span_f32_sse2(float* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	// the same operations as blend_px_f32 in the same order, so the
+	// results match the scalar kernel exactly
+	const __m128 src = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(
+		_mm_unpacklo_epi8(_mm_cvtsi32_si128((int) color), _mm_setzero_si128()), _mm_setzero_si128())), _mm_set1_ps(1.0f / 255));
+	const __m128 alpha_lane = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+	const __m128 one = _mm_set_ps(1.0f, 0, 0, 0);
+	for(size_t i = 0; i < n; i++) {
+		unsigned cov = coverage ? coverage[i] : 255;
+		__m128 a = _mm_set1_ps((float) ((color >> 24) * cov) * (1.0f / 65025));
+		__m128 d = _mm_loadu_ps(dst + 4 * i);
+		d = _mm_add_ps(d, _mm_mul_ps(_mm_sub_ps(src, d), a));
+		_mm_storeu_ps(dst + 4 * i, _mm_or_ps(_mm_andnot_ps(alpha_lane, d), one));
+	}
+}
+
+static inline __m128i swap_rb_sse2(__m128i px) {
+	const __m128i rb_mask = _mm_set1_epi32(0x00ff00ff);
+	__m128i rb = _mm_and_si128(px, rb_mask);
+	rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+	return _mm_or_si128(_mm_andnot_si128(rb_mask, px), rb);
+}
+
+void pack_bgra_sse2(uint8_t* dst, const unsigned* src, size_t n) {
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4)
+		_mm_storeu_si128((__m128i*) (dst + 4 * i), swap_rb_sse2(_mm_loadu_si128((const __m128i*) (src + i))));
+	pack_bgra_scalar(dst + 4 * i, src + i, n - i);
+}
+
+static inline __m128i over_background_sse2(__m128i px, __m128i bg) {
+	// px holds two pixels as 16-bit channels. the size of the difference
+	// is scaled and divided rounding down, then its sign is put back,
+	// which truncates toward zero like the scalar division
+	__m128i d = _mm_sub_epi16(px, bg);
+	__m128i sign = _mm_srai_epi16(d, 15);
+	d = _mm_sub_epi16(_mm_xor_si128(d, sign), sign);
+	__m128i p = _mm_mullo_epi16(d, spread_alpha_sse2(px));
+	// floor(p / 255) for p up to 255 * 255
+	p = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(p, _mm_set1_epi16(1)), _mm_srli_epi16(p, 8)), 8);
+	return _mm_add_epi16(bg, _mm_sub_epi16(_mm_xor_si128(p, sign), sign));
+}
+
+void pack_bgr_sse2(uint8_t* dst, const unsigned* src, size_t n, unsigned background) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bg = _mm_unpacklo_epi8(_mm_set1_epi32((int) background), zero);
+	size_t i = 0;
+	// every pixel is stored as four bytes and the next one overwrites the
+	// spare, so the loop stops while there is a pixel left for the tail
+	for(; i + 4 < n; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+		__m128i lo = over_background_sse2(_mm_unpacklo_epi8(s, zero), bg);
+		__m128i hi = over_background_sse2(_mm_unpackhi_epi8(s, zero), bg);
+		uint32_t px[4];
+		_mm_storeu_si128((__m128i*) px, swap_rb_sse2(_mm_packus_epi16(lo, hi)));
+		for(int k = 0; k < 4; k++)
+			__builtin_memcpy(dst + 3 * (i + k), &px[k], 4);
+	}
+	pack_bgr_scalar(dst + 3 * i, src + i, n - i, background);
+}
+
+#else
+
+void blend_span_f32_sse2(float* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	blend_span_f32_scalar(dst, coverage, n, color);
+}
+
+void blend_span_sse2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	blend_span_scalar(dst, coverage, n, color);
+}
+
+void blend_span_image_sse2(unsigned* dst, const unsigned* src, size_t n) {
+	blend_span_image_scalar(dst, src, n);
+}
+
+void blend_span_premul_sse2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	blend_span_premul_scalar(dst, coverage, n, color);
+}
+
+void blend_span_image_premul_sse2(unsigned* dst, const unsigned* src, size_t n) {
+	blend_span_image_premul_scalar(dst, src, n);
+}
+
+void fill_span(unsigned* dst, size_t n, unsigned color, int stream) {
+	for(size_t i = 0; i < n; i++)
+		dst[i] = color;
+}
+
+void pack_bgra_sse2(uint8_t* dst, const unsigned* src, size_t n) {
+	pack_bgra_scalar(dst, src, n);
+}
+
+void pack_bgr_sse2(uint8_t* dst, const unsigned* src, size_t n, unsigned background) {
+	pack_bgr_scalar(dst, src, n, background);
+}
+
+#endif
+
+#if defined(BLEND_X86)
+
+__attribute__((target("avx2")))
+static inline __m256i div255_epi16_avx2(__m256i x) {
+	x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend2_avx2(__m256i dst, __m256i src, __m256i a) {
+	__m256i na = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+	__m256i x = _mm256_add_epi16(_mm256_mullo_epi16(src, a), _mm256_mullo_epi16(dst, na));
+	return div255_epi16_avx2(x);
+}
+
+__attribute__((target("avx2")))
+void blend_span_avx2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i opaque = _mm256_set1_epi32((int) 0xff000000u);
+	__m256i src = _mm256_unpacklo_epi8(_mm256_set1_epi32((int) color), zero);
+	__m128i ca = _mm_set1_epi16((short) (color >> 24));
+	__m128i full = _mm_set1_epi16(255);
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m128i cov = full;
+		if(coverage)
+			cov = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i*) (coverage + i)));
+		__m128i a = _mm_mullo_epi16(ca, cov);
+		a = _mm_add_epi16(a, _mm_set1_epi16(128));
+		a = _mm_srli_epi16(_mm_add_epi16(a, _mm_srli_epi16(a, 8)), 8);
+		// unpack works within 128-bit lanes, so pixels 0,1,4,5 end up in
+		// the low half of each lane and 2,3,6,7 in the high half
+		__m128i a0123 = _mm_unpacklo_epi16(a, a);
+		__m128i a4567 = _mm_unpackhi_epi16(a, a);
+		__m256i a_lo = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi32(a0123, a0123)), _mm_unpacklo_epi32(a4567, a4567), 1);
+		__m256i a_hi = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpackhi_epi32(a0123, a0123)), _mm_unpackhi_epi32(a4567, a4567), 1);
+		__m256i d = _mm256_loadu_si256((__m256i*) (dst + i));
+		__m256i lo = blend2_avx2(_mm256_unpacklo_epi8(d, zero), src, a_lo);
+		__m256i hi = blend2_avx2(_mm256_unpackhi_epi8(d, zero), src, a_hi);
+		_mm256_storeu_si256((__m256i*) (dst + i), _mm256_or_si256(_mm256_packus_epi16(lo, hi), opaque));
+	}
+	// gcc does not clear the upper halves before the tail call, and legacy
+	// SSE code running with them dirty stalls for far longer than the
+	// blend itself takes on short spans
+	_mm256_zeroupper();
+	blend_span_sse2(dst + i, coverage ? coverage + i : NULL, n - i, color);
+}
+
+__attribute__((target("avx2")))
+void blend_span_image_avx2(unsigned* dst, const unsigned* src, size_t n) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i opaque = _mm256_set1_epi32((int) 0xff000000u);
+	// copies the alpha word of each pixel to its four channel words
+	const __m256i spread = _mm256_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15,
+		6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15);
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i*) (src + i));
+		__m256i d = _mm256_loadu_si256((__m256i*) (dst + i));
+		__m256i s_lo = _mm256_unpacklo_epi8(s, zero);
+		__m256i s_hi = _mm256_unpackhi_epi8(s, zero);
+		__m256i lo = blend2_avx2(_mm256_unpacklo_epi8(d, zero), s_lo, _mm256_shuffle_epi8(s_lo, spread));
+		__m256i hi = blend2_avx2(_mm256_unpackhi_epi8(d, zero), s_hi, _mm256_shuffle_epi8(s_hi, spread));
+		_mm256_storeu_si256((__m256i*) (dst + i), _mm256_or_si256(_mm256_packus_epi16(lo, hi), opaque));
+	}
+	_mm256_zeroupper();
+	blend_span_image_sse2(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void blend_span_premul_avx2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i full = _mm256_set1_epi16(255);
+	__m256i src = _mm256_unpacklo_epi8(_mm256_set1_epi32((int) color), zero);
+	__m128i ca = _mm_set1_epi16((short) (color >> 24));
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m128i c = _mm_set1_epi16(255);
+		if(coverage)
+			c = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i*) (coverage + i)));
+		__m128i a = _mm_mullo_epi16(ca, c);
+		a = _mm_add_epi16(a, _mm_set1_epi16(128));
+		a = _mm_srli_epi16(_mm_add_epi16(a, _mm_srli_epi16(a, 8)), 8);
+		// same lane order as blend_span_avx2, for both coverage and alpha
+		__m128i c0123 = _mm_unpacklo_epi16(c, c);
+		__m128i c4567 = _mm_unpackhi_epi16(c, c);
+		__m256i c_lo = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi32(c0123, c0123)), _mm_unpacklo_epi32(c4567, c4567), 1);
+		__m256i c_hi = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpackhi_epi32(c0123, c0123)), _mm_unpackhi_epi32(c4567, c4567), 1);
+		__m128i a0123 = _mm_unpacklo_epi16(a, a);
+		__m128i a4567 = _mm_unpackhi_epi16(a, a);
+		__m256i a_lo = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi32(a0123, a0123)), _mm_unpacklo_epi32(a4567, a4567), 1);
+		__m256i a_hi = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpackhi_epi32(a0123, a0123)), _mm_unpackhi_epi32(a4567, a4567), 1);
+		__m256i d = _mm256_loadu_si256((__m256i*) (dst + i));
+		__m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(src, c_lo), _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(full, a_lo)));
+		__m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(src, c_hi), _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(full, a_hi)));
+		_mm256_storeu_si256((__m256i*) (dst + i), _mm256_packus_epi16(div255_epi16_avx2(lo), div255_epi16_avx2(hi)));
+	}
+	_mm256_zeroupper();
+	blend_span_premul_sse2(dst + i, coverage ? coverage + i : NULL, n - i, color);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i linear_channel_avx2(__m256i d, __m256i ls, __m256i w, __m256i nw, int shift) {
+	// one channel of eight pixels, gathered from the tables as 32-bit
+	// loads and masked down to the entry
+	__m256i idx = _mm256_and_si256(_mm256_srli_epi32(d, shift), _mm256_set1_epi32(0xff));
+	__m256i ld = _mm256_and_si256(_mm256_i32gather_epi32((const int*) srgb_decode, idx, 2), _mm256_set1_epi32(0xffff));
+	__m256i l = _mm256_add_epi32(_mm256_mullo_epi32(ls, w), _mm256_mullo_epi32(ld, nw));
+	l = _mm256_srli_epi32(_mm256_add_epi32(l, _mm256_set1_epi32(2048)), 12);
+	__m256i c = _mm256_and_si256(_mm256_i32gather_epi32((const int*) srgb_encode, l, 1), _mm256_set1_epi32(0xff));
+	return _mm256_slli_epi32(c, shift);
+}
+
+__attribute__((target("avx2")))
+void blend_span_linear_avx2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	const __m256i ca = _mm256_set1_epi32((int) (color >> 24));
+	const __m256i full = _mm256_set1_epi32(255);
+	const __m256i lr = _mm256_set1_epi32(srgb_decode[color & 0xff]);
+	const __m256i lg = _mm256_set1_epi32(srgb_decode[(color >> 8) & 0xff]);
+	const __m256i lb = _mm256_set1_epi32(srgb_decode[(color >> 16) & 0xff]);
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m256i cov = full;
+		if(coverage)
+			cov = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (coverage + i)));
+		__m256i a = _mm256_add_epi32(_mm256_mullo_epi32(ca, cov), _mm256_set1_epi32(128));
+		a = _mm256_srli_epi32(_mm256_add_epi32(a, _mm256_srli_epi32(a, 8)), 8);
+		__m256i w = _mm256_add_epi32(a, _mm256_srli_epi32(a, 7));
+		__m256i nw = _mm256_sub_epi32(_mm256_set1_epi32(256), w);
+		__m256i d = _mm256_loadu_si256((__m256i*) (dst + i));
+		__m256i out = _mm256_set1_epi32((int) 0xff000000u);
+		out = _mm256_or_si256(out, linear_channel_avx2(d, lr, w, nw, 0));
+		out = _mm256_or_si256(out, linear_channel_avx2(d, lg, w, nw, 8));
+		out = _mm256_or_si256(out, linear_channel_avx2(d, lb, w, nw, 16));
+		_mm256_storeu_si256((__m256i*) (dst + i), out);
+	}
+	_mm256_zeroupper();
+	blend_span_linear_scalar(dst + i, coverage ? coverage + i : NULL, n - i, color);
+}
+
+__attribute__((target("avx2")))
+void pack_bgra_avx2(uint8_t* dst, const unsigned* src, size_t n) {
+	const __m256i order = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m256i px = _mm256_loadu_si256((const __m256i*) (src + i));
+		_mm256_storeu_si256((__m256i*) (dst + 4 * i), _mm256_shuffle_epi8(px, order));
+	}
+	_mm256_zeroupper();
+	pack_bgra_sse2(dst + 4 * i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i over_background_avx2(__m256i px, __m256i bg) {
+	// see over_background_sse2
+	__m256i d = _mm256_sub_epi16(px, bg);
+	__m256i sign = _mm256_srai_epi16(d, 15);
+	d = _mm256_sub_epi16(_mm256_xor_si256(d, sign), sign);
+	__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	__m256i p = _mm256_mullo_epi16(d, a);
+	p = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(p, _mm256_set1_epi16(1)), _mm256_srli_epi16(p, 8)), 8);
+	return _mm256_add_epi16(bg, _mm256_sub_epi16(_mm256_xor_si256(p, sign), sign));
+}
+
+__attribute__((target("avx2")))
+void pack_bgr_avx2(uint8_t* dst, const unsigned* src, size_t n, unsigned background) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i bg = _mm256_unpacklo_epi8(_mm256_set1_epi32((int) background), zero);
+	// each lane packs its four pixels into its low 12 bytes
+	const __m256i order = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	size_t i = 0;
+	// the lanes are stored 12 bytes apart as 16 bytes each, the last 4
+	// bytes land on the next pixels and are overwritten, so two pixels
+	// have to be left for the tail
+	for(; i + 10 <= n; i += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i*) (src + i));
+		__m256i lo = over_background_avx2(_mm256_unpacklo_epi8(s, zero), bg);
+		__m256i hi = over_background_avx2(_mm256_unpackhi_epi8(s, zero), bg);
+		__m256i px = _mm256_shuffle_epi8(_mm256_packus_epi16(lo, hi), order);
+		_mm_storeu_si128((__m128i*) (dst + 3 * i), _mm256_castsi256_si128(px));
+		_mm_storeu_si128((__m128i*) (dst + 3 * i + 12), _mm256_extracti128_si256(px, 1));
+	}
+	_mm256_zeroupper();
+	pack_bgr_sse2(dst + 3 * i, src + i, n - i, background);
+}
+
+#else
+
+void blend_span_linear_avx2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	blend_span_linear_scalar(dst, coverage, n, color);
+}
+
+void blend_span_premul_avx2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	blend_span_premul_sse2(dst, coverage, n, color);
+}
+
+void blend_span_avx2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	blend_span_sse2(dst, coverage, n, color);
+}
+
+void blend_span_image_avx2(unsigned* dst, const unsigned* src, size_t n) {
+	blend_span_image_sse2(dst, src, n);
+}
+
+void pack_bgra_avx2(uint8_t* dst, const unsigned* src, size_t n) {
+	pack_bgra_sse2(dst, src, n);
+}
+
+void pack_bgr_avx2(uint8_t* dst, const unsigned* src, size_t n, unsigned background) {
+	pack_bgr_sse2(dst, src, n, background);
+}
+
+#endif
+
+static void blend_span_detect(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+static void blend_span_image_detect(unsigned* dst, const unsigned* src, size_t n);
+static void blend_span_premul_detect(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+static void blend_span_image_premul_detect(unsigned* dst, const unsigned* src, size_t n);
+static void blend_span_linear_detect(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+static void blend_span_f32_detect(float* dst, const uint8_t* coverage, size_t n, unsigned color);
+static void pack_bgra_detect(uint8_t* dst, const unsigned* src, size_t n);
+static void pack_bgr_detect(uint8_t* dst, const unsigned* src, size_t n, unsigned background);
+
+// resolved on first use. threads that race here all store the same
+// values and the code the pointers lead to needs no ordering, so relaxed
+// atomic loads and stores are enough, and cost a plain mov
+#define IMPL_LOAD(p) __atomic_load_n(&(p), __ATOMIC_RELAXED)
+#define IMPL_STORE(p, f) __atomic_store_n(&(p), (f), __ATOMIC_RELAXED)
+
+static void (*blend_span_impl)(unsigned*, const uint8_t*, size_t, unsigned) = blend_span_detect;
+static void (*blend_span_image_impl)(unsigned*, const unsigned*, size_t) = blend_span_image_detect;
+static void (*blend_span_premul_impl)(unsigned*, const uint8_t*, size_t, unsigned) = blend_span_premul_detect;
+static void (*blend_span_image_premul_impl)(unsigned*, const unsigned*, size_t) = blend_span_image_premul_detect;
+static void (*blend_span_linear_impl)(unsigned*, const uint8_t*, size_t, unsigned) = blend_span_linear_detect;
+static void (*blend_span_f32_impl)(float*, const uint8_t*, size_t, unsigned) = blend_span_f32_detect;
+static void (*pack_bgra_impl)(uint8_t*, const unsigned*, size_t) = pack_bgra_detect;
+static void (*pack_bgr_impl)(uint8_t*, const unsigned*, size_t, unsigned) = pack_bgr_detect;
+
+static void blend_detect(void) {
+#if defined(BLEND_X86)
+	if(__builtin_cpu_supports("avx2")) {
+		IMPL_STORE(blend_span_impl, blend_span_avx2);
+		IMPL_STORE(blend_span_image_impl, blend_span_image_avx2);
+		IMPL_STORE(blend_span_premul_impl, blend_span_premul_avx2);
+		IMPL_STORE(blend_span_linear_impl, blend_span_linear_avx2);
+		IMPL_STORE(pack_bgra_impl, pack_bgra_avx2);
+		IMPL_STORE(pack_bgr_impl, pack_bgr_avx2);
+	}
+	else {
+		IMPL_STORE(blend_span_impl, blend_span_sse2);
+		IMPL_STORE(blend_span_image_impl, blend_span_image_sse2);
+		IMPL_STORE(blend_span_premul_impl, blend_span_premul_sse2);
+		IMPL_STORE(blend_span_linear_impl, blend_span_linear_scalar);
+		IMPL_STORE(pack_bgra_impl, pack_bgra_sse2);
+		IMPL_STORE(pack_bgr_impl, pack_bgr_sse2);
+	}
+	IMPL_STORE(blend_span_image_premul_impl, blend_span_image_premul_sse2);
+	IMPL_STORE(blend_span_f32_impl, blend_span_f32_sse2);
+#else
+	IMPL_STORE(blend_span_impl, blend_span_scalar);
+	IMPL_STORE(blend_span_image_impl, blend_span_image_scalar);
+	IMPL_STORE(blend_span_premul_impl, blend_span_premul_scalar);
+	IMPL_STORE(blend_span_image_premul_impl, blend_span_image_premul_scalar);
+	IMPL_STORE(blend_span_linear_impl, blend_span_linear_scalar);
+	IMPL_STORE(blend_span_f32_impl, blend_span_f32_scalar);
+	IMPL_STORE(pack_bgra_impl, pack_bgra_scalar);
+	IMPL_STORE(pack_bgr_impl, pack_bgr_scalar);
+#endif
+}
+
+static void blend_span_detect(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	blend_detect();
+	IMPL_LOAD(blend_span_impl)(dst, coverage, n, color);
+}
+
+static void blend_span_image_detect(unsigned* dst, const unsigned* src, size_t n) {
+	blend_detect();
+	IMPL_LOAD(blend_span_image_impl)(dst, src, n);
+}
+
+static void blend_span_premul_detect(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	blend_detect();
+	IMPL_LOAD(blend_span_premul_impl)(dst, coverage, n, color);
+}
+
+static void blend_span_image_premul_detect(unsigned* dst, const unsigned* src, size_t n) {
+	blend_detect();
+	IMPL_LOAD(blend_span_image_premul_impl)(dst, src, n);
+}
+
+static void blend_span_linear_detect(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	blend_detect();
+	IMPL_LOAD(blend_span_linear_impl)(dst, coverage, n, color);
+}
+
+static void blend_span_f32_detect(float* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	blend_detect();
+	IMPL_LOAD(blend_span_f32_impl)(dst, coverage, n, color);
+}
+
+static void pack_bgra_detect(uint8_t* dst, const unsigned* src, size_t n) {
+	blend_detect();
+	IMPL_LOAD(pack_bgra_impl)(dst, src, n);
+}
+
+static void pack_bgr_detect(uint8_t* dst, const unsigned* src, size_t n, unsigned background) {
+	blend_detect();
+	IMPL_LOAD(pack_bgr_impl)(dst, src, n, background);
+}
+
+void blend_span(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	IMPL_LOAD(blend_span_impl)(dst, coverage, n, color);
+}
+
+void blend_span_image(unsigned* dst, const unsigned* src, size_t n) {
+	IMPL_LOAD(blend_span_image_impl)(dst, src, n);
+}
+
+void blend_span_premul(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	IMPL_LOAD(blend_span_premul_impl)(dst, coverage, n, color);
+}
+
+void blend_span_image_premul(unsigned* dst, const unsigned* src, size_t n) {
+	IMPL_LOAD(blend_span_image_premul_impl)(dst, src, n);
+}
+
+void blend_span_linear(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	IMPL_LOAD(blend_span_linear_impl)(dst, coverage, n, color);
+}
+
+void blend_span_f32(float* dst, const uint8_t* coverage, size_t n, unsigned color) {
+	IMPL_LOAD(blend_span_f32_impl)(dst, coverage, n, color);
+}
+
+void pack_bgra(uint8_t* dst, const unsigned* src, size_t n) {
+	IMPL_LOAD(pack_bgra_impl)(dst, src, n);
+}
+
+void pack_bgr(uint8_t* dst, const unsigned* src, size_t n, unsigned background) {
+	IMPL_LOAD(pack_bgr_impl)(dst, src, n, background);
+}
@@ -0,0 +1,456 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "srgb.h"
+
+// integer blend kernels for packed rgba32 pixels
+//
+// all of the kernels compute the same thing, bit for bit:
+//   a = div255(color.a * coverage)
+//   out.c = div255(color.c * a + dst.c * (255 - a))
+//   out.a = 0xff
+// where div255 rounds to nearest. blend_span_scalar is the reference the
+// SIMD versions are checked against
+
+/**
+ * @brief Divide by 255 rounding to nearest, exact for x in [0, 255 * 255]
+ *
+ * @param x value to divide
+ *
+ * @return x / 255 rounded to nearest
+ */
+static inline unsigned div255(unsigned x) {
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+/**
+ * @brief Blend one color over one pixel with 8-bit coverage
+ *
+ * @param dst packed rgba32 pixel underneath
+ * @param color packed rgba32 color to draw
+ * @param coverage coverage of the pixel from 0 to 255
+ *
+ * @return the blended pixel
+ */
+static inline unsigned blend_px(unsigned dst, unsigned color, unsigned coverage) {
+	unsigned a = div255((color >> 24) * coverage);
+	unsigned na = 255 - a;
+	unsigned r = div255((color & 0xff) * a + (dst & 0xff) * na);
+	unsigned g = div255(((color >> 8) & 0xff) * a + ((dst >> 8) & 0xff) * na);
+	unsigned b = div255(((color >> 16) & 0xff) * a + ((dst >> 16) & 0xff) * na);
+	return 0xff000000u | b << 16 | g << 8 | r;
+}
+
+/**
+ * @brief Blend one color over a run of pixels, reference scalar kernel
+ *
+ * @param dst pixels to blend into
+ * @param coverage one coverage value per pixel, or NULL for full coverage
+ * @param n number of pixels
+ * @param color packed rgba32 color to draw
+ */
+void blend_span_scalar(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief SSE2 version of blend_span_scalar, 4 pixels per iteration
+ */
+void blend_span_sse2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief AVX2 version of blend_span_scalar, 8 pixels per iteration
+ *
+ * Only call this when the cpu supports AVX2, blend_span checks for you.
+ */
+void blend_span_avx2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief Blend a run of pixels with the fastest kernel the cpu supports
+ *
+ * @param dst pixels to blend into
+ * @param coverage one coverage value per pixel, or NULL for full coverage
+ * @param n number of pixels
+ * @param color packed rgba32 color to draw
+ */
+void blend_span(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief Blend a run of source pixels over a run of pixels, reference kernel
+ *
+ * Each source pixel is blended with its own alpha, the same as
+ * blend_px(dst[i], src[i], 255).
+ *
+ * @param dst pixels to blend into
+ * @param src packed rgba32 pixels to draw
+ * @param n number of pixels
+ */
+void blend_span_image_scalar(unsigned* dst, const unsigned* src, size_t n);
+
+/**
+ * @brief SSE2 version of blend_span_image_scalar
+ */
+void blend_span_image_sse2(unsigned* dst, const unsigned* src, size_t n);
+
+/**
+ * @brief AVX2 version of blend_span_image_scalar
+ *
+ * Only call this when the cpu supports AVX2, blend_span_image checks for you.
+ */
+void blend_span_image_avx2(unsigned* dst, const unsigned* src, size_t n);
+
+/**
+ * @brief Blend source pixels with the fastest kernel the cpu supports
+ *
+ * @param dst pixels to blend into
+ * @param src packed rgba32 pixels to draw
+ * @param n number of pixels
+ */
+void blend_span_image(unsigned* dst, const unsigned* src, size_t n);
+
+// premultiplied kernels, for framebuffers that store every channel
+// already scaled by alpha. coverage is then one multiply on all four
+// channels and OVER needs no divide by the result's alpha:
+//   a = div255(color.a * coverage)
+//   out = div255(color * coverage + dst * (255 - a))   for r, g, b and a
+// the color passed in must itself be premultiplied, see premultiply
+
+/**
+ * @brief Scale the color channels of a straight alpha color by its alpha
+ *
+ * @param color packed rgba32 color with straight alpha
+ *
+ * @return the same color premultiplied
+ */
+static inline unsigned premultiply(unsigned color) {
+	unsigned a = color >> 24;
+	unsigned r = div255((color & 0xff) * a);
+	unsigned g = div255(((color >> 8) & 0xff) * a);
+	unsigned b = div255(((color >> 16) & 0xff) * a);
+	return a << 24 | b << 16 | g << 8 | r;
+}
+
+/**
+ * @brief Undo premultiply, rounding to nearest
+ *
+ * @param color packed rgba32 color with premultiplied alpha
+ *
+ * @return the same color with straight alpha, 0 when alpha is 0
+ */
+static inline unsigned unpremultiply(unsigned color) {
+	unsigned a = color >> 24;
+	if(a == 255 || a == 0)
+		return a ? color : 0;
+	unsigned half = a / 2, out = a << 24;
+	for(int shift = 0; shift < 24; shift += 8) {
+		unsigned c = (((color >> shift) & 0xff) * 255 + half) / a;
+		out |= (c > 255 ? 255 : c) << shift;
+	}
+	return out;
+}
+
+/**
+ * @brief Blend one premultiplied color over one premultiplied pixel
+ *
+ * @param dst packed premultiplied pixel underneath
+ * @param color packed premultiplied color to draw
+ * @param coverage coverage of the pixel from 0 to 255
+ *
+ * @return the blended pixel
+ */
+static inline unsigned blend_px_premul(unsigned dst, unsigned color, unsigned coverage) {
+	unsigned out = 0;
+	unsigned na = 255 - div255((color >> 24) * coverage);
+	for(int shift = 0; shift < 32; shift += 8)
+		out |= div255(((color >> shift) & 0xff) * coverage + ((dst >> shift) & 0xff) * na) << shift;
+	return out;
+}
+
+/**
+ * @brief Premultiplied blend_span_scalar, the reference kernel
+ *
+ * @param dst premultiplied pixels to blend into
+ * @param coverage one coverage value per pixel, or NULL for full coverage
+ * @param n number of pixels
+ * @param color packed premultiplied color to draw
+ */
+void blend_span_premul_scalar(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief SSE2 version of blend_span_premul_scalar, 4 pixels per iteration
+ */
+void blend_span_premul_sse2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief AVX2 version of blend_span_premul_scalar, 8 pixels per iteration
+ *
+ * Only call this when the cpu supports AVX2, blend_span_premul checks for you.
+ */
+void blend_span_premul_avx2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief Premultiplied blend_span with the fastest kernel the cpu supports
+ *
+ * @param dst premultiplied pixels to blend into
+ * @param coverage one coverage value per pixel, or NULL for full coverage
+ * @param n number of pixels
+ * @param color packed premultiplied color to draw
+ */
+void blend_span_premul(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief Blend premultiplied source pixels over premultiplied pixels, reference kernel
+ *
+ * @param dst premultiplied pixels to blend into
+ * @param src premultiplied pixels to draw
+ * @param n number of pixels
+ */
+void blend_span_image_premul_scalar(unsigned* dst, const unsigned* src, size_t n);
+
+/**
+ * @brief SSE2 version of blend_span_image_premul_scalar
+ */
+void blend_span_image_premul_sse2(unsigned* dst, const unsigned* src, size_t n);
+
+/**
+ * @brief Premultiplied blend_span_image with the fastest kernel the cpu supports
+ *
+ * @param dst premultiplied pixels to blend into
+ * @param src premultiplied pixels to draw
+ * @param n number of pixels
+ */
+void blend_span_image_premul(unsigned* dst, const unsigned* src, size_t n);
+
+// linear light kernels, for straight framebuffers that blend in linear
+// light instead of on the stored sRGB values. coverage weights become
+// 0 to 256 so the blend shifts straight into an encode index:
+//   a = div255(color.a * coverage), w = a + (a >> 7)
+//   out.c = encode((decode(color.c) * w + decode(dst.c) * (256 - w) + 2048) >> 12)
+//   out.a = 0xff
+// see srgb.h for the tables
+
+/**
+ * @brief Blend one color over one pixel in linear light
+ *
+ * @param dst packed rgba32 pixel underneath
+ * @param color packed rgba32 color to draw
+ * @param coverage coverage of the pixel from 0 to 255
+ *
+ * @return the blended pixel
+ */
+static inline unsigned blend_px_linear(unsigned dst, unsigned color, unsigned coverage) {
+	unsigned a = div255((color >> 24) * coverage);
+	unsigned w = a + (a >> 7);
+	unsigned out = 0xff000000u;
+	for(int shift = 0; shift < 24; shift += 8) {
+		unsigned l = srgb_decode[(color >> shift) & 0xff] * w + srgb_decode[(dst >> shift) & 0xff] * (256 - w);
+		out |= (unsigned) srgb_encode[(l + 2048) >> 12] << shift;
+	}
+	return out;
+}
+
+/**
+ * @brief Linear light blend_span_scalar, the reference kernel
+ *
+ * @param dst pixels to blend into
+ * @param coverage one coverage value per pixel, or NULL for full coverage
+ * @param n number of pixels
+ * @param color packed rgba32 color to draw
+ */
+void blend_span_linear_scalar(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief AVX2 version of blend_span_linear_scalar, 8 pixels per iteration with gathers
+ *
+ * Only call this when the cpu supports AVX2, blend_span_linear checks for you.
+ */
+void blend_span_linear_avx2(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief Linear light blend_span with the fastest kernel the cpu supports
+ *
+ * @param dst pixels to blend into
+ * @param coverage one coverage value per pixel, or NULL for full coverage
+ * @param n number of pixels
+ * @param color packed rgba32 color to draw
+ */
+void blend_span_linear(unsigned* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief Blend source pixels over pixels in linear light
+ *
+ * @param dst pixels to blend into
+ * @param src packed rgba32 pixels to draw
+ * @param n number of pixels
+ */
+void blend_span_image_linear(unsigned* dst, const unsigned* src, size_t n);
+
+// wide formats, straight alpha like blend_px but nothing is rounded
+// before the store. the alpha stays the full product of color.a and
+// coverage, out of 65025:
+//   rgba16: out.c = (c * 257 * a + dst.c * (65025 - a) + 32512) / 65025
+//   float:  out.c = dst.c + (c / 255 - dst.c) * a / 65025
+//   out.a = 65535 or 1.0
+// pixels are r, g, b, a in memory, the same order as rgba32
+
+/**
+ * @brief Blend one rgba32 color over one 16-bit per channel pixel
+ *
+ * @param dst the four channels of the pixel underneath
+ * @param color packed rgba32 color to draw
+ * @param coverage coverage of the pixel from 0 to 255
+ */
+static inline void blend_px_rgba16(uint16_t* dst, unsigned color, unsigned coverage) {
+	unsigned a = (color >> 24) * coverage;
+	for(int c = 0; c < 3; c++) {
+		unsigned s = ((color >> (8 * c)) & 0xff) * 257;
+		dst[c] = (uint16_t) ((s * a + dst[c] * (65025 - a) + 32512) / 65025);
+	}
+	dst[3] = 0xffff;
+}
+
+/**
+ * @brief Blend one rgba32 color over one float pixel
+ *
+ * @param dst the four channels of the pixel underneath
+ * @param color packed rgba32 color to draw
+ * @param coverage coverage of the pixel from 0 to 255
+ */
+static inline void blend_px_f32(float* dst, unsigned color, unsigned coverage) {
+	float a = (float) ((color >> 24) * coverage) * (1.0f / 65025);
+	for(int c = 0; c < 3; c++)
+		dst[c] += ((float) ((color >> (8 * c)) & 0xff) * (1.0f / 255) - dst[c]) * a;
+	dst[3] = 1.0f;
+}
+
+/**
+ * @brief Blend a color over a run of 16-bit per channel pixels
+ *
+ * The divide by 65025 compiles to a multiply, there is no SIMD version.
+ *
+ * @param dst 4 * n channels to blend into
+ * @param coverage one coverage value per pixel, or NULL for full coverage
+ * @param n number of pixels
+ * @param color packed rgba32 color to draw
+ */
+void blend_span_rgba16(uint16_t* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief Blend a color over a run of float pixels, the reference kernel
+ *
+ * @param dst 4 * n channels to blend into
+ * @param coverage one coverage value per pixel, or NULL for full coverage
+ * @param n number of pixels
+ * @param color packed rgba32 color to draw
+ */
+void blend_span_f32_scalar(float* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief SSE2 version of blend_span_f32_scalar, one pixel per register
+ */
+void blend_span_f32_sse2(float* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief blend_span_f32 with the fastest kernel the cpu supports
+ *
+ * @param dst 4 * n channels to blend into
+ * @param coverage one coverage value per pixel, or NULL for full coverage
+ * @param n number of pixels
+ * @param color packed rgba32 color to draw
+ */
+void blend_span_f32(float* dst, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief Blend straight alpha float pixels over float pixels
+ *
+ * @param dst 4 * n channels to blend into
+ * @param src 4 * n channels to draw
+ * @param n number of pixels
+ */
+void blend_span_image_f32(float* dst, const float* src, size_t n);
+
+// fills bigger than this bypass the cache with non-temporal stores, the
+// pixels would be evicted before anything reads them again anyway
+#define FILL_STREAM_BYTES ((size_t) 8 << 20)
+
+/**
+ * @brief Set a run of pixels to one color
+ *
+ * @param dst pixels to set
+ * @param n number of pixels
+ * @param color packed rgba32 color to store
+ * @param stream use non-temporal stores that skip the cache
+ */
+void fill_span(unsigned* dst, size_t n, unsigned color, int stream);
+
+// row conversions for image writers. 24-bit files have no alpha, so the
+// pixels are composited over an opaque background the same way
+// stb_image_write does it:
+//   out.c = bg.c + (c - bg.c) * a / 255
+// with the division truncating toward zero
+
+/**
+ * @brief Convert rgba32 pixels to b, g, r, a bytes, reference kernel
+ *
+ * @param dst 4 * n bytes to write
+ * @param src packed rgba32 pixels
+ * @param n number of pixels
+ */
+void pack_bgra_scalar(uint8_t* dst, const unsigned* src, size_t n);
+
+/**
+ * @brief SSE2 version of pack_bgra_scalar
+ */
+void pack_bgra_sse2(uint8_t* dst, const unsigned* src, size_t n);
+
+/**
+ * @brief AVX2 version of pack_bgra_scalar
+ *
+ * Only call this when the cpu supports AVX2, pack_bgra checks for you.
+ */
+void pack_bgra_avx2(uint8_t* dst, const unsigned* src, size_t n);
+
+/**
+ * @brief Convert rgba32 pixels to b, g, r, a bytes with the fastest kernel the cpu supports
+ *
+ * @param dst 4 * n bytes to write
+ * @param src packed rgba32 pixels
+ * @param n number of pixels
+ */
+void pack_bgra(uint8_t* dst, const unsigned* src, size_t n);
+
+/**
+ * @brief Composite rgba32 pixels over a background into b, g, r bytes, reference kernel
+ *
+ * @param dst 3 * n bytes to write
+ * @param src packed rgba32 pixels
+ * @param n number of pixels
+ * @param background rgba32 color underneath, its alpha is ignored
+ */
+void pack_bgr_scalar(uint8_t* dst, const unsigned* src, size_t n, unsigned background);
+
+/**
+ * @brief SSE2 version of pack_bgr_scalar
+ */
+void pack_bgr_sse2(uint8_t* dst, const unsigned* src, size_t n, unsigned background);
+
+/**
+ * @brief AVX2 version of pack_bgr_scalar
+ *
+ * Only call this when the cpu supports AVX2, pack_bgr checks for you.
+ */
+void pack_bgr_avx2(uint8_t* dst, const unsigned* src, size_t n, unsigned background);
+
+/**
+ * @brief Composite rgba32 pixels into b, g, r bytes with the fastest kernel the cpu supports
+ *
+ * @param dst 3 * n bytes to write
+ * @param src packed rgba32 pixels
+ * @param n number of pixels
+ * @param background rgba32 color underneath, its alpha is ignored
+ */
+void pack_bgr(uint8_t* dst, const unsigned* src, size_t n, unsigned background);
+
+#endif
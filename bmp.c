@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bmp.h"
+
+// rows are stored bottom up, each padded to a multiple of 4 bytes
+
+typedef struct {
+	int w;
+	const unsigned* pixels; /**< whole image, for bmp_write_pixels */
+	framebuffer_t* fb; /**< for bmp_write_framebuffer */
+} bmp_source_t;
+
+static const unsigned* source_row(bmp_source_t* src, int y, unsigned* scratch) {
+	if(src->fb)
+		return framebuffer_row(src->fb, y, scratch);
+	return src->pixels + (size_t) src->w * y;
+}
+
+static uint8_t* put_le(uint8_t* p, uint32_t v, int bytes) {
+	for(int i = 0; i < bytes; i++)
+		*p++ = (uint8_t) (v >> (8 * i));
+	return p;
+}
+
+static size_t put_header(uint8_t* p, int w, int h, int bits, size_t stride) {
+	// BITMAPINFOHEADER for 24 bits, the same fields stb_image_write writes.
+	// BITMAPV4HEADER with BI_BITFIELDS masks for 32 bits, without them
+	// readers take the fourth byte as padding
+	size_t info = bits == 24 ? 40 : 108;
+	uint32_t data = (uint32_t) (stride * h);
+	uint8_t* q = p;
+	*q++ = 'B';
+	*q++ = 'M';
+	q = put_le(q, (uint32_t) (14 + info) + data, 4);
+	q = put_le(q, 0, 4);
+	q = put_le(q, (uint32_t) (14 + info), 4);
+	q = put_le(q, (uint32_t) info, 4);
+	q = put_le(q, (uint32_t) w, 4);
+	q = put_le(q, (uint32_t) h, 4);
+	q = put_le(q, 1, 2);
+	q = put_le(q, (uint32_t) bits, 2);
+	if(bits == 24) {
+		memset(q, 0, 24);
+		return 14 + info;
+	}
+	q = put_le(q, 3, 4);
+	q = put_le(q, data, 4);
+	memset(q, 0, 16);
+	q += 16;
+	q = put_le(q, 0x00ff0000, 4);
+	q = put_le(q, 0x0000ff00, 4);
+	q = put_le(q, 0x000000ff, 4);
+	q = put_le(q, 0xff000000, 4);
+	// 'sRGB', which makes the endpoints and gammas after it unused
+	q = put_le(q, 0x73524742, 4);
+	memset(q, 0, 48);
+	return 14 + info;
+}
+
+static int write_bmp_source(const char* path, int w, int h, int bits, bmp_source_t* src) {
+	if(w <= 0 || h <= 0 || (bits != 24 && bits != 32))
+		return 0;
+	size_t bytes = (size_t) w * (bits / 8);
+	size_t stride = (bytes + 3) & ~(size_t) 3;
+	// every size in the headers is 32 bits
+	if((uint64_t) stride * h + 122 > UINT32_MAX)
+		return 0;
+	size_t cap = stride > BMP_CHUNK ? stride : BMP_CHUNK;
+	uint8_t* buf = malloc(cap);
+	unsigned* scratch = malloc((size_t) w * sizeof(unsigned));
+	FILE* f = buf && scratch ? fopen(path, "wb") : NULL;
+	if(!f) {
+		free(buf);
+		free(scratch);
+		return 0;
+	}
+	int ok = 1;
+	size_t fill = put_header(buf, w, h, bits, stride);
+	for(int y = h - 1; ok && y >= 0; y--) {
+		if(fill + stride > cap) {
+			ok = fwrite(buf, 1, fill, f) == fill;
+			fill = 0;
+		}
+		const unsigned* row = source_row(src, y, scratch);
+		if(bits == 24)
+			pack_bgr(buf + fill, row, w, BMP_BACKGROUND);
+		else
+			pack_bgra(buf + fill, row, w);
+		memset(buf + fill + bytes, 0, stride - bytes);
+		fill += stride;
+	}
+	ok = ok && fwrite(buf, 1, fill, f) == fill;
+	ok = fclose(f) == 0 && ok;
+	free(buf);
+	free(scratch);
+	return ok;
+}
+
+int bmp_write_pixels(const char* path, int w, int h, int bits, const unsigned* pixels) {
+	bmp_source_t src = {.w = w, .pixels = pixels};
+	return write_bmp_source(path, w, h, bits, &src);
+}
+
+int bmp_write_framebuffer(framebuffer_t* fb, const char* path, int bits) {
+	bmp_source_t src = {.w = fb->width, .fb = fb};
+	return write_bmp_source(path, fb->width, fb->height, bits, &src);
+}
@@ -0,0 +1,44 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include "framebuffer.h"
+
+// bulk BMP writer
+//
+// rows are converted with pack_bgr or pack_bgra into one large buffer
+// and the buffer is written whenever it fills, instead of a write call
+// per pixel. 24-bit files are composited over BMP_BACKGROUND like
+// stb_image_write does, byte for byte. 32-bit files keep the alpha and
+// carry a BITMAPV4HEADER with channel masks so readers know about it
+
+// bytes gathered before they are written
+#define BMP_CHUNK ((size_t) 1 << 20)
+
+// what transparent pixels of 24-bit files show, the same pink as stb
+#define BMP_BACKGROUND 0xffff00ffu
+
+/**
+ * @brief Write rgba32 pixels as a BMP
+ *
+ * @param path file to write
+ * @param w width in pixels
+ * @param h height in pixels
+ * @param bits 24 for b, g, r composited over BMP_BACKGROUND, 32 for b, g, r, a
+ * @param pixels w * h straight alpha rgba32 pixels, row by row from the top
+ *
+ * @return 1 on success, 0 on failure
+ */
+int bmp_write_pixels(const char* path, int w, int h, int bits, const unsigned* pixels);
+
+/**
+ * @brief Write any framebuffer as a BMP, one framebuffer_row at a time
+ *
+ * @param fb framebuffer to write
+ * @param path file to write
+ * @param bits 24 or 32, see bmp_write_pixels
+ *
+ * @return 1 on success, 0 on failure
+ */
+int bmp_write_framebuffer(framebuffer_t* fb, const char* path, int bits);
+
+#endif
@@ -0,0 +1,601 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "deflate.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DEFLATE_X86 1
+#include <immintrin.h>
+#endif
+
+// RFC 1950 and 1951. matches are found through hash chains of four byte
+// prefixes and taken greedily, every DEFLATE_BLOCK symbols are written as
+// one block with Huffman codes built for it
+
+#define MAX_MATCH 258
+
+// matches are only looked for from this long up, length 3 matches seldom
+// take fewer bits than their literals and chasing them costs more than
+// they save on filtered image rows
+#define HASH_BYTES 4
+
+#define LITLEN_CODES 286
+#define DIST_CODES 30
+#define CLEN_CODES 19
+
+static const uint16_t len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t clen_order[CLEN_CODES] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+typedef struct {
+	int chain; /**< positions tried per match search */
+	int nice; /**< a match this long ends the search */
+	int insert; /**< longer matches leave their inner positions out of the chains */
+} level_t;
+
+// the low levels settle for shorter matches, and the fastest one skips the
+// inside of long matches, which is where its time goes on runs of filtered
+// background
+static const level_t levels[10] = {
+	{0, 0, 0},
+	{2, 32, 64},
+	{4, 64, MAX_MATCH},
+	{8, 128, MAX_MATCH},
+	{16, 128, MAX_MATCH},
+	{32, MAX_MATCH, MAX_MATCH},
+	{64, MAX_MATCH, MAX_MATCH},
+	{256, MAX_MATCH, MAX_MATCH},
+	{1024, MAX_MATCH, MAX_MATCH},
+	{4096, MAX_MATCH, MAX_MATCH}
+};
+
+static inline int len_code(int len) {
+	// four codes per power of two above 10, 258 has its own
+	if(len <= 10)
+		return len - 3;
+	if(len == MAX_MATCH)
+		return 28;
+	unsigned v = len - 3;
+	int bits = 31 - __builtin_clz(v);
+	return 4 * (bits - 1) + ((v >> (bits - 2)) & 3);
+}
+
+static inline int dist_code(int dist) {
+	// two codes per power of two above 4
+	unsigned v = dist - 1;
+	if(v < 4)
+		return v;
+	int bits = 31 - __builtin_clz(v);
+	return 2 * bits + ((v >> (bits - 1)) & 1);
+}
+
+// the most bytes that can be summed before b overflows 32 bits
+#define ADLER_NMAX 5552
+
+uint32_t adler32_scalar(uint32_t adler, const void* data, size_t n) {
+	const uint8_t* p = (const uint8_t*) data;
+	uint32_t a = adler & 0xffff, b = adler >> 16;
+	while(n > 0) {
+		size_t k = n < ADLER_NMAX ? n : ADLER_NMAX;
+		n -= k;
+		while(k--) {
+			a += *p++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return b << 16 | a;
+}
+
+#if defined(DEFLATE_X86)
+__attribute__((target("avx2"))) uint32_t adler32_avx2(uint32_t adler, const void* data, size_t n) {
+	// 32 bytes at a time: a gains their sum, b gains 32 times a before the
+	// step plus the bytes weighted 32 down to 1. the a before each step is
+	// summed up in prefix and multiplied by 32 once per run
+	const uint8_t* p = (const uint8_t*) data;
+	const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+		16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i zero = _mm256_setzero_si256();
+	uint32_t a = adler & 0xffff, b = adler >> 16;
+	while(n >= 32) {
+		size_t k = n < ADLER_NMAX ? n : ADLER_NMAX;
+		k &= ~(size_t) 31;
+		n -= k;
+		__m256i va = _mm256_setr_epi32(a, 0, 0, 0, 0, 0, 0, 0);
+		__m256i vb = _mm256_setr_epi32(b, 0, 0, 0, 0, 0, 0, 0);
+		__m256i prefix = zero;
+		for(; k > 0; k -= 32, p += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i*) p);
+			prefix = _mm256_add_epi32(prefix, va);
+			va = _mm256_add_epi32(va, _mm256_sad_epu8(v, zero));
+			vb = _mm256_add_epi32(vb, _mm256_madd_epi16(_mm256_maddubs_epi16(v, weights), ones));
+		}
+		vb = _mm256_add_epi32(vb, _mm256_slli_epi32(prefix, 5));
+		// every lane is at most the whole sum, which fits
+		__m128i sa = _mm_add_epi32(_mm256_castsi256_si128(va), _mm256_extracti128_si256(va, 1));
+		__m128i sb = _mm_add_epi32(_mm256_castsi256_si128(vb), _mm256_extracti128_si256(vb, 1));
+		sa = _mm_add_epi32(sa, _mm_shuffle_epi32(sa, 0x4e));
+		sb = _mm_add_epi32(sb, _mm_shuffle_epi32(sb, 0x4e));
+		sa = _mm_add_epi32(sa, _mm_shuffle_epi32(sa, 0xb1));
+		sb = _mm_add_epi32(sb, _mm_shuffle_epi32(sb, 0xb1));
+		a = (uint32_t) _mm_cvtsi128_si32(sa) % 65521;
+		b = (uint32_t) _mm_cvtsi128_si32(sb) % 65521;
+	}
+	_mm256_zeroupper();
+	return adler32_scalar(b << 16 | a, p, n);
+}
+#else
+uint32_t adler32_avx2(uint32_t adler, const void* data, size_t n) {
+	return adler32_scalar(adler, data, n);
+}
+#endif
+
+static uint32_t adler32_detect(uint32_t adler, const void* data, size_t n);
+
+// resolved on first use. threads that race here store the same value,
+// so relaxed atomics are enough
+static uint32_t (*adler32_impl)(uint32_t, const void*, size_t) = adler32_detect;
+
+static uint32_t adler32_detect(uint32_t adler, const void* data, size_t n) {
+#if defined(DEFLATE_X86)
+	uint32_t (*impl)(uint32_t, const void*, size_t) = __builtin_cpu_supports("avx2") ? adler32_avx2 : adler32_scalar;
+#else
+	uint32_t (*impl)(uint32_t, const void*, size_t) = adler32_scalar;
+#endif
+	__atomic_store_n(&adler32_impl, impl, __ATOMIC_RELAXED);
+	return impl(adler, data, n);
+}
+
+uint32_t adler32(uint32_t adler, const void* data, size_t n) {
+	return __atomic_load_n(&adler32_impl, __ATOMIC_RELAXED)(adler, data, n);
+}
+
+uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, uint64_t len2) {
+	// a of the second piece is offset by the a of the first, and every one
+	// of its len2 bytes added that offset to b
+	uint32_t rem = (uint32_t) (len2 % 65521);
+	uint32_t a1 = adler1 & 0xffff, b1 = adler1 >> 16;
+	uint32_t a2 = adler2 & 0xffff, b2 = adler2 >> 16;
+	uint32_t a = (a1 + a2 + 65521 - 1) % 65521;
+	uint32_t b = (uint32_t) (((uint64_t) rem * a1 + b1 + b2 + 65521 - rem) % 65521);
+	return b << 16 | a;
+}
+
+static int reserve(deflate_t* z, size_t n) {
+	if(z->out_len + n <= z->out_cap)
+		return 1;
+	size_t cap = z->out_cap ? z->out_cap : 4096;
+	while(cap < z->out_len + n)
+		cap *= 2;
+	uint8_t* out = realloc(z->out, cap);
+	if(!out)
+		return 0;
+	z->out = out;
+	z->out_cap = cap;
+	return 1;
+}
+
+static inline void put_bits(deflate_t* z, uint32_t v, int n) {
+	// room was reserved for the whole block. bits go out four bytes at a
+	// time, which the compiler makes one store
+	z->bits |= (uint64_t) v << z->nbits;
+	z->nbits += n;
+	if(z->nbits >= 32) {
+		uint8_t* p = z->out + z->out_len;
+		p[0] = (uint8_t) z->bits;
+		p[1] = (uint8_t) (z->bits >> 8);
+		p[2] = (uint8_t) (z->bits >> 16);
+		p[3] = (uint8_t) (z->bits >> 24);
+		z->out_len += 4;
+		z->bits >>= 32;
+		z->nbits -= 32;
+	}
+}
+
+static void align_bits(deflate_t* z) {
+	// pads to a byte boundary and writes out everything pending
+	z->nbits = (z->nbits + 7) & ~7;
+	for(; z->nbits > 0; z->nbits -= 8) {
+		z->out[z->out_len++] = (uint8_t) z->bits;
+		z->bits >>= 8;
+	}
+}
+
+deflate_t* deflate_init_raw(int level) {
+	deflate_t* z = malloc(sizeof(deflate_t));
+	if(!z)
+		return NULL;
+	z->pos = 0;
+	z->end = 0;
+	level = level < 1 ? 1 : level > 9 ? 9 : level;
+	z->max_chain = levels[level].chain;
+	z->nice_len = levels[level].nice;
+	z->max_insert = levels[level].insert;
+	z->nsym = 0;
+	z->bits = 0;
+	z->nbits = 0;
+	z->adler = 1;
+	z->raw = 1;
+	z->out = NULL;
+	z->out_len = 0;
+	z->out_cap = 0;
+	memset(z->head, 0xff, sizeof(z->head));
+	return z;
+}
+
+deflate_t* deflate_init(int level) {
+	deflate_t* z = deflate_init_raw(level);
+	if(!z)
+		return NULL;
+	z->raw = 0;
+	if(!reserve(z, 2)) {
+		deflate_free(z);
+		return NULL;
+	}
+	// 32K window, deflate, no dictionary
+	z->out[z->out_len++] = 0x78;
+	z->out[z->out_len++] = 0x9c;
+	return z;
+}
+
+void deflate_free(deflate_t* z) {
+	if(!z)
+		return;
+	free(z->out);
+	free(z);
+}
+
+static void at_least_two(uint32_t* freq, int n) {
+	// a code with a single symbol is incomplete, which inflaters may reject
+	int used = 0;
+	for(int i = 0; i < n; i++)
+		used += freq[i] != 0;
+	for(int i = 0; used < 2 && i < n; i++) {
+		if(!freq[i]) {
+			freq[i] = 1;
+			used++;
+		}
+	}
+}
+
+static void huffman_lengths(const uint32_t* freq, int n, int limit, uint8_t* len) {
+	// merge the two lightest nodes until one is left. leaves are taken in
+	// order of weight and merged nodes come out in order of weight, so two
+	// queues stand in for a heap. if the tree is deeper than limit the
+	// weights are halved, which flattens it, and it is built again
+	uint32_t f[LITLEN_CODES];
+	uint32_t weight[2 * LITLEN_CODES];
+	int leaf[LITLEN_CODES];
+	int parent[2 * LITLEN_CODES];
+	int depth[2 * LITLEN_CODES];
+	memcpy(f, freq, n * sizeof(uint32_t));
+	for(;;) {
+		int nleaf = 0;
+		for(int i = 0; i < n; i++) {
+			len[i] = 0;
+			if(!f[i])
+				continue;
+			// insertion sort by weight, n is small
+			int j = nleaf++;
+			for(; j > 0 && f[leaf[j - 1]] > f[i]; j--)
+				leaf[j] = leaf[j - 1];
+			leaf[j] = i;
+		}
+		if(nleaf < 2) {
+			if(nleaf)
+				len[leaf[0]] = 1;
+			return;
+		}
+		for(int i = 0; i < nleaf; i++)
+			weight[i] = f[leaf[i]];
+		int a = 0, b = nleaf, next = nleaf;
+		while(next < 2 * nleaf - 1) {
+			int pick[2];
+			for(int k = 0; k < 2; k++)
+				pick[k] = a < nleaf && (b >= next || weight[a] <= weight[b]) ? a++ : b++;
+			weight[next] = weight[pick[0]] + weight[pick[1]];
+			parent[pick[0]] = parent[pick[1]] = next;
+			next++;
+		}
+		// parents always come after their children
+		int root = 2 * nleaf - 2, deepest = 0;
+		depth[root] = 0;
+		for(int i = root - 1; i >= 0; i--) {
+			depth[i] = depth[parent[i]] + 1;
+			deepest = depth[i] > deepest ? depth[i] : deepest;
+		}
+		if(deepest <= limit) {
+			for(int i = 0; i < nleaf; i++)
+				len[leaf[i]] = (uint8_t) depth[i];
+			return;
+		}
+		for(int i = 0; i < n; i++)
+			f[i] = (f[i] + 1) >> 1;
+	}
+}
+
+static void huffman_codes(const uint8_t* len, int n, uint16_t* code) {
+	// canonical codes, bit reversed since deflate sends codes from the top
+	// bit but everything else from the bottom
+	int count[16] = {0}, next[16];
+	for(int i = 0; i < n; i++)
+		count[len[i]]++;
+	count[0] = 0;
+	int c = 0;
+	for(int bits = 1; bits < 16; bits++) {
+		c = (c + count[bits - 1]) << 1;
+		next[bits] = c;
+	}
+	for(int i = 0; i < n; i++) {
+		if(!len[i])
+			continue;
+		unsigned v = next[len[i]]++, r = 0;
+		for(int k = 0; k < len[i]; k++, v >>= 1)
+			r = r << 1 | (v & 1);
+		code[i] = (uint16_t) r;
+	}
+}
+
+static int write_block(deflate_t* z, int final) {
+	// at most 48 bits per symbol, and the header is well under 1K
+	if(!reserve(z, z->nsym * 6 + 1024))
+		return 0;
+	uint32_t lf[LITLEN_CODES] = {0}, df[DIST_CODES] = {0}, cf[CLEN_CODES] = {0};
+	for(size_t i = 0; i < z->nsym; i++) {
+		if(z->dist[i]) {
+			lf[257 + len_code(z->sym[i])]++;
+			df[dist_code(z->dist[i])]++;
+		}
+		else {
+			lf[z->sym[i]]++;
+		}
+	}
+	lf[256] = 1;
+	at_least_two(lf, LITLEN_CODES);
+	at_least_two(df, DIST_CODES);
+	uint8_t ll[LITLEN_CODES], dl[DIST_CODES], cl[CLEN_CODES];
+	uint16_t lc[LITLEN_CODES], dc[DIST_CODES], cc[CLEN_CODES];
+	huffman_lengths(lf, LITLEN_CODES, 15, ll);
+	huffman_lengths(df, DIST_CODES, 15, dl);
+	int hlit = LITLEN_CODES, hdist = DIST_CODES;
+	while(hlit > 257 && !ll[hlit - 1])
+		hlit--;
+	while(hdist > 1 && !dl[hdist - 1])
+		hdist--;
+
+	// both sets of lengths are sent as one sequence, runs are coded with
+	// 16 (repeat the last length), 17 and 18 (repeat zero)
+	uint8_t lens[LITLEN_CODES + DIST_CODES];
+	uint8_t rle[LITLEN_CODES + DIST_CODES], rle_extra[LITLEN_CODES + DIST_CODES];
+	int total = hlit + hdist, nrle = 0;
+	memcpy(lens, ll, hlit);
+	memcpy(lens + hlit, dl, hdist);
+	for(int i = 0; i < total;) {
+		int l = lens[i], run = 1;
+		while(i + run < total && lens[i + run] == l)
+			run++;
+		if(l == 0 && run >= 3) {
+			int take = run < 138 ? run : 138;
+			rle[nrle] = take >= 11 ? 18 : 17;
+			rle_extra[nrle++] = (uint8_t) (take >= 11 ? take - 11 : take - 3);
+			i += take;
+		}
+		else if(l != 0 && run >= 4) {
+			int take = run - 1 < 6 ? run - 1 : 6;
+			rle[nrle] = (uint8_t) l;
+			rle_extra[nrle++] = 0;
+			rle[nrle] = 16;
+			rle_extra[nrle++] = (uint8_t) (take - 3);
+			i += 1 + take;
+		}
+		else {
+			rle[nrle] = (uint8_t) l;
+			rle_extra[nrle++] = 0;
+			i++;
+		}
+	}
+	for(int i = 0; i < nrle; i++)
+		cf[rle[i]]++;
+	at_least_two(cf, CLEN_CODES);
+	huffman_lengths(cf, CLEN_CODES, 7, cl);
+	int hclen = CLEN_CODES;
+	while(hclen > 4 && !cl[clen_order[hclen - 1]])
+		hclen--;
+	huffman_codes(ll, LITLEN_CODES, lc);
+	huffman_codes(dl, DIST_CODES, dc);
+	huffman_codes(cl, CLEN_CODES, cc);
+
+	put_bits(z, final, 1);
+	put_bits(z, 2, 2);
+	put_bits(z, hlit - 257, 5);
+	put_bits(z, hdist - 1, 5);
+	put_bits(z, hclen - 4, 4);
+	for(int i = 0; i < hclen; i++)
+		put_bits(z, cl[clen_order[i]], 3);
+	for(int i = 0; i < nrle; i++) {
+		int s = rle[i];
+		put_bits(z, cc[s], cl[s]);
+		if(s >= 16)
+			put_bits(z, rle_extra[i], s == 16 ? 2 : s == 17 ? 3 : 7);
+	}
+
+	for(size_t i = 0; i < z->nsym; i++) {
+		int s = z->sym[i], d = z->dist[i];
+		if(!d) {
+			put_bits(z, lc[s], ll[s]);
+			continue;
+		}
+		int c = len_code(s);
+		put_bits(z, lc[257 + c], ll[257 + c]);
+		put_bits(z, s - len_base[c], len_extra[c]);
+		c = dist_code(d);
+		put_bits(z, dc[c], dl[c]);
+		put_bits(z, d - dist_base[c], dist_extra[c]);
+	}
+	put_bits(z, lc[256], ll[256]);
+	z->nsym = 0;
+	return 1;
+}
+
+static inline uint32_t hash4(const uint8_t* p) {
+	uint32_t v = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+	return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+static inline void insert(deflate_t* z, size_t pos) {
+	uint32_t h = hash4(z->window + pos);
+	z->prev[pos & (DEFLATE_WSIZE - 1)] = z->head[h];
+	z->head[h] = (int32_t) pos;
+}
+
+static inline int match_length(const uint8_t* a, const uint8_t* b, int max_len) {
+	// eight bytes at a time, on little endian machines the lowest set bit
+	// of the xor is in the first byte that differs
+	int l = 0;
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	for(; l + 8 <= max_len; l += 8) {
+		uint64_t x, y;
+		memcpy(&x, a + l, 8);
+		memcpy(&y, b + l, 8);
+		if(x != y)
+			return l + (__builtin_ctzll(x ^ y) >> 3);
+	}
+#endif
+	while(l < max_len && a[l] == b[l])
+		l++;
+	return l;
+}
+
+static int compress(deflate_t* z, int flush) {
+	// without flush the last MAX_MATCH bytes wait, a match starting there
+	// could go on into the next input
+	const uint8_t* w = z->window;
+	while(flush ? z->pos < z->end : z->pos + MAX_MATCH < z->end) {
+		size_t pos = z->pos, avail = z->end - pos;
+		int best = 0, best_dist = 0;
+		if(avail >= HASH_BYTES) {
+			int max_len = avail < MAX_MATCH ? (int) avail : MAX_MATCH;
+			int nice = z->nice_len < max_len ? z->nice_len : max_len;
+			int32_t cur = z->head[hash4(w + pos)];
+			for(int chain = z->max_chain; cur >= 0 && pos - cur <= DEFLATE_WSIZE && chain > 0; chain--) {
+				// the byte that would make the match longer is checked first
+				if(w[cur + best] == w[pos + best]) {
+					int l = match_length(w + cur, w + pos, max_len);
+					if(l > best) {
+						best = l;
+						best_dist = (int) (pos - cur);
+						if(best >= nice)
+							break;
+					}
+				}
+				// slots are reused every window, an entry that is not older
+				// than the position it came from is stale
+				int32_t next = z->prev[cur & (DEFLATE_WSIZE - 1)];
+				if(next >= cur)
+					break;
+				cur = next;
+			}
+			insert(z, pos);
+		}
+		// hash collisions can leave a shorter one
+		if(best >= HASH_BYTES) {
+			for(int i = 1; best <= z->max_insert && i < best && pos + i + HASH_BYTES <= z->end; i++)
+				insert(z, pos + i);
+			z->sym[z->nsym] = (uint16_t) best;
+			z->dist[z->nsym++] = (uint16_t) best_dist;
+			z->pos += best;
+		}
+		else {
+			z->sym[z->nsym] = w[pos];
+			z->dist[z->nsym++] = 0;
+			z->pos++;
+		}
+		if(z->nsym == DEFLATE_BLOCK && !write_block(z, 0))
+			return 0;
+	}
+	return 1;
+}
+
+static void slide(deflate_t* z) {
+	// drop the older half of the window, positions move down with it
+	memmove(z->window, z->window + DEFLATE_WSIZE, DEFLATE_WSIZE);
+	z->pos -= DEFLATE_WSIZE;
+	z->end -= DEFLATE_WSIZE;
+	for(size_t i = 0; i < sizeof(z->head) / sizeof(z->head[0]); i++)
+		z->head[i] = z->head[i] >= DEFLATE_WSIZE ? z->head[i] - DEFLATE_WSIZE : -1;
+	for(size_t i = 0; i < DEFLATE_WSIZE; i++)
+		z->prev[i] = z->prev[i] >= DEFLATE_WSIZE ? z->prev[i] - DEFLATE_WSIZE : -1;
+}
+
+void deflate_set_dictionary(deflate_t* z, const void* data, size_t n) {
+	const uint8_t* p = (const uint8_t*) data;
+	if(n > DEFLATE_WSIZE) {
+		p += n - DEFLATE_WSIZE;
+		n = DEFLATE_WSIZE;
+	}
+	memcpy(z->window, p, n);
+	z->pos = z->end = n;
+	for(size_t i = 0; i + HASH_BYTES <= n; i++)
+		insert(z, i);
+}
+
+int deflate_write(deflate_t* z, const void* data, size_t n) {
+	const uint8_t* p = (const uint8_t*) data;
+	z->adler = adler32(z->adler, p, n);
+	while(n > 0) {
+		// compress leaves at most MAX_MATCH bytes, so a full window is
+		// always past its first half
+		if(z->end == sizeof(z->window))
+			slide(z);
+		size_t take = sizeof(z->window) - z->end;
+		take = take < n ? take : n;
+		memcpy(z->window + z->end, p, take);
+		z->end += take;
+		p += take;
+		n -= take;
+		if(!compress(z, 0))
+			return 0;
+	}
+	return 1;
+}
+
+int deflate_flush(deflate_t* z) {
+	if(!compress(z, 1) || (z->nsym && !write_block(z, 0)) || !reserve(z, 12))
+		return 0;
+	// an empty stored block, its length fields start on a byte boundary
+	put_bits(z, 0, 3);
+	align_bits(z);
+	z->out[z->out_len++] = 0x00;
+	z->out[z->out_len++] = 0x00;
+	z->out[z->out_len++] = 0xff;
+	z->out[z->out_len++] = 0xff;
+	return 1;
+}
+
+int deflate_finish(deflate_t* z) {
+	if(!compress(z, 1) || !write_block(z, 1) || !reserve(z, 12))
+		return 0;
+	// pad to a byte, then the checksum most significant byte first
+	align_bits(z);
+	if(z->raw)
+		return 1;
+	for(int shift = 24; shift >= 0; shift -= 8)
+		z->out[z->out_len++] = (uint8_t) (z->adler >> shift);
+	return 1;
+}
@@ -0,0 +1,167 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// streaming zlib compressor
+//
+// input is taken a piece at a time and compressed with greedy LZ77 over a
+// sliding window and dynamic Huffman blocks, so memory stays fixed no
+// matter how much goes through. compressed bytes pile up in out until
+// the caller takes them, at most about one block at a time
+//
+// raw streams have no zlib header or checksum. they are for compressing
+// pieces of one stream on separate threads: every piece but the last
+// ends with deflate_flush on a byte boundary, gets the end of the piece
+// before it as its dictionary, and the pieces are joined by simply
+// writing them one after another, with the checksums put together by
+// adler32_combine
+
+// history kept for matches, the largest deflate allows
+#define DEFLATE_WSIZE 32768
+
+#define DEFLATE_HASH_BITS 15
+
+// literals and matches per Huffman block
+#define DEFLATE_BLOCK 16384
+
+/**
+ * @brief State of one zlib stream
+ */
+typedef struct {
+	uint8_t window[2 * DEFLATE_WSIZE]; /**< last DEFLATE_WSIZE bytes compressed and the input not compressed yet */
+	int32_t head[1 << DEFLATE_HASH_BITS]; /**< last window position of every hash, -1 for none */
+	int32_t prev[DEFLATE_WSIZE]; /**< previous position with the same hash, by position mod DEFLATE_WSIZE */
+	size_t pos; /**< next byte of window to compress */
+	size_t end; /**< bytes in window */
+	int max_chain; /**< positions tried per match search */
+	int nice_len; /**< a match this long ends the search */
+	int max_insert; /**< longer matches leave their inner positions out of the hash chains */
+	uint16_t sym[DEFLATE_BLOCK]; /**< literal byte, or match length */
+	uint16_t dist[DEFLATE_BLOCK]; /**< match distance, 0 for literals */
+	size_t nsym;
+	uint64_t bits; /**< pending output bits, lowest first */
+	int nbits;
+	uint32_t adler; /**< Adler-32 of the input so far */
+	int raw; /**< no zlib header or checksum */
+	uint8_t* out; /**< compressed bytes the caller has not taken */
+	size_t out_len; /**< the caller sets this to 0 after taking the bytes */
+	size_t out_cap;
+} deflate_t;
+
+/**
+ * @brief Start a zlib stream
+ *
+ * @param level 1 for fastest to 9 for smallest
+ *
+ * @return a pointer to the new stream, its header already in out, NULL if it could not be allocated
+ */
+deflate_t* deflate_init(int level);
+
+/**
+ * @brief Start a raw deflate stream, without zlib header or checksum
+ *
+ * @param level 1 for fastest to 9 for smallest
+ *
+ * @return a pointer to the new stream, NULL if it could not be allocated
+ */
+deflate_t* deflate_init_raw(int level);
+
+/**
+ * @brief Let matches reach back into data that came before the stream
+ *
+ * Only the last DEFLATE_WSIZE bytes are used, and they are not part of
+ * the checksum. Call before the first deflate_write.
+ *
+ * @param z stream to prime
+ * @param data bytes the decompressor will have seen just before this stream
+ * @param n number of bytes
+ */
+void deflate_set_dictionary(deflate_t* z, const void* data, size_t n);
+
+/**
+ * @brief Free a stream
+ *
+ * @param z stream to free, may be NULL
+ */
+void deflate_free(deflate_t* z);
+
+/**
+ * @brief Compress more input
+ *
+ * Some of the input is held back for matches until more arrives or the
+ * stream is finished.
+ *
+ * @param z stream to add to
+ * @param data bytes to compress
+ * @param n number of bytes
+ *
+ * @return 1 on success, 0 if the output could not grow
+ */
+int deflate_write(deflate_t* z, const void* data, size_t n);
+
+/**
+ * @brief Compress all input so far and end the output on a byte boundary
+ *
+ * An empty stored block follows the compressed data, like zlib's
+ * Z_SYNC_FLUSH. The stream stays open.
+ *
+ * @param z stream to flush
+ *
+ * @return 1 on success, 0 if the output could not grow
+ */
+int deflate_flush(deflate_t* z);
+
+/**
+ * @brief Compress what is left and end the stream with its checksum
+ *
+ * Raw streams end with their last block, without a checksum.
+ *
+ * @param z stream to finish
+ *
+ * @return 1 on success, 0 if the output could not grow
+ */
+int deflate_finish(deflate_t* z);
+
+/**
+ * @brief Update an Adler-32 checksum, reference scalar version
+ *
+ * @param adler checksum so far, 1 to start
+ * @param data bytes to add
+ * @param n number of bytes
+ *
+ * @return the new checksum
+ */
+uint32_t adler32_scalar(uint32_t adler, const void* data, size_t n);
+
+/**
+ * @brief AVX2 version of adler32_scalar, 32 bytes per iteration
+ *
+ * Only call this when the cpu supports AVX2, adler32 checks for you.
+ */
+uint32_t adler32_avx2(uint32_t adler, const void* data, size_t n);
+
+/**
+ * @brief Update an Adler-32 checksum with the fastest version the cpu supports
+ *
+ * @param adler checksum so far, 1 to start
+ * @param data bytes to add
+ * @param n number of bytes
+ *
+ * @return the new checksum
+ */
+uint32_t adler32(uint32_t adler, const void* data, size_t n);
+
+/**
+ * @brief Adler-32 of two pieces of data one after the other
+ *
+ * @param adler1 checksum of the first piece
+ * @param adler2 checksum of the second piece
+ * @param len2 length of the second piece
+ *
+ * @return the checksum of both
+ */
+uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, uint64_t len2);
+
+#endif
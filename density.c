@@ -0,0 +1,279 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "density.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// batches are split into a few chunks per thread so stealing can even
+// out the lines, like the binning in tile.c
+#define DENSITY_CHUNK 1024
+
+// histogram equalization ranks counts by the log of the count in this
+// many bins, exact ranks would need a sort of the whole plane
+#define DENSITY_BINS 4096
+
+density_t* density_init(int w, int h) {
+	density_t* d = calloc(1, sizeof(density_t));
+	if(!d)
+		return NULL;
+	d->plane = framebuffer_init(w, h);
+	if(!d->plane) {
+		free(d);
+		return NULL;
+	}
+	return d;
+}
+
+void density_free(density_t* d) {
+	if(!d)
+		return;
+	framebuffer_free(d->plane);
+	for(int i = 0; i < d->nlocal; i++)
+		framebuffer_free(d->local[i]);
+	free(d->local);
+	free(d);
+}
+
+void density_clear(density_t* d) {
+	// the worker planes are always left zeroed by density_batch_mt
+	memset(d->plane->fb, 0, (size_t) d->plane->width * d->plane->height * sizeof(uint32_t));
+}
+
+int density_aaline(density_t* d, point_t* p1, point_t* p2) {
+	return density_aaline_clip(d->plane, p1, p2, NULL);
+}
+
+static int plane_bounds(framebuffer_t* plane, rect_t* bounds) {
+	*bounds = plane->scissor;
+	if(bounds->x0 < 0)
+		bounds->x0 = 0;
+	if(bounds->y0 < 0)
+		bounds->y0 = 0;
+	if(bounds->x1 > plane->width)
+		bounds->x1 = plane->width;
+	if(bounds->y1 > plane->height)
+		bounds->y1 = plane->height;
+	return bounds->x0 < bounds->x1 && bounds->y0 < bounds->y1;
+}
+
+static void add_segments(framebuffer_t* plane, const segment_t* segs, size_t n, const rect_t* bounds) {
+	uint8_t visible[DENSITY_CHUNK];
+	point_t p1, p2;
+	for(size_t base = 0; base < n; base += DENSITY_CHUNK) {
+		size_t count = n - base < DENSITY_CHUNK ? n - base : DENSITY_CHUNK;
+		if(!segments_visible(segs + base, count, bounds, visible))
+			continue;
+		for(size_t i = 0; i < count; i++) {
+			if(!visible[i])
+				continue;
+			p1 = segs[base + i].p1;
+			p2 = segs[base + i].p2;
+			density_aaline_clip(plane, &p1, &p2, bounds);
+		}
+	}
+}
+
+int density_batch(density_t* d, const segment_t* segs, size_t n) {
+	rect_t bounds;
+	if(plane_bounds(d->plane, &bounds))
+		add_segments(d->plane, segs, n, &bounds);
+	return 1;
+}
+
+typedef struct {
+	density_t* d;
+	const segment_t* segs;
+	size_t n;
+	rect_t bounds;
+	int nchunks;
+	int nbands;
+	uint8_t* used; /**< which workers drew anything, only those are summed */
+} density_job_t;
+
+static void add_chunk(void* ctx, int chunk, int worker) {
+	// worker 0 is the calling thread and adds straight into the result
+	density_job_t* job = (density_job_t*) ctx;
+	size_t start = job->n * chunk / job->nchunks;
+	size_t end = job->n * (chunk + 1) / job->nchunks;
+	framebuffer_t* plane = worker == 0 ? job->d->plane : job->d->local[worker - 1];
+	job->used[worker] = 1;
+	add_segments(plane, job->segs + start, end - start, &job->bounds);
+}
+
+static void add_row(uint32_t* dst, uint32_t* src, size_t n) {
+	// dst += src, and src is cleared for the next batch
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	for(; i + 4 <= n; i += 4) {
+		__m128i a = _mm_loadu_si128((const __m128i*) (dst + i));
+		__m128i b = _mm_loadu_si128((const __m128i*) (src + i));
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_add_epi32(a, b));
+		_mm_storeu_si128((__m128i*) (src + i), zero);
+	}
+#endif
+	for(; i < n; i++) {
+		dst[i] += src[i];
+		src[i] = 0;
+	}
+}
+
+static void reduce_band(void* ctx, int band, int worker) {
+	density_job_t* job = (density_job_t*) ctx;
+	int rows = job->bounds.y1 - job->bounds.y0;
+	int y0 = job->bounds.y0 + (int) ((int64_t) rows * band / job->nbands);
+	int y1 = job->bounds.y0 + (int) ((int64_t) rows * (band + 1) / job->nbands);
+	int stride = job->d->plane->width;
+	size_t n = job->bounds.x1 - job->bounds.x0;
+	uint32_t* dst = (uint32_t*) job->d->plane->fb;
+	for(int y = y0; y < y1; y++) {
+		size_t row = (size_t) stride * y + job->bounds.x0;
+		for(int i = 0; i < job->d->nlocal; i++)
+			if(job->used[i + 1])
+				add_row(dst + row, (uint32_t*) job->d->local[i]->fb + row, n);
+	}
+}
+
+static int reserve_planes(density_t* d, int nlocal) {
+	if(nlocal <= d->nlocal)
+		return 1;
+	framebuffer_t** local = realloc(d->local, nlocal * sizeof(framebuffer_t*));
+	if(!local)
+		return 0;
+	d->local = local;
+	for(; d->nlocal < nlocal; d->nlocal++) {
+		d->local[d->nlocal] = framebuffer_init(d->plane->width, d->plane->height);
+		if(!d->local[d->nlocal])
+			return 0;
+	}
+	return 1;
+}
+
+int density_batch_mt(density_t* d, const segment_t* segs, size_t n, threadpool_t* pool) {
+	int threads = threadpool_size(pool);
+	if(threads == 1 || n <= DENSITY_CHUNK)
+		return density_batch(d, segs, n);
+	density_job_t job = {.d = d, .segs = segs, .n = n};
+	if(!plane_bounds(d->plane, &job.bounds))
+		return 1;
+	if(!reserve_planes(d, threads - 1))
+		return 0;
+	uint8_t used[threads];
+	memset(used, 0, sizeof(used));
+	job.used = used;
+	job.nchunks = threads * 4;
+	if((size_t) job.nchunks > n / DENSITY_CHUNK + 1)
+		job.nchunks = (int) (n / DENSITY_CHUNK + 1);
+	threadpool_run(pool, job.nchunks, add_chunk, &job);
+
+	// sums are the same in any order, so the bands need no coordination
+	job.nbands = threads * 4;
+	if(job.nbands > job.bounds.y1 - job.bounds.y0)
+		job.nbands = job.bounds.y1 - job.bounds.y0;
+	threadpool_run(pool, job.nbands, reduce_band, &job);
+	return 1;
+}
+
+void density_palette(unsigned* palette, unsigned lo, unsigned hi) {
+	for(int i = 0; i < 256; i++) {
+		unsigned c = 0;
+		for(int shift = 0; shift < 32; shift += 8) {
+			unsigned a = (lo >> shift) & 0xff, b = (hi >> shift) & 0xff;
+			c |= ((a * (255 - i) + b * i + 127) / 255) << shift;
+		}
+		palette[i] = c;
+	}
+}
+
+typedef struct {
+	int mode;
+	uint32_t max;
+	float log_scale; /**< 1 / log(max) */
+	const uint32_t* cdf; /**< DENSITY_BINS running totals for DENSITY_EQUALIZE */
+	double cdf_scale; /**< 255 / nonzero pixels */
+} tonemap_t;
+
+static inline int log_bin(uint32_t c, const tonemap_t* tm) {
+	return (int) (logf((float) c) * tm->log_scale * (DENSITY_BINS - 1));
+}
+
+static inline int tonemap_index(uint32_t c, const tonemap_t* tm) {
+	// counts in [1, max] map to [1, 255]
+	if(c == 0)
+		return 0;
+	if(tm->max == 1)
+		return 255;
+	switch(tm->mode) {
+	case DENSITY_LOG:
+		return 1 + (int) (logf((float) c) * tm->log_scale * 254 + 0.5f);
+	case DENSITY_EQUALIZE: {
+		int idx = (int) ceil(tm->cdf[log_bin(c, tm)] * tm->cdf_scale);
+		return idx > 255 ? 255 : idx;
+	}
+	default:
+		return 1 + (int) ((uint64_t) (c - 1) * 254 / (tm->max - 1));
+	}
+}
+
+int density_tonemap(density_t* d, framebuffer_t* fb, int mode, const unsigned* palette) {
+	rect_t r;
+	if(!plane_bounds(fb, &r))
+		return 1;
+	if(r.x1 > d->plane->width)
+		r.x1 = d->plane->width;
+	if(r.y1 > d->plane->height)
+		r.y1 = d->plane->height;
+	if(r.x0 >= r.x1 || r.y0 >= r.y1)
+		return 1;
+	const uint32_t* counts = (const uint32_t*) d->plane->fb;
+	int stride = d->plane->width;
+	size_t n = r.x1 - r.x0;
+
+	tonemap_t tm = {.mode = mode};
+	for(int y = r.y0; y < r.y1; y++) {
+		const uint32_t* row = counts + (size_t) stride * y + r.x0;
+		for(size_t x = 0; x < n; x++)
+			tm.max = row[x] > tm.max ? row[x] : tm.max;
+	}
+	tm.log_scale = tm.max > 1 ? 1.0f / logf((float) tm.max) : 0;
+
+	uint32_t* cdf = NULL;
+	if(mode == DENSITY_EQUALIZE && tm.max > 1) {
+		cdf = calloc(DENSITY_BINS, sizeof(uint32_t));
+		if(!cdf)
+			return 0;
+		uint32_t nonzero = 0;
+		for(int y = r.y0; y < r.y1; y++) {
+			const uint32_t* row = counts + (size_t) stride * y + r.x0;
+			for(size_t x = 0; x < n; x++) {
+				if(row[x]) {
+					cdf[log_bin(row[x], &tm)]++;
+					nonzero++;
+				}
+			}
+		}
+		for(int i = 1; i < DENSITY_BINS; i++)
+			cdf[i] += cdf[i - 1];
+		tm.cdf = cdf;
+		tm.cdf_scale = 255.0 / nonzero;
+	}
+
+	unsigned* colors = malloc(n * sizeof(unsigned));
+	if(!colors) {
+		free(cdf);
+		return 0;
+	}
+	for(int y = r.y0; y < r.y1; y++) {
+		const uint32_t* row = counts + (size_t) stride * y + r.x0;
+		for(size_t x = 0; x < n; x++)
+			colors[x] = palette[tonemap_index(row[x], &tm)];
+		// premultiplied, sparse and wide storage are all handled there
+		framebuffer_blend_image(fb, r.x0, y, colors, n);
+	}
+	free(colors);
+	free(cdf);
+	return 1;
+}
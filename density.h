@@ -0,0 +1,134 @@
+#ifndef DENSITY_H
+#define DENSITY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "framebuffer.h"
+#include "threadpool.h"
+
+// line density plots
+//
+// instead of blending, the Wu coverage of every line is added into a
+// plane of uint32 counts, 255 for a fully covered pixel. addition does
+// not care about order, so millions of overlapping lines neither
+// saturate nor depend on draw order, and threads can each fill their
+// own plane and sum them afterwards. density_tonemap turns the counts
+// into colors once all lines are in
+//
+// a pixel overflows after about 16.8 million fully covering lines
+
+// density_tonemap modes
+#define DENSITY_LINEAR 0 /**< proportional to the count */
+#define DENSITY_LOG 1 /**< proportional to the log of the count */
+#define DENSITY_EQUALIZE 2 /**< by rank, every palette entry gets about as many pixels */
+
+/**
+ * @brief An accumulation plane and the scratch planes of its workers
+ */
+typedef struct {
+	framebuffer_t* plane; /**< uint32 counts stored in place of pixels, its scissor limits drawing */
+	framebuffer_t** local; /**< one plane per extra worker of density_batch_mt, kept between calls */
+	int nlocal;
+} density_t;
+
+/**
+ * @brief Create an empty accumulation plane
+ *
+ * @param w width in pixels
+ * @param h height in pixels
+ *
+ * @return a pointer to the new plane, NULL if it could not be allocated
+ */
+density_t* density_init(int w, int h);
+
+/**
+ * @brief Free a plane and its worker planes
+ *
+ * @param d plane to free, may be NULL
+ */
+void density_free(density_t* d);
+
+/**
+ * @brief Set every count to zero
+ *
+ * @param d plane to operate on
+ */
+void density_clear(density_t* d);
+
+/**
+ * @brief Add the coverage of an antialiased line to a plane of counts
+ *
+ * The pixels and coverage are exactly those draw_aaline_clip would blend.
+ *
+ * @param plane framebuffer whose pixels are uint32 counts
+ * @param p1 start position of line
+ * @param p2 stop position of line
+ * @param clip rectangle to draw in, NULL for the whole plane
+ */
+int density_aaline_clip(framebuffer_t* plane, point_t* p1, point_t* p2, const rect_t* clip);
+
+/**
+ * @brief Add the coverage of an antialiased line
+ *
+ * @param d plane to add to
+ * @param p1 start position of line
+ * @param p2 stop position of line
+ */
+int density_aaline(density_t* d, point_t* p1, point_t* p2);
+
+/**
+ * @brief Add the coverage of many lines, segment colors are ignored
+ *
+ * @param d plane to add to
+ * @param segs array of segments
+ * @param n number of segments
+ */
+int density_batch(density_t* d, const segment_t* segs, size_t n);
+
+/**
+ * @brief Add the coverage of many lines using a thread pool
+ *
+ * Each worker adds its share of the segments into its own plane, then
+ * the planes are summed into d in parallel bands of rows. The counts
+ * come out the same as density_batch.
+ *
+ * @param d plane to add to
+ * @param segs array of segments
+ * @param n number of segments
+ * @param pool threads to draw with, NULL to draw on the calling thread
+ *
+ * @return 1 on success, 0 if the worker planes could not be allocated
+ */
+int density_batch_mt(density_t* d, const segment_t* segs, size_t n, threadpool_t* pool);
+
+/**
+ * @brief Fill a palette with a ramp between two colors
+ *
+ * All four channels are interpolated, so a transparent lo lets the
+ * background show through where there are no lines.
+ *
+ * @param palette 256 rgba32 entries to fill
+ * @param lo color of entry 0, used for empty pixels
+ * @param hi color of entry 255, used for the densest pixels
+ */
+void density_palette(unsigned* palette, unsigned lo, unsigned hi);
+
+/**
+ * @brief Map the counts to colors and blend them into a framebuffer
+ *
+ * Each count is mapped to a palette index by mode, empty pixels get
+ * index 0 and any other count at least index 1. The palette colors are
+ * blended over fb with their alpha, inside its scissor and the part
+ * both have in common.
+ *
+ * @param d plane to read
+ * @param fb framebuffer to draw into
+ * @param mode one of the DENSITY_* values
+ * @param palette 256 rgba32 colors, see density_palette
+ *
+ * @return 1 on success, 0 if memory could not be allocated
+ */
+int density_tonemap(density_t* d, framebuffer_t* fb, int mode, const unsigned* palette);
+
+#endif
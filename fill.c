@@ -0,0 +1,265 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "framebuffer.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// antialiased polygon fill with a signed area accumulator
+//
+// every edge adds, for each pixel it passes through, the signed area it
+// sweeps to the left of the pixel's right side, and for the pixel after
+// it the rest of its height. a prefix sum along the row then gives each
+// pixel its winding weighted by how much of it is covered, which the
+// fill rule turns into coverage. cost is linear in the length of the
+// edges plus the area of the bounding box
+//
+// pixel centers sit on whole coordinates like everywhere else, so pixel
+// x covers [x - 0.5, x + 0.5)
+
+typedef struct {
+	float* acc; /**< (width + 2) * height cells, row major */
+	int stride;
+	int width; /**< pixels across the box */
+	int height;
+	int x0, y0; /**< box origin in the framebuffer */
+} fill_cells_t;
+
+static void accumulate_line(fill_cells_t* cells, float x0, float y0, float x1, float y1) {
+	// x0..x1 are in [0, width] and y0..y1 may leave [0, height]
+	if(y0 == y1)
+		return;
+	float dir = 1.0f;
+	if(y0 > y1) {
+		float t = x0;
+		x0 = x1;
+		x1 = t;
+		t = y0;
+		y0 = y1;
+		y1 = t;
+		dir = -1.0f;
+	}
+	float dxdy = (x1 - x0) / (y1 - y0);
+	float x = x0;
+	if(y0 < 0) {
+		x -= y0 * dxdy;
+		y0 = 0;
+	}
+	if(y1 > cells->height)
+		y1 = (float) cells->height;
+	if(y0 >= y1)
+		return;
+	int row_end = (int) ceilf(y1);
+	for(int y = (int) y0; y < row_end; y++) {
+		float* row = &cells->acc[(size_t) cells->stride * y];
+		float top = y > y0 ? (float) y : y0;
+		float bottom = y + 1 < y1 ? (float) (y + 1) : y1;
+		float dy = bottom - top;
+		float x_next = x + dxdy * dy;
+		float d = dy * dir;
+		float xa = x < x_next ? x : x_next;
+		float xb = x < x_next ? x_next : x;
+		float xa_floor = floorf(xa);
+		int ia = (int) xa_floor;
+		int ib = (int) ceilf(xb);
+		if(ib <= ia + 1) {
+			// inside one pixel, split by where the edge crosses it on average
+			float xm = 0.5f * (x + x_next) - xa_floor;
+			row[ia] += d - d * xm;
+			row[ia + 1] += d * xm;
+		}
+		else {
+			// the area left of the edge grows linearly across the pixels it
+			// crosses, with triangles in the first and last one
+			float s = 1.0f / (xb - xa);
+			float fa = xa - xa_floor;
+			float a0 = 0.5f * s * (1 - fa) * (1 - fa);
+			float fb = xb - ib + 1;
+			float am = 0.5f * s * fb * fb;
+			row[ia] += d * a0;
+			if(ib == ia + 2) {
+				row[ia + 1] += d * (1 - a0 - am);
+			}
+			else {
+				float a1 = s * (1.5f - fa);
+				row[ia + 1] += d * (a1 - a0);
+				for(int i = ia + 2; i < ib - 1; i++)
+					row[i] += d * s;
+				float a2 = a1 + (ib - ia - 3) * s;
+				row[ib - 1] += d * (1 - a2 - am);
+			}
+			row[ib] += d * am;
+		}
+		x = x_next;
+	}
+}
+
+static float clamp_x(float x, float w) {
+	return x < 0 ? 0 : x > w ? w : x;
+}
+
+static void accumulate_edge(fill_cells_t* cells, float x0, float y0, float x1, float y1) {
+	// edges left of the box still add winding to the whole row, so the
+	// parts outside are pressed flat against its sides rather than dropped.
+	// the edge is cut where it crosses a side, keeping its direction
+	float w = (float) cells->width;
+	float t[4] = {0, 1, 1, 1};
+	int n = 1;
+	if(x0 != x1) {
+		float ta = (0 - x0) / (x1 - x0);
+		float tb = (w - x0) / (x1 - x0);
+		if(ta > tb) {
+			float tt = ta;
+			ta = tb;
+			tb = tt;
+		}
+		if(ta > 0 && ta < 1)
+			t[n++] = ta;
+		if(tb > 0 && tb < 1)
+			t[n++] = tb;
+	}
+	t[n] = 1;
+	float px = clamp_x(x0, w), py = y0;
+	for(int i = 1; i <= n; i++) {
+		float qx = clamp_x(x0 + (x1 - x0) * t[i], w);
+		float qy = y0 + (y1 - y0) * t[i];
+		accumulate_line(cells, px, py, qx, qy);
+		px = qx;
+		py = qy;
+	}
+}
+
+static void resolve_row(float* row, int n, int rule, uint8_t* coverage) {
+	// prefix sum of the cells into coverage, clearing them on the way
+	float sum = 0;
+	int i = 0;
+#ifdef __SSE2__
+	__m128 carry = _mm_setzero_ps();
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 scale = _mm_set1_ps(255.0f);
+	for(; i + 4 <= n; i += 4) {
+		// in register scan, the running total comes from the last lane
+		__m128 x = _mm_loadu_ps(row + i);
+		x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+		x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+		x = _mm_add_ps(x, carry);
+		carry = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+		_mm_storeu_ps(row + i, _mm_setzero_ps());
+		__m128 c = _mm_andnot_ps(sign, x);
+		if(rule == FILL_EVENODD) {
+			// fold the winding into [0, 2) and then into a triangle wave
+			__m128 k = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(c, half)));
+			c = _mm_sub_ps(c, _mm_mul_ps(k, two));
+			c = _mm_min_ps(c, _mm_sub_ps(two, c));
+		}
+		c = _mm_min_ps(c, one);
+		__m128i v = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half));
+		v = _mm_packs_epi32(v, v);
+		v = _mm_packus_epi16(v, v);
+		int32_t v4 = _mm_cvtsi128_si32(v);
+		__builtin_memcpy(coverage + i, &v4, 4);
+	}
+	sum = _mm_cvtss_f32(carry);
+#endif
+	for(; i < n; i++) {
+		sum += row[i];
+		row[i] = 0;
+		float c = fabsf(sum);
+		if(rule == FILL_EVENODD) {
+			c -= 2.0f * (int) (c * 0.5f);
+			c = c < 2.0f - c ? c : 2.0f - c;
+		}
+		c = c < 1.0f ? c : 1.0f;
+		coverage[i] = (uint8_t) (c * 255.0f + 0.5f);
+	}
+}
+
+int fill_path(framebuffer_t* fb, unsigned color, const pointfx_t* pts, const size_t* counts, size_t ncontours, int rule) {
+	// the box is the path's bounds cut down to what may be drawn
+	rect_t bounds = fb->scissor;
+	if(bounds.x0 < 0)
+		bounds.x0 = 0;
+	if(bounds.y0 < 0)
+		bounds.y0 = 0;
+	if(bounds.x1 > fb->width)
+		bounds.x1 = fb->width;
+	if(bounds.y1 > fb->height)
+		bounds.y1 = fb->height;
+	size_t total = 0;
+	for(size_t c = 0; c < ncontours; c++)
+		total += counts[c];
+	if(total == 0 || bounds.x0 >= bounds.x1 || bounds.y0 >= bounds.y1)
+		return 1;
+	int32_t xmin = pts[0].x, xmax = pts[0].x, ymin = pts[0].y, ymax = pts[0].y;
+	for(size_t i = 1; i < total; i++) {
+		xmin = pts[i].x < xmin ? pts[i].x : xmin;
+		xmax = pts[i].x > xmax ? pts[i].x : xmax;
+		ymin = pts[i].y < ymin ? pts[i].y : ymin;
+		ymax = pts[i].y > ymax ? pts[i].y : ymax;
+	}
+	// pixel x covers [x - 0.5, x + 0.5), round out to whole pixels
+	int bx0 = (int) floor((double) xmin / FX_ONE + 0.5);
+	int bx1 = (int) ceil((double) xmax / FX_ONE + 0.5);
+	int by0 = (int) floor((double) ymin / FX_ONE + 0.5);
+	int by1 = (int) ceil((double) ymax / FX_ONE + 0.5);
+	bx0 = bx0 > bounds.x0 ? bx0 : bounds.x0;
+	by0 = by0 > bounds.y0 ? by0 : bounds.y0;
+	bx1 = bx1 < bounds.x1 ? bx1 : bounds.x1;
+	by1 = by1 < bounds.y1 ? by1 : bounds.y1;
+	if(bx0 >= bx1 || by0 >= by1)
+		return 1;
+
+	fill_cells_t cells;
+	cells.x0 = bx0;
+	cells.y0 = by0;
+	cells.width = bx1 - bx0;
+	cells.height = by1 - by0;
+	// two spare cells, for the last pixel's carry and so resolve never
+	// reads past the row
+	cells.stride = cells.width + 2;
+	cells.acc = calloc((size_t) cells.stride * cells.height, sizeof(float));
+	uint8_t* coverage = malloc(cells.width + 4);
+	if(!cells.acc || !coverage) {
+		free(cells.acc);
+		free(coverage);
+		return 0;
+	}
+
+	float ox = bx0 - 0.5f, oy = by0 - 0.5f;
+	const pointfx_t* contour = pts;
+	for(size_t c = 0; c < ncontours; c++) {
+		size_t n = counts[c];
+		// every contour is closed back to its first point
+		for(size_t i = 0; i < n; i++) {
+			const pointfx_t* a = &contour[i];
+			const pointfx_t* b = &contour[i + 1 < n ? i + 1 : 0];
+			accumulate_edge(&cells, (float) a->x / FX_ONE - ox, (float) a->y / FX_ONE - oy,
+				(float) b->x / FX_ONE - ox, (float) b->y / FX_ONE - oy);
+		}
+		contour += n;
+	}
+
+	for(int y = 0; y < cells.height; y++) {
+		resolve_row(&cells.acc[(size_t) cells.stride * y], cells.width, rule, coverage);
+		// only blend from the first to the last covered pixel
+		int a = 0, b = cells.width - 1;
+		while(a <= b && coverage[a] == 0)
+			a++;
+		while(b >= a && coverage[b] == 0)
+			b--;
+		if(a <= b)
+			framebuffer_blend_span(fb, bx0 + a, y + by0, coverage + a, b - a + 1, color);
+	}
+	free(cells.acc);
+	free(coverage);
+	return 1;
+}
+
+int fill_polygon(framebuffer_t* fb, unsigned color, const pointfx_t* pts, size_t n, int rule) {
+	return fill_path(fb, color, pts, &n, 1, rule);
+}
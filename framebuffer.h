@@ -1,20 +1,62 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-
+// define STB_IMAGE_WRITE_IMPLEMENTATION in exactly one file before including this
 #include "stb_image_write.h"
+#include "blend.h"
+#include "sparse.h"
+#include "threadpool.h"
+
+// side of the square tiles used by draw_aaline_batch_mt
+#define TILE_SIZE 64
+
+// fractional bits of pointfx_t coordinates
+#define FX_SHIFT 8
+#define FX_ONE (1 << FX_SHIFT)
+
+// convert a pixel coordinate to 24.8 fixed point, rounding to nearest
+#define TO_FX(v) ((int32_t) ((v) * FX_ONE + ((v) < 0 ? -0.5 : 0.5)))
+
+/**
+ * @brief (X,Y) coordinate struct in 24.8 fixed point
+ *
+ * Pixel centers are at whole coordinates, the same as point_t. Keep
+ * endpoints within 2^21 pixels of the origin so the slope fits in 32.32.
+ */
+typedef struct {
+	int32_t x;
+	int32_t y;
+} pointfx_t;
+
+/**
+ * @brief Axis aligned rectangle, x1 and y1 are exclusive
+ */
+typedef struct {
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+} rect_t;
 
 /**
  * @brief Framebuffer struct
  */
 typedef struct {
-	void* fb; /**< pointer to actual struct data, cast to unsigned* to use 32bit rgba */
+	void* fb; /**< pointer to actual struct data, cast to unsigned* to use 32bit rgba, see format, NULL if sparse */
 	int width; /**< width in pixels */
 	int height; /**< height in pixels */
+	rect_t scissor; /**< drawing never touches pixels outside this */
+	size_t capacity; /**< pixels allocated, can be more than width * height after a resize */
+	int premultiplied; /**< pixels are stored with premultiplied alpha, see FB_PREMULTIPLIED */
+	int linear; /**< colors are blended in linear light, see FB_LINEAR */
+	int format; /**< FB_FORMAT_* layout of the pixels */
+	sparse_tiles_t* tiles; /**< tile table of FB_SPARSE framebuffers, NULL for dense ones */
 } framebuffer_t;
 
 /**
@@ -25,6 +67,15 @@ typedef struct {
 	int y;
 } point_t;
 
+/**
+ * @brief Line segment with its own color, the unit of draw_aaline_batch
+ */
+typedef struct {
+	point_t p1; /**< start of segment */
+	point_t p2; /**< end of segment */
+	unsigned color; /**< rgba32 color of segment */
+} segment_t;
+
 /**
  * @brief Pack rgba values into one int
  *
@@ -83,6 +134,70 @@ unsigned multiply_alpha(unsigned color, double alpha);
  */
 void write_bmp(framebuffer_t* fb);
 
+/**
+ * @brief Write framebuffer to an image file, picking the format from the extension
+ *
+ * .png, .jpg/.jpeg, .tga, .qoi and .hdr are recognized, anything else is written
+ * as bmp. Premultiplied framebuffers are converted to straight alpha on the
+ * way out. .hdr is written as linear light floats from any dense format,
+ * wide formats are quantized to 8 bits with ordered dithering for the
+ * others. Sparse framebuffers are written through framebuffer_row.
+ * 8-bit and sparse framebuffers go to .png, .jpg, .bmp and .qoi through
+ * png_write_framebuffer, jpeg_write_framebuffer, bmp_write_framebuffer and
+ * qoi_write_framebuffer, a row at a time without a copy of the image. bmp
+ * files are 24-bit, see bmp.h. qoi files keep alpha and are the fastest to
+ * write, see qoi.h. jpeg files use JPEG_QUALITY and JPEG_SUBSAMPLING.
+ *
+ * @param fb framebuffer to operate on
+ * @param path file to write
+ *
+ * @return 1 on success, 0 on failure
+ */
+int framebuffer_write(framebuffer_t* fb, const char* path);
+
+/**
+ * @brief framebuffer_write, with a choice of PNG profile and .png and .jpg files compressed on a thread pool
+ *
+ * See png_write_framebuffer_mt and jpeg_write_framebuffer. Every other
+ * format is written as by framebuffer_write, which uses PNG_PROFILE.
+ *
+ * @param fb framebuffer to operate on
+ * @param path file to write
+ * @param png_profile PNG_FASTEST, PNG_BALANCED or PNG_SMALLEST, see png.h
+ * @param pool threads to compress with, may be NULL
+ *
+ * @return 1 on success, 0 on failure
+ */
+int framebuffer_write_mt(framebuffer_t* fb, const char* path, int png_profile, threadpool_t* pool);
+
+/**
+ * @brief Blend a color over a run of pixels in the framebuffer's format
+ *
+ * blend_span for straight framebuffers, blend_span_premul with the color
+ * premultiplied for premultiplied ones, blend_span_linear for linear ones
+ * and the wide kernels for wide formats. Every raster path goes through
+ * this or its per pixel equivalent.
+ *
+ * @param fb framebuffer to draw into
+ * @param x first pixel of the run
+ * @param y row of the run
+ * @param coverage one coverage value per pixel, or NULL for full coverage
+ * @param n number of pixels
+ * @param color straight alpha rgba32 color to draw
+ */
+void framebuffer_blend_span(framebuffer_t* fb, int x, int y, const uint8_t* coverage, size_t n, unsigned color);
+
+/**
+ * @brief Blend a run of straight alpha rgba32 pixels in the framebuffer's format
+ *
+ * @param fb framebuffer to draw into
+ * @param x first pixel of the run
+ * @param y row of the run
+ * @param src pixels to draw
+ * @param n number of pixels
+ */
+void framebuffer_blend_image(framebuffer_t* fb, int x, int y, const unsigned* src, size_t n);
+
 /**
  * @brief Draw antialiased line into framebuffer
  *
@@ -93,6 +208,229 @@ void write_bmp(framebuffer_t* fb);
  */
 int draw_aaline(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2);
 
+/**
+ * @brief Restrict drawing to a rectangle of the framebuffer
+ *
+ * @param fb framebuffer to operate on
+ * @param rect rectangle to draw in, NULL to allow the whole framebuffer
+ */
+void framebuffer_set_scissor(framebuffer_t* fb, const rect_t* rect);
+
+/**
+ * @brief Mark which segments can touch any pixel of a rectangle
+ *
+ * A cheap bounding box test, a segment marked visible may still miss.
+ *
+ * @param segs array of segments
+ * @param n number of segments
+ * @param rect rectangle to test against
+ * @param visible set to 1 for segments that may be visible, 0 otherwise
+ *
+ * @return the number of segments marked visible
+ */
+size_t segments_visible(const segment_t* segs, size_t n, const rect_t* rect, uint8_t* visible);
+
+/**
+ * @brief Draw antialiased line into framebuffer, only touching pixels in clip
+ *
+ * The line is clipped to clip and the framebuffer scissor once, up front,
+ * and the pixels inside come out exactly as draw_aaline would draw them.
+ *
+ * @param fb framebuffer to operate one
+ * @param color color to draw line with
+ * @param p1 start position of line
+ * @param p2 stop position of line
+ * @param clip rectangle to draw in, NULL for the whole framebuffer
+ */
+int draw_aaline_clip(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2, const rect_t* clip);
+
+/**
+ * @brief Draw antialiased line with sub-pixel endpoints into framebuffer
+ *
+ * Unlike draw_aaline, the end pixels get partial coverage for how much
+ * of them the line actually spans, so the line starts and stops at the
+ * fractional endpoints.
+ *
+ * @param fb framebuffer to operate on
+ * @param color color to draw line with
+ * @param p1 start position of line
+ * @param p2 stop position of line
+ */
+int draw_aaline_fx(framebuffer_t* fb, unsigned color, pointfx_t* p1, pointfx_t* p2);
+
+/**
+ * @brief draw_aaline_fx, only touching pixels in clip
+ *
+ * @param fb framebuffer to operate on
+ * @param color color to draw line with
+ * @param p1 start position of line
+ * @param p2 stop position of line
+ * @param clip rectangle to draw in, NULL for the whole framebuffer
+ */
+int draw_aaline_fx_clip(framebuffer_t* fb, unsigned color, pointfx_t* p1, pointfx_t* p2, const rect_t* clip);
+
+#define CAP_BUTT 0 /**< the stroke stops at the endpoints */
+#define CAP_SQUARE 1 /**< the stroke runs half its width past the endpoints */
+#define CAP_ROUND 2 /**< the endpoints get half circles */
+
+/**
+ * @brief Draw a wide antialiased stroke into framebuffer in a single pass
+ *
+ * Every pixel under the stroke is blended once, with coverage from the
+ * overlap of the pixel and the stroke, so wide strokes cost their area
+ * rather than their width times their length.
+ *
+ * @param fb framebuffer to operate on
+ * @param color color to draw stroke with
+ * @param width width of the stroke in pixels
+ * @param cap one of the CAP_* values
+ * @param p1 start position of stroke
+ * @param p2 stop position of stroke
+ */
+int draw_stroke(framebuffer_t* fb, unsigned color, double width, int cap, pointfx_t* p1, pointfx_t* p2);
+
+/**
+ * @brief draw_stroke, only touching pixels in clip
+ *
+ * @param fb framebuffer to operate on
+ * @param color color to draw stroke with
+ * @param width width of the stroke in pixels
+ * @param cap one of the CAP_* values
+ * @param p1 start position of stroke
+ * @param p2 stop position of stroke
+ * @param clip rectangle to draw in, NULL for the whole framebuffer
+ */
+int draw_stroke_clip(framebuffer_t* fb, unsigned color, double width, int cap, pointfx_t* p1, pointfx_t* p2, const rect_t* clip);
+
+#define JOIN_MITER 0 /**< outer edges meet in a point, up to the miter limit */
+#define JOIN_ROUND 1 /**< joins get a circle */
+#define JOIN_BEVEL 2 /**< the corner is cut straight across */
+
+/**
+ * @brief How a polyline is stroked
+ */
+typedef struct {
+	double width; /**< width of the stroke in pixels */
+	int cap; /**< CAP_* for both ends of the path */
+	int join; /**< JOIN_* for every vertex inside the path */
+	double miter_limit; /**< longest miter as a multiple of the width, longer ones are beveled */
+} stroke_style_t;
+
+/**
+ * @brief Draw a stroked polyline into framebuffer
+ *
+ * The vertices are read once, front to back. Segments, joins and caps
+ * are gathered into a coverage mask and the mask is blended at the end,
+ * so every pixel is blended once per path no matter how many segments
+ * cross it. The mask grows with the path and holds, for every row the
+ * path crosses, only the columns it reaches there, so a long thin path
+ * across a large canvas needs memory for its footprint, not its
+ * bounding box. Repeated vertices are skipped.
+ *
+ * @param fb framebuffer to operate on
+ * @param color color to draw the path with
+ * @param pts vertices of the path
+ * @param n number of vertices
+ * @param style width, caps and joins
+ *
+ * @return 1 on success, 0 if the coverage mask could not be allocated,
+ * in which case nothing is drawn
+ */
+int draw_polyline(framebuffer_t* fb, unsigned color, const point_t* pts, size_t n, const stroke_style_t* style);
+
+/**
+ * @brief draw_polyline with sub-pixel vertices
+ *
+ * @param fb framebuffer to operate on
+ * @param color color to draw the path with
+ * @param pts vertices of the path
+ * @param n number of vertices
+ * @param style width, caps and joins
+ *
+ * @return 1 on success, 0 if the coverage mask could not be allocated,
+ * in which case nothing is drawn
+ */
+int draw_polyline_fx(framebuffer_t* fb, unsigned color, const pointfx_t* pts, size_t n, const stroke_style_t* style);
+
+#define FILL_NONZERO 0 /**< inside where the winding number is not zero */
+#define FILL_EVENODD 1 /**< inside where the winding number is odd */
+
+/**
+ * @brief Fill a path of closed contours with exact area coverage
+ *
+ * Edges add signed area to a cell buffer over the path's bounding box,
+ * a prefix sum along each row turns that into coverage and each row is
+ * blended once. Contours that share an edge leave no seam.
+ *
+ * @param fb framebuffer to operate on
+ * @param color color to fill with
+ * @param pts vertices of all contours, one after the other
+ * @param counts number of vertices in each contour, every contour is closed
+ * @param ncontours number of contours
+ * @param rule FILL_NONZERO or FILL_EVENODD
+ *
+ * @return 1 on success, 0 if the cell buffer could not be allocated
+ */
+int fill_path(framebuffer_t* fb, unsigned color, const pointfx_t* pts, const size_t* counts, size_t ncontours, int rule);
+
+/**
+ * @brief Fill a single closed polygon, see fill_path
+ *
+ * @param fb framebuffer to operate on
+ * @param color color to fill with
+ * @param pts vertices of the polygon
+ * @param n number of vertices
+ * @param rule FILL_NONZERO or FILL_EVENODD
+ *
+ * @return 1 on success, 0 if the cell buffer could not be allocated
+ */
+int fill_polygon(framebuffer_t* fb, unsigned color, const pointfx_t* pts, size_t n, int rule);
+
+/**
+ * @brief Draw an antialiased line of whole pixel thickness
+ *
+ * A draw_stroke with butt caps, or draw_aaline when thickness is 1.
+ *
+ * @param fb framebuffer to operate on
+ * @param color color to draw line with
+ * @param thickness width of the line in pixels
+ * @param p1 start position of line
+ * @param p2 stop position of line
+ */
+int draw_aaline_thick(framebuffer_t* fb, unsigned color, unsigned thickness, point_t* p1, point_t* p2);
+
+/**
+ * @brief Draw many antialiased lines into framebuffer
+ *
+ * Segments are classified into vertical, horizontal, shallow and steep
+ * buckets in fixed size chunks and each bucket is drawn by its own
+ * kernel. Chunks are drawn in order, but inside a chunk overlapping
+ * segments of different kinds may blend in a different order than
+ * calling draw_aaline on each one would.
+ *
+ * @param fb framebuffer to operate on
+ * @param segs array of segments, endpoints may be in either order
+ * @param n number of segments
+ */
+int draw_aaline_batch(framebuffer_t* fb, const segment_t* segs, size_t n);
+
+/**
+ * @brief Draw many antialiased lines into framebuffer using a thread pool
+ *
+ * The framebuffer is split into TILE_SIZE square tiles. Every tile gets the
+ * list of segments that touch it, in submission order, and the tiles are
+ * drawn in parallel. The result is byte-identical to calling draw_aaline
+ * on every segment in order.
+ *
+ * @param fb framebuffer to operate on
+ * @param segs array of segments, endpoints may be in either order
+ * @param n number of segments
+ * @param pool threads to draw with, NULL to draw on the calling thread
+ *
+ * @return 1 on success, 0 if memory for the tile lists could not be allocated
+ */
+int draw_aaline_batch_mt(framebuffer_t* fb, const segment_t* segs, size_t n, threadpool_t* pool);
+
 /**
  * @brief Create a new empty framebuffer
  *
@@ -103,16 +441,141 @@ int draw_aaline(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2);
  */
 framebuffer_t* framebuffer_init(int w, int h);
 
+// framebuffer_init_flags options
+#define FB_NO_CLEAR 0x1 /**< leave the pixels uninitialized, for callers that fill right away */
+#define FB_PREMULTIPLIED 0x2 /**< store pixels premultiplied, colors passed in and read back stay straight */
+#define FB_LINEAR 0x4 /**< blend in linear light, pixels stay sRGB, ignored with FB_PREMULTIPLIED */
+#define FB_RGBA16 0x8 /**< 16 bits per channel, see FB_FORMAT_RGBA16 */
+#define FB_RGBA32F 0x10 /**< a float per channel, see FB_FORMAT_RGBA32F */
+#define FB_SPARSE 0x20 /**< allocate SPARSE_TILE tiles on first write, see sparse.h */
+
+// sparse framebuffers read back untouched tiles as the color of the last
+// framebuffer_fill, transparent black at first. pixel access, fills,
+// blits, draw_aaline, draw_aaline_fx, the batches and everything that
+// blends spans (strokes, polygons, tone mapping) go through the tile
+// table. the per kind kernels like draw_aaline_steep only take dense
+// framebuffers, and draw_aaline_batch_mt draws sparse ones on the
+// calling thread
+
+// framebuffer_t formats. the wide ones keep faint overlapping lines from
+// losing to rounding, they are always straight alpha and ignore
+// FB_PREMULTIPLIED and FB_LINEAR. colors still go in and come out as
+// rgba32
+#define FB_FORMAT_RGBA8 0 /**< packed rgba32 per pixel */
+#define FB_FORMAT_RGBA16 1 /**< uint16_t r, g, b, a per pixel */
+#define FB_FORMAT_RGBA32F 2 /**< float r, g, b, a per pixel, 0 to 1 */
+
+/**
+ * @brief Create a new framebuffer with options
+ *
+ * @param w width of framebuffer
+ * @param h height of framebuffer
+ * @param flags FB_* options or'd together
+ *
+ * @return a pointer to the new framebuffer, NULL if it could not be allocated
+ */
+framebuffer_t* framebuffer_init_flags(int w, int h, unsigned flags);
+
+/**
+ * @brief Change the size of a framebuffer, reusing its memory when it fits
+ *
+ * The pixels are left uninitialized and the scissor is reset.
+ *
+ * @param fb framebuffer to operate on
+ * @param w new width
+ * @param h new height
+ *
+ * @return 1 on success, 0 if memory could not be allocated, fb is unchanged then
+ */
+int framebuffer_resize(framebuffer_t* fb, int w, int h);
+
+/**
+ * @brief Free a framebuffer and its pixels
+ *
+ * @param fb framebuffer to free, may be NULL
+ */
+void framebuffer_free(framebuffer_t* fb);
+
+// framebuffer_blit modes
+#define BLIT_OPAQUE 0 /**< copy source pixels as they are */
+#define BLIT_BLEND 1 /**< blend source pixels over the destination with their alpha */
+
+/**
+ * @brief Set every pixel of the framebuffer to one color
+ *
+ * Large framebuffers are filled with non-temporal stores. The scissor
+ * does not apply.
+ *
+ * @param fb framebuffer to operate on
+ * @param color rgba32 color to store
+ */
+void framebuffer_fill(framebuffer_t* fb, unsigned color);
+
+/**
+ * @brief Set every pixel of a rectangle to one color
+ *
+ * @param fb framebuffer to operate on
+ * @param color rgba32 color to store
+ * @param rect rectangle to fill, clipped to the framebuffer and its scissor
+ */
+void framebuffer_fill_rect(framebuffer_t* fb, unsigned color, const rect_t* rect);
+
+/**
+ * @brief Copy or blend a rectangle of one framebuffer into another
+ *
+ * Pixels are converted when the two framebuffers differ in format or in
+ * premultiplication.
+ *
+ * @param dst framebuffer to draw into
+ * @param src framebuffer to read from, must not be dst
+ * @param src_rect part of src to copy, NULL for all of it
+ * @param x left edge of the copy in dst
+ * @param y top edge of the copy in dst
+ * @param mode BLIT_OPAQUE or BLIT_BLEND
+ */
+void framebuffer_blit(framebuffer_t* dst, framebuffer_t* src, const rect_t* src_rect, int x, int y, int mode);
+
 /**
  * @brief Get the value of a pixel in a framebuffer
  *
  * @param fb framebuffer to operate on
  * @param px pixel to get the value of
  *
- * @return the RGBA value of px in fb
+ * @return the RGBA value of px in fb, with straight alpha and rounded to 8 bits
  */
 unsigned framebuffer_px(framebuffer_t* fb, point_t* px);
 
+/**
+ * @brief Get a dense view of one tile of a sparse framebuffer
+ *
+ * The view shares the tile's pixels and format, its origin is the tile's
+ * top left corner and its scissor is the framebuffer's moved along with
+ * it. A new tile starts out as the clear color.
+ *
+ * @param fb sparse framebuffer
+ * @param tx column of the tile, pixel x / SPARSE_TILE
+ * @param ty row of the tile, pixel y / SPARSE_TILE
+ * @param create allocate the tile if nothing has been drawn into it yet
+ * @param view filled with the view
+ *
+ * @return 1 if the tile exists, 0 if it does not and create is 0 or it could not be allocated
+ */
+int framebuffer_tile(framebuffer_t* fb, int tx, int ty, int create, framebuffer_t* view);
+
+/**
+ * @brief Read one row of pixels as straight alpha rgba32
+ *
+ * Encoders read rows through this so they work the same for every
+ * format and for sparse framebuffers.
+ *
+ * @param fb framebuffer to read
+ * @param y row to read
+ * @param scratch room for fb->width pixels, used when the row has to be converted
+ *
+ * @return the row, either scratch or the framebuffer's own pixels
+ */
+const unsigned* framebuffer_row(framebuffer_t* fb, int y, unsigned* scratch);
+
 /**
  * @brief Print framebuffer contents and size to stdout
  *
@@ -129,3 +592,5 @@ void framebuffer_repr(framebuffer_t* fb);
  * @return 1 if pixel is out of bounds, 0 otherwise
  */
 int framebuffer_overrun(framebuffer_t* fb, point_t* px);
+
+#endif
@@ -0,0 +1,612 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jpeg.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JPEG_X86 1
+#include <immintrin.h>
+#endif
+
+// natural position of every zigzag position
+static const uint8_t zigzag[64] = {
+	0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// the example tables of the standard, annex K, in natural order
+static const uint8_t luma_quant[64] = {
+	16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+	18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92, 49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+};
+
+static const uint8_t chroma_quant[64] = {
+	17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// Huffman tables as they go in a DHT segment, the number of codes of
+// every length from 1 to 16 and then the symbols in code order
+static const uint8_t dc_luma_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t dc_chroma_bits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t dc_values[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t ac_luma_bits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t ac_luma_values[162] = {
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81,
+	0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18,
+	0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+	0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+	0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99,
+	0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+	0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5,
+	0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa
+};
+
+static const uint8_t ac_chroma_bits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t ac_chroma_values[162] = {
+	0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08,
+	0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25,
+	0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47,
+	0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74,
+	0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+	0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba,
+	0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe2, 0xe3, 0xe4,
+	0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa
+};
+
+// what the AAN DCT leaves in every row and column, times 2 * sqrt(2),
+// taken out again by the quantizer
+static const float aan_scale[8] = {
+	1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f,
+	1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f
+};
+
+// worst case bytes of one block, 63 AC codes of 26 bits with every byte stuffed
+#define BLOCK_BYTES 512
+
+void jpeg_ycc_scalar(const unsigned* px, size_t n, float* y, float* cb, float* cr) {
+	for(size_t i = 0; i < n; i++) {
+		float r = (float) (px[i] & 0xff), g = (float) (px[i] >> 8 & 0xff), b = (float) (px[i] >> 16 & 0xff);
+		y[i] = 0.29900f * r + 0.58700f * g + 0.11400f * b - 128;
+		cb[i] = -0.16874f * r - 0.33126f * g + 0.50000f * b;
+		cr[i] = 0.50000f * r - 0.41869f * g - 0.08131f * b;
+	}
+}
+
+static void fdct_1d(float* d, size_t step) {
+	// the AAN DCT, the same operations in the same order as stb_image_write
+	float d0 = d[0], d1 = d[step], d2 = d[2 * step], d3 = d[3 * step];
+	float d4 = d[4 * step], d5 = d[5 * step], d6 = d[6 * step], d7 = d[7 * step];
+	float tmp0 = d0 + d7, tmp7 = d0 - d7, tmp1 = d1 + d6, tmp6 = d1 - d6;
+	float tmp2 = d2 + d5, tmp5 = d2 - d5, tmp3 = d3 + d4, tmp4 = d3 - d4;
+
+	// even part
+	float tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3, tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+	d[0] = tmp10 + tmp11;
+	d[4 * step] = tmp10 - tmp11;
+	float z1 = (tmp12 + tmp13) * 0.707106781f;
+	d[2 * step] = tmp13 + z1;
+	d[6 * step] = tmp13 - z1;
+
+	// odd part
+	tmp10 = tmp4 + tmp5;
+	tmp11 = tmp5 + tmp6;
+	tmp12 = tmp6 + tmp7;
+	float z5 = (tmp10 - tmp12) * 0.382683433f;
+	float z2 = tmp10 * 0.541196100f + z5;
+	float z4 = tmp12 * 1.306562965f + z5;
+	float z3 = tmp11 * 0.707106781f;
+	float z11 = tmp7 + z3, z13 = tmp7 - z3;
+	d[5 * step] = z13 + z2;
+	d[3 * step] = z13 - z2;
+	d[step] = z11 + z4;
+	d[7 * step] = z11 - z4;
+}
+
+void jpeg_fdct_scalar(const float* in, size_t stride, const float* scale, int16_t* out) {
+	float b[64];
+	for(int r = 0; r < 8; r++)
+		memcpy(b + 8 * r, in + stride * r, 8 * sizeof(float));
+	for(int r = 0; r < 8; r++)
+		fdct_1d(b + 8 * r, 1);
+	for(int c = 0; c < 8; c++)
+		fdct_1d(b + c, 8);
+	for(int i = 0; i < 64; i++) {
+		float v = b[i] * scale[i];
+		out[i] = (int16_t) (v < 0 ? v - 0.5f : v + 0.5f);
+	}
+}
+
+#if defined(JPEG_X86)
+__attribute__((target("avx2"))) void jpeg_ycc_avx2(const unsigned* px, size_t n, float* y, float* cb, float* cr) {
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (px + i));
+		__m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(v, mask));
+		__m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 8), mask));
+		__m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 16), mask));
+		// separate multiplies and adds in the scalar order, no fma, so the
+		// results are the same to the bit
+		__m256 t = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(0.29900f), r), _mm256_mul_ps(_mm256_set1_ps(0.58700f), g));
+		t = _mm256_add_ps(t, _mm256_mul_ps(_mm256_set1_ps(0.11400f), b));
+		_mm256_storeu_ps(y + i, _mm256_sub_ps(t, _mm256_set1_ps(128)));
+		t = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(-0.16874f), r), _mm256_mul_ps(_mm256_set1_ps(0.33126f), g));
+		_mm256_storeu_ps(cb + i, _mm256_add_ps(t, _mm256_mul_ps(_mm256_set1_ps(0.50000f), b)));
+		t = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(0.50000f), r), _mm256_mul_ps(_mm256_set1_ps(0.41869f), g));
+		_mm256_storeu_ps(cr + i, _mm256_sub_ps(t, _mm256_mul_ps(_mm256_set1_ps(0.08131f), b)));
+	}
+	jpeg_ycc_scalar(px + i, n - i, y + i, cb + i, cr + i);
+}
+
+__attribute__((target("avx2"))) static inline void fdct_8x8(__m256* v) {
+	// fdct_1d on eight columns at once, v[i] is row i
+	__m256 tmp0 = _mm256_add_ps(v[0], v[7]), tmp7 = _mm256_sub_ps(v[0], v[7]);
+	__m256 tmp1 = _mm256_add_ps(v[1], v[6]), tmp6 = _mm256_sub_ps(v[1], v[6]);
+	__m256 tmp2 = _mm256_add_ps(v[2], v[5]), tmp5 = _mm256_sub_ps(v[2], v[5]);
+	__m256 tmp3 = _mm256_add_ps(v[3], v[4]), tmp4 = _mm256_sub_ps(v[3], v[4]);
+
+	__m256 tmp10 = _mm256_add_ps(tmp0, tmp3), tmp13 = _mm256_sub_ps(tmp0, tmp3);
+	__m256 tmp11 = _mm256_add_ps(tmp1, tmp2), tmp12 = _mm256_sub_ps(tmp1, tmp2);
+	v[0] = _mm256_add_ps(tmp10, tmp11);
+	v[4] = _mm256_sub_ps(tmp10, tmp11);
+	__m256 z1 = _mm256_mul_ps(_mm256_add_ps(tmp12, tmp13), _mm256_set1_ps(0.707106781f));
+	v[2] = _mm256_add_ps(tmp13, z1);
+	v[6] = _mm256_sub_ps(tmp13, z1);
+
+	tmp10 = _mm256_add_ps(tmp4, tmp5);
+	tmp11 = _mm256_add_ps(tmp5, tmp6);
+	tmp12 = _mm256_add_ps(tmp6, tmp7);
+	__m256 z5 = _mm256_mul_ps(_mm256_sub_ps(tmp10, tmp12), _mm256_set1_ps(0.382683433f));
+	__m256 z2 = _mm256_add_ps(_mm256_mul_ps(tmp10, _mm256_set1_ps(0.541196100f)), z5);
+	__m256 z4 = _mm256_add_ps(_mm256_mul_ps(tmp12, _mm256_set1_ps(1.306562965f)), z5);
+	__m256 z3 = _mm256_mul_ps(tmp11, _mm256_set1_ps(0.707106781f));
+	__m256 z11 = _mm256_add_ps(tmp7, z3), z13 = _mm256_sub_ps(tmp7, z3);
+	v[5] = _mm256_add_ps(z13, z2);
+	v[3] = _mm256_sub_ps(z13, z2);
+	v[1] = _mm256_add_ps(z11, z4);
+	v[7] = _mm256_sub_ps(z11, z4);
+}
+
+__attribute__((target("avx2"))) static inline void transpose_8x8(__m256* v) {
+	__m256 t0 = _mm256_unpacklo_ps(v[0], v[1]), t1 = _mm256_unpackhi_ps(v[0], v[1]);
+	__m256 t2 = _mm256_unpacklo_ps(v[2], v[3]), t3 = _mm256_unpackhi_ps(v[2], v[3]);
+	__m256 t4 = _mm256_unpacklo_ps(v[4], v[5]), t5 = _mm256_unpackhi_ps(v[4], v[5]);
+	__m256 t6 = _mm256_unpacklo_ps(v[6], v[7]), t7 = _mm256_unpackhi_ps(v[6], v[7]);
+	__m256 s0 = _mm256_shuffle_ps(t0, t2, 0x44), s1 = _mm256_shuffle_ps(t0, t2, 0xee);
+	__m256 s2 = _mm256_shuffle_ps(t1, t3, 0x44), s3 = _mm256_shuffle_ps(t1, t3, 0xee);
+	__m256 s4 = _mm256_shuffle_ps(t4, t6, 0x44), s5 = _mm256_shuffle_ps(t4, t6, 0xee);
+	__m256 s6 = _mm256_shuffle_ps(t5, t7, 0x44), s7 = _mm256_shuffle_ps(t5, t7, 0xee);
+	v[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+	v[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+	v[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+	v[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+	v[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+	v[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+	v[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+	v[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+__attribute__((target("avx2"))) void jpeg_fdct_avx2(const float* in, size_t stride, const float* scale, int16_t* out) {
+	// rows first like the scalar version: transposed, the rows are columns
+	// and one fdct_8x8 does all of them, then back for the columns
+	__m256 v[8];
+	for(int r = 0; r < 8; r++)
+		v[r] = _mm256_loadu_ps(in + stride * r);
+	transpose_8x8(v);
+	fdct_8x8(v);
+	transpose_8x8(v);
+	fdct_8x8(v);
+	// round half away from zero, as the scalar version does
+	const __m256 sign = _mm256_set1_ps(-0.0f), half = _mm256_set1_ps(0.5f);
+	for(int r = 0; r < 8; r += 2) {
+		__m256 a = _mm256_mul_ps(v[r], _mm256_loadu_ps(scale + 8 * r));
+		__m256 b = _mm256_mul_ps(v[r + 1], _mm256_loadu_ps(scale + 8 * r + 8));
+		a = _mm256_add_ps(a, _mm256_or_ps(_mm256_and_ps(a, sign), half));
+		b = _mm256_add_ps(b, _mm256_or_ps(_mm256_and_ps(b, sign), half));
+		__m256i q = _mm256_packs_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+		_mm256_storeu_si256((__m256i*) (out + 8 * r), _mm256_permute4x64_epi64(q, 0xd8));
+	}
+}
+#else
+void jpeg_ycc_avx2(const unsigned* px, size_t n, float* y, float* cb, float* cr) {
+	jpeg_ycc_scalar(px, n, y, cb, cr);
+}
+
+void jpeg_fdct_avx2(const float* in, size_t stride, const float* scale, int16_t* out) {
+	jpeg_fdct_scalar(in, stride, scale, out);
+}
+#endif
+
+static void ycc_detect(const unsigned* px, size_t n, float* y, float* cb, float* cr);
+static void fdct_detect(const float* in, size_t stride, const float* scale, int16_t* out);
+
+// resolved on first use. threads that race here store the same values,
+// so relaxed atomics are enough
+static void (*ycc_impl)(const unsigned*, size_t, float*, float*, float*) = ycc_detect;
+static void (*fdct_impl)(const float*, size_t, const float*, int16_t*) = fdct_detect;
+
+static void ycc_detect(const unsigned* px, size_t n, float* y, float* cb, float* cr) {
+#if defined(JPEG_X86)
+	void (*impl)(const unsigned*, size_t, float*, float*, float*) = __builtin_cpu_supports("avx2") ? jpeg_ycc_avx2 : jpeg_ycc_scalar;
+#else
+	void (*impl)(const unsigned*, size_t, float*, float*, float*) = jpeg_ycc_scalar;
+#endif
+	__atomic_store_n(&ycc_impl, impl, __ATOMIC_RELAXED);
+	impl(px, n, y, cb, cr);
+}
+
+static void fdct_detect(const float* in, size_t stride, const float* scale, int16_t* out) {
+#if defined(JPEG_X86)
+	void (*impl)(const float*, size_t, const float*, int16_t*) = __builtin_cpu_supports("avx2") ? jpeg_fdct_avx2 : jpeg_fdct_scalar;
+#else
+	void (*impl)(const float*, size_t, const float*, int16_t*) = jpeg_fdct_scalar;
+#endif
+	__atomic_store_n(&fdct_impl, impl, __ATOMIC_RELAXED);
+	impl(in, stride, scale, out);
+}
+
+void jpeg_ycc(const unsigned* px, size_t n, float* y, float* cb, float* cr) {
+	__atomic_load_n(&ycc_impl, __ATOMIC_RELAXED)(px, n, y, cb, cr);
+}
+
+void jpeg_fdct(const float* in, size_t stride, const float* scale, int16_t* out) {
+	__atomic_load_n(&fdct_impl, __ATOMIC_RELAXED)(in, stride, scale, out);
+}
+
+typedef struct {
+	uint16_t code[256]; /**< by symbol */
+	uint8_t len[256];
+} jpeg_huff_t;
+
+static void huff_build(jpeg_huff_t* t, const uint8_t* bits, const uint8_t* values) {
+	// canonical codes, annex C
+	unsigned code = 0;
+	int k = 0;
+	for(int len = 1; len <= 16; len++, code <<= 1) {
+		for(int i = 0; i < bits[len - 1]; i++, k++) {
+			t->code[values[k]] = (uint16_t) code++;
+			t->len[values[k]] = (uint8_t) len;
+		}
+	}
+}
+
+typedef struct {
+	uint8_t* data; /**< entropy coded rows of the band and the RSTn markers after them */
+	size_t len;
+	size_t cap;
+	uint64_t bits; /**< pending output bits, the last one lowest */
+	int nbits;
+	int ok;
+} jpeg_band_t;
+
+static int band_reserve(jpeg_band_t* band, size_t n) {
+	if(band->len + n <= band->cap)
+		return 1;
+	size_t cap = band->cap * 2 > band->len + n ? band->cap * 2 : band->len + n;
+	uint8_t* data = realloc(band->data, cap);
+	if(!data)
+		return band->ok = 0;
+	band->data = data;
+	band->cap = cap;
+	return 1;
+}
+
+static inline void put_bits(jpeg_band_t* band, uint32_t v, int n) {
+	// n is at most 27, so 32 bits go out at a time with room to spare.
+	// every 0xff byte is followed by a stuffed zero
+	band->bits = band->bits << n | v;
+	band->nbits += n;
+	if(band->nbits < 32)
+		return;
+	band->nbits -= 32;
+	uint32_t w = (uint32_t) (band->bits >> band->nbits);
+	uint8_t* p = band->data + band->len;
+	if((~w - 0x01010101u) & w & 0x80808080u) {
+		for(int i = 24; i >= 0; i -= 8) {
+			*p++ = (uint8_t) (w >> i);
+			if((uint8_t) (w >> i) == 0xff)
+				*p++ = 0;
+		}
+	}
+	else {
+		p[0] = (uint8_t) (w >> 24);
+		p[1] = (uint8_t) (w >> 16);
+		p[2] = (uint8_t) (w >> 8);
+		p[3] = (uint8_t) w;
+		p += 4;
+	}
+	band->len = p - band->data;
+}
+
+static void align_bits(jpeg_band_t* band) {
+	// pads with ones to a byte and writes what is pending
+	int pad = (8 - band->nbits % 8) % 8;
+	band->bits = band->bits << pad | ((1u << pad) - 1);
+	band->nbits += pad;
+	while(band->nbits > 0) {
+		band->nbits -= 8;
+		uint8_t c = (uint8_t) (band->bits >> band->nbits);
+		band->data[band->len++] = c;
+		if(c == 0xff)
+			band->data[band->len++] = 0;
+	}
+}
+
+static inline void put_coded(jpeg_band_t* band, const jpeg_huff_t* t, int run, int v) {
+	// the code of run and the size of v, then v itself in that many bits,
+	// less one if negative
+	unsigned a = v < 0 ? -v : v;
+	int size = a ? 32 - __builtin_clz(a) : 0;
+	int sym = run << 4 | size;
+	unsigned bits = (unsigned) (v < 0 ? v - 1 : v) & ((1u << size) - 1);
+	put_bits(band, (uint32_t) t->code[sym] << size | bits, t->len[sym] + size);
+}
+
+static void encode_block(jpeg_band_t* band, const int16_t* coef, int* dc, const jpeg_huff_t* dc_table, const jpeg_huff_t* ac_table) {
+	// the AC coefficients that are not zero are found from a bit mask, so
+	// runs of zeros cost nothing to skip
+	int zz[64];
+	uint64_t nonzero = 0;
+	for(int i = 0; i < 64; i++) {
+		zz[i] = coef[zigzag[i]];
+		nonzero |= (uint64_t) (zz[i] != 0) << i;
+	}
+	put_coded(band, dc_table, 0, zz[0] - *dc);
+	*dc = zz[0];
+	nonzero &= ~(uint64_t) 1;
+	int last = 0;
+	while(nonzero) {
+		int i = __builtin_ctzll(nonzero);
+		nonzero &= nonzero - 1;
+		int run = i - last - 1;
+		for(; run > 15; run -= 16)
+			put_bits(band, ac_table->code[0xf0], ac_table->len[0xf0]);
+		put_coded(band, ac_table, run, zz[i]);
+		last = i;
+	}
+	if(last != 63)
+		put_bits(band, ac_table->code[0x00], ac_table->len[0x00]);
+}
+
+typedef struct {
+	framebuffer_t* fb; /**< for jpeg_write_framebuffer */
+	const unsigned* pixels; /**< whole image, for jpeg_encode and jpeg_write_pixels */
+	int w;
+	int h;
+	int sub; /**< JPEG_420 */
+	int mcu; /**< pixels on a side of an MCU, 8 or 16 */
+	int mcus; /**< MCUs per row */
+	int mcu_rows;
+	int rows; /**< MCU rows per band */
+	int first; /**< band of bands[0] */
+	float scale[2][64]; /**< luma and chroma, see jpeg_fdct */
+	jpeg_huff_t dc[2];
+	jpeg_huff_t ac[2];
+	jpeg_band_t* bands;
+} jpeg_job_t;
+
+static void encode_band(void* ctx, int job_index, int worker) {
+	jpeg_job_t* job = (jpeg_job_t*) ctx;
+	jpeg_band_t* out = &job->bands[job_index];
+	int b = job->first + job_index;
+	int r0 = b * job->rows;
+	int r1 = r0 + job->rows < job->mcu_rows ? r0 + job->rows : job->mcu_rows;
+	int m = job->mcu, w = job->w;
+	size_t pw = (size_t) job->mcus * m;
+
+	// an MCU row at a time as three planes of pw by m floats. 4:2:0 chroma
+	// is averaged down in place, into the top left quarter
+	float* y = malloc(pw * m * 3 * sizeof(float));
+	float* cb = y + pw * m;
+	float* cr = cb + pw * m;
+	unsigned* scratch = job->fb ? malloc((size_t) w * sizeof(unsigned)) : NULL;
+	*out = (jpeg_band_t) {.ok = y && (!job->fb || scratch)};
+	band_reserve(out, pw * m * (r1 - r0) / 8 + BLOCK_BYTES);
+	int16_t coef[64];
+	for(int r = r0; out->ok && r < r1; r++) {
+		for(int i = 0; i < m; i++) {
+			// rows and columns past the image repeat the last ones
+			int row_y = r * m + i < job->h ? r * m + i : job->h - 1;
+			const unsigned* row = job->fb ? framebuffer_row(job->fb, row_y, scratch) : job->pixels + (size_t) w * row_y;
+			size_t o = pw * i;
+			jpeg_ycc(row, w, y + o, cb + o, cr + o);
+			for(size_t x = w; x < pw; x++) {
+				y[o + x] = y[o + w - 1];
+				cb[o + x] = cb[o + w - 1];
+				cr[o + x] = cr[o + w - 1];
+			}
+		}
+		if(job->sub) {
+			for(int i = 0; i < 8; i++) {
+				const float* s0 = cb + pw * 2 * i, * s1 = s0 + pw;
+				const float* t0 = cr + pw * 2 * i, * t1 = t0 + pw;
+				for(size_t x = 0; x < pw / 2; x++) {
+					cb[pw * i + x] = (s0[2 * x] + s0[2 * x + 1] + s1[2 * x] + s1[2 * x + 1]) * 0.25f;
+					cr[pw * i + x] = (t0[2 * x] + t0[2 * x + 1] + t1[2 * x] + t1[2 * x + 1]) * 0.25f;
+				}
+			}
+		}
+		int dc[3] = {0, 0, 0};
+		for(int mx = 0; mx < job->mcus; mx++) {
+			if(!band_reserve(out, (job->sub ? 6 : 3) * BLOCK_BYTES))
+				break;
+			for(int i = 0; i < (job->sub ? 4 : 1); i++) {
+				jpeg_fdct(y + pw * 8 * (i >> 1) + (size_t) m * mx + 8 * (i & 1), pw, job->scale[0], coef);
+				encode_block(out, coef, &dc[0], &job->dc[0], &job->ac[0]);
+			}
+			jpeg_fdct(cb + 8 * (size_t) mx, pw, job->scale[1], coef);
+			encode_block(out, coef, &dc[1], &job->dc[1], &job->ac[1]);
+			jpeg_fdct(cr + 8 * (size_t) mx, pw, job->scale[1], coef);
+			encode_block(out, coef, &dc[2], &job->dc[1], &job->ac[1]);
+		}
+		if(!band_reserve(out, 16))
+			break;
+		align_bits(out);
+		// every row but the last ends its restart interval, which also
+		// resets the DC predictions
+		if(r + 1 < job->mcu_rows) {
+			out->data[out->len++] = 0xff;
+			out->data[out->len++] = (uint8_t) (0xd0 + (r & 7));
+		}
+	}
+	free(y);
+	free(scratch);
+}
+
+typedef struct {
+	FILE* f; /**< file to write to, NULL to gather everything in buf */
+	uint8_t* buf;
+	size_t len;
+	size_t cap;
+	int ok;
+} jpeg_out_t;
+
+static void out_write(jpeg_out_t* out, const void* data, size_t n) {
+	if(!out->ok)
+		return;
+	if(out->f) {
+		out->ok = fwrite(data, 1, n, out->f) == n;
+		return;
+	}
+	if(out->len + n > out->cap) {
+		size_t cap = out->cap * 2 > out->len + n ? out->cap * 2 : out->len + n;
+		uint8_t* buf = realloc(out->buf, cap);
+		if(!buf) {
+			out->ok = 0;
+			return;
+		}
+		out->buf = buf;
+		out->cap = cap;
+	}
+	memcpy(out->buf + out->len, data, n);
+	out->len += n;
+}
+
+static uint8_t* put_dht(uint8_t* p, int id, const uint8_t* bits, const uint8_t* values, int n) {
+	*p++ = (uint8_t) id;
+	memcpy(p, bits, 16);
+	memcpy(p + 16, values, n);
+	return p + 16 + n;
+}
+
+static size_t put_headers(uint8_t* head, const jpeg_job_t* job, const uint8_t (*quant)[64]) {
+	static const uint8_t jfif[] = {0xff, 0xd8, 0xff, 0xe0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+	uint8_t* p = head;
+	memcpy(p, jfif, sizeof(jfif));
+	p += sizeof(jfif);
+	*p++ = 0xff;
+	*p++ = 0xdb;
+	*p++ = 0;
+	*p++ = 2 + 2 * 65;
+	for(int t = 0; t < 2; t++) {
+		*p++ = (uint8_t) t;
+		for(int i = 0; i < 64; i++)
+			*p++ = quant[t][zigzag[i]];
+	}
+	const uint8_t sof[] = {0xff, 0xc0, 0, 17, 8, (uint8_t) (job->h >> 8), (uint8_t) job->h, (uint8_t) (job->w >> 8),
+		(uint8_t) job->w, 3, 1, job->sub ? 0x22 : 0x11, 0, 2, 0x11, 1, 3, 0x11, 1};
+	memcpy(p, sof, sizeof(sof));
+	p += sizeof(sof);
+	size_t dht = 2 + 4 * 17 + 2 * sizeof(dc_values) + sizeof(ac_luma_values) + sizeof(ac_chroma_values);
+	*p++ = 0xff;
+	*p++ = 0xc4;
+	*p++ = (uint8_t) (dht >> 8);
+	*p++ = (uint8_t) dht;
+	p = put_dht(p, 0x00, dc_luma_bits, dc_values, sizeof(dc_values));
+	p = put_dht(p, 0x10, ac_luma_bits, ac_luma_values, sizeof(ac_luma_values));
+	p = put_dht(p, 0x01, dc_chroma_bits, dc_values, sizeof(dc_values));
+	p = put_dht(p, 0x11, ac_chroma_bits, ac_chroma_values, sizeof(ac_chroma_values));
+	// one restart interval per MCU row
+	const uint8_t dri[] = {0xff, 0xdd, 0, 4, (uint8_t) (job->mcus >> 8), (uint8_t) job->mcus};
+	static const uint8_t sos[] = {0xff, 0xda, 0, 12, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0};
+	memcpy(p, dri, sizeof(dri));
+	p += sizeof(dri);
+	memcpy(p, sos, sizeof(sos));
+	p += sizeof(sos);
+	return p - head;
+}
+
+static int encode_jpeg(jpeg_job_t* job, int quality, threadpool_t* pool, jpeg_out_t* out) {
+	if(job->w <= 0 || job->h <= 0 || job->w > 65535 || job->h > 65535 || (job->sub != JPEG_444 && job->sub != JPEG_420))
+		return 0;
+	// quality scales the example tables the way the IJG library does
+	quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
+	quality = quality < 50 ? 5000 / quality : 200 - quality * 2;
+	uint8_t quant[2][64];
+	for(int i = 0; i < 64; i++) {
+		int qy = (luma_quant[i] * quality + 50) / 100, qc = (chroma_quant[i] * quality + 50) / 100;
+		quant[0][i] = (uint8_t) (qy < 1 ? 1 : qy > 255 ? 255 : qy);
+		quant[1][i] = (uint8_t) (qc < 1 ? 1 : qc > 255 ? 255 : qc);
+		for(int t = 0; t < 2; t++)
+			job->scale[t][i] = 1 / (quant[t][i] * aan_scale[i / 8] * aan_scale[i % 8]);
+	}
+	huff_build(&job->dc[0], dc_luma_bits, dc_values);
+	huff_build(&job->ac[0], ac_luma_bits, ac_luma_values);
+	huff_build(&job->dc[1], dc_chroma_bits, dc_values);
+	huff_build(&job->ac[1], ac_chroma_bits, ac_chroma_values);
+	job->mcu = job->sub ? 16 : 8;
+	job->mcus = (job->w + job->mcu - 1) / job->mcu;
+	job->mcu_rows = (job->h + job->mcu - 1) / job->mcu;
+	size_t row_pixels = (size_t) job->mcus * job->mcu * job->mcu;
+	job->rows = JPEG_BAND_PIXELS / row_pixels > 0 ? (int) (JPEG_BAND_PIXELS / row_pixels) : 1;
+	int nbands = (job->mcu_rows + job->rows - 1) / job->rows;
+
+	uint8_t head[1024];
+	out_write(out, head, put_headers(head, job, quant));
+	// a few bands per thread are in flight at a time, which bounds the
+	// compressed data held
+	int wave = threadpool_size(pool) * 2;
+	job->bands = calloc(wave, sizeof(jpeg_band_t));
+	if(!job->bands)
+		return 0;
+	for(job->first = 0; out->ok && job->first < nbands; job->first += wave) {
+		int count = nbands - job->first < wave ? nbands - job->first : wave;
+		threadpool_run(pool, count, encode_band, job);
+		for(int i = 0; i < count; i++) {
+			jpeg_band_t* band = &job->bands[i];
+			if(!band->ok)
+				out->ok = 0;
+			out_write(out, band->data, band->len);
+			free(band->data);
+			band->data = NULL;
+		}
+	}
+	static const uint8_t eoi[] = {0xff, 0xd9};
+	out_write(out, eoi, sizeof(eoi));
+	free(job->bands);
+	return out->ok;
+}
+
+uint8_t* jpeg_encode(int w, int h, const unsigned* pixels, int quality, int subsampling, threadpool_t* pool, size_t* len) {
+	jpeg_job_t job = {.pixels = pixels, .w = w, .h = h, .sub = subsampling};
+	jpeg_out_t out = {.ok = 1};
+	if(!encode_jpeg(&job, quality, pool, &out)) {
+		free(out.buf);
+		return NULL;
+	}
+	*len = out.len;
+	return out.buf;
+}
+
+static int write_jpeg_job(const char* path, jpeg_job_t* job, int quality, threadpool_t* pool) {
+	jpeg_out_t out = {.ok = 1};
+	out.f = fopen(path, "wb");
+	if(!out.f)
+		return 0;
+	int ok = encode_jpeg(job, quality, pool, &out);
+	ok = fclose(out.f) == 0 && ok;
+	return ok;
+}
+
+int jpeg_write_pixels(const char* path, int w, int h, const unsigned* pixels, int quality, int subsampling, threadpool_t* pool) {
+	jpeg_job_t job = {.pixels = pixels, .w = w, .h = h, .sub = subsampling};
+	return write_jpeg_job(path, &job, quality, pool);
+}
+
+int jpeg_write_framebuffer(framebuffer_t* fb, const char* path, int quality, int subsampling, threadpool_t* pool) {
+	jpeg_job_t job = {.fb = fb, .w = fb->width, .h = fb->height, .sub = subsampling};
+	return write_jpeg_job(path, &job, quality, pool);
+}
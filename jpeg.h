@@ -0,0 +1,124 @@
+#ifndef JPEG_H
+#define JPEG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "framebuffer.h"
+#include "threadpool.h"
+
+// baseline JPEG writer
+//
+// coded the way stb_image_write does it: the example Huffman tables of
+// the standard, its quantization tables scaled the IJG way, a float AAN
+// DCT, and alpha dropped. pixels are converted to YCbCr eight at a time
+// and the DCT works on all eight rows or columns of a block at once with
+// AVX2 when the cpu has it
+//
+// every MCU row is a restart interval. a row needs nothing from the rows
+// before it, so bands of rows are encoded on separate threads and joined
+// by writing them one after another, with the RSTn markers in between.
+// the file is the same however many threads wrote it
+
+// quality of framebuffer_write, the same as it used with stb_image_write
+#define JPEG_QUALITY 90
+
+#define JPEG_444 0 /**< full resolution chroma */
+#define JPEG_420 1 /**< chroma at half the width and height, smaller files, blurs thin colored lines */
+
+// chroma of framebuffer_write, line art keeps its colors at full resolution
+#define JPEG_SUBSAMPLING JPEG_444
+
+// pixels per band encoded on one thread, rounded to whole MCU rows
+#define JPEG_BAND_PIXELS ((size_t) 1 << 20)
+
+/**
+ * @brief Encode rgba32 pixels as a JPEG in memory
+ *
+ * @param w width in pixels, at most 65535
+ * @param h height in pixels, at most 65535
+ * @param pixels w * h rgba32 pixels, row by row from the top, alpha is ignored
+ * @param quality 1 for smallest to 100 for best
+ * @param subsampling JPEG_444 or JPEG_420
+ * @param pool threads to encode bands on, NULL to encode on the calling thread
+ * @param len set to the number of bytes returned
+ *
+ * @return the encoded file, to be freed by the caller, NULL on failure
+ */
+uint8_t* jpeg_encode(int w, int h, const unsigned* pixels, int quality, int subsampling, threadpool_t* pool, size_t* len);
+
+/**
+ * @brief Write rgba32 pixels as a JPEG file
+ *
+ * See jpeg_encode for the parameters.
+ *
+ * @return 1 on success, 0 on failure
+ */
+int jpeg_write_pixels(const char* path, int w, int h, const unsigned* pixels, int quality, int subsampling, threadpool_t* pool);
+
+/**
+ * @brief Write any framebuffer as a JPEG file
+ *
+ * Bands read their rows with framebuffer_row, so there is no copy of
+ * the image. A few bands per thread are held until they are written.
+ *
+ * @param fb framebuffer to write
+ * @param path file to write
+ * @param quality 1 for smallest to 100 for best
+ * @param subsampling JPEG_444 or JPEG_420
+ * @param pool threads to encode bands on, NULL to encode on the calling thread
+ *
+ * @return 1 on success, 0 on failure
+ */
+int jpeg_write_framebuffer(framebuffer_t* fb, const char* path, int quality, int subsampling, threadpool_t* pool);
+
+/**
+ * @brief Convert rgba32 pixels to level shifted YCbCr, reference scalar version
+ *
+ * @param px pixels to convert
+ * @param n number of pixels
+ * @param y luma minus 128, n floats
+ * @param cb blue difference, n floats
+ * @param cr red difference, n floats
+ */
+void jpeg_ycc_scalar(const unsigned* px, size_t n, float* y, float* cb, float* cr);
+
+/**
+ * @brief AVX2 version of jpeg_ycc_scalar, 8 pixels per iteration, with the same results
+ *
+ * Only call this when the cpu supports AVX2, jpeg_ycc checks for you.
+ */
+void jpeg_ycc_avx2(const unsigned* px, size_t n, float* y, float* cb, float* cr);
+
+/**
+ * @brief Convert rgba32 pixels to YCbCr with the fastest version the cpu supports
+ *
+ * See jpeg_ycc_scalar for the parameters.
+ */
+void jpeg_ycc(const unsigned* px, size_t n, float* y, float* cb, float* cr);
+
+/**
+ * @brief DCT and quantize one 8x8 block, reference scalar version
+ *
+ * @param in first sample of the block
+ * @param stride floats from one row of the block to the next
+ * @param scale 64 reciprocal quantizer steps with the DCT's own scale folded in
+ * @param out 64 rounded coefficients in natural order, not zigzag
+ */
+void jpeg_fdct_scalar(const float* in, size_t stride, const float* scale, int16_t* out);
+
+/**
+ * @brief AVX2 version of jpeg_fdct_scalar, all 8 rows or columns at once, with the same results
+ *
+ * Only call this when the cpu supports AVX2, jpeg_fdct checks for you.
+ */
+void jpeg_fdct_avx2(const float* in, size_t stride, const float* scale, int16_t* out);
+
+/**
+ * @brief DCT and quantize one 8x8 block with the fastest version the cpu supports
+ *
+ * See jpeg_fdct_scalar for the parameters.
+ */
+void jpeg_fdct(const float* in, size_t stride, const float* scale, int16_t* out);
+
+#endif
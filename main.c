@@ -1,8 +1,22 @@
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+
 #include "framebuffer.h"
+#include "server.h"
+#include "density.h"
+#include "png.h"
+#include "bmp.h"
+#include "qoi.h"
+#include "jpeg.h"
+
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 int framebuffer_overrun(framebuffer_t* fb, point_t* px) {
-	int x_check = (px->x < 0) || (px->x > fb->width);
-	int y_check = (px->y < 0) || (px->y > fb->height);
+	int x_check = (px->x < 0) || (px->x >= fb->width);
+	int y_check = (px->y < 0) || (px->y >= fb->height);
 	if(x_check || y_check) {
 		//printf("out of bounds framebuffer access : %ux%u\n", px->x, px->y);
 		return 1;
@@ -11,29 +25,299 @@ int framebuffer_overrun(framebuffer_t* fb, point_t* px) {
 }
 
 framebuffer_t* framebuffer_init(int w, int h) {
-	int fb_sz = w * h * sizeof(unsigned);
-	unsigned* fb_frame = malloc(fb_sz);
-	memset(fb_frame, '\0', fb_sz);
+	return framebuffer_init_flags(w, h, 0);
+}
+
+static inline size_t format_size(int format) {
+	// bytes per pixel
+	if(format == FB_FORMAT_RGBA16)
+		return 4 * sizeof(uint16_t);
+	if(format == FB_FORMAT_RGBA32F)
+		return 4 * sizeof(float);
+	return sizeof(unsigned);
+}
+
+framebuffer_t* framebuffer_init_flags(int w, int h, unsigned flags) {
+	int format = flags & FB_RGBA32F ? FB_FORMAT_RGBA32F : flags & FB_RGBA16 ? FB_FORMAT_RGBA16 : FB_FORMAT_RGBA8;
 	framebuffer_t* fb = malloc(sizeof(framebuffer_t));
-	fb->fb = fb_frame;
+	if(!fb)
+		return NULL;
+	fb->fb = NULL;
+	fb->tiles = NULL;
+	fb->capacity = 0;
+	if(flags & FB_SPARSE) {
+		fb->tiles = sparse_init(w, h, format_size(format));
+		if(!fb->tiles) {
+			free(fb);
+			return NULL;
+		}
+	}
+	else {
+		size_t fb_sz = (size_t) w * h * format_size(format);
+		fb->fb = malloc(fb_sz);
+		if(!fb->fb) {
+			free(fb);
+			return NULL;
+		}
+		if(!(flags & FB_NO_CLEAR))
+			memset(fb->fb, '\0', fb_sz);
+		fb->capacity = (size_t) w * h;
+	}
 	fb->width = w;
 	fb->height = h;
+	fb->format = format;
+	fb->premultiplied = format == FB_FORMAT_RGBA8 && (flags & FB_PREMULTIPLIED) != 0;
+	fb->linear = format == FB_FORMAT_RGBA8 && !fb->premultiplied && (flags & FB_LINEAR) != 0;
+	framebuffer_set_scissor(fb, NULL);
 	return fb;
 }
 
+int framebuffer_resize(framebuffer_t* fb, int w, int h) {
+	if(fb->tiles)
+		return 0;
+	size_t n = (size_t) w * h;
+	if(n > fb->capacity) {
+		// the old pixels are not kept, so skip realloc's copy
+		void* fb_frame = malloc(n * format_size(fb->format));
+		if(!fb_frame)
+			return 0;
+		free(fb->fb);
+		fb->fb = fb_frame;
+		fb->capacity = n;
+	}
+	fb->width = w;
+	fb->height = h;
+	framebuffer_set_scissor(fb, NULL);
+	return 1;
+}
+
+void framebuffer_free(framebuffer_t* fb) {
+	if(!fb)
+		return;
+	sparse_free(fb->tiles);
+	free(fb->fb);
+	free(fb);
+}
+
+void framebuffer_set_scissor(framebuffer_t* fb, const rect_t* rect) {
+	rect_t all = {.x0 = 0, .y0 = 0, .x1 = fb->width, .y1 = fb->height};
+	fb->scissor = rect ? *rect : all;
+}
+
+static inline int rect_intersect(rect_t* out, const rect_t* a, const rect_t* b) {
+	out->x0 = a->x0 > b->x0 ? a->x0 : b->x0;
+	out->y0 = a->y0 > b->y0 ? a->y0 : b->y0;
+	out->x1 = a->x1 < b->x1 ? a->x1 : b->x1;
+	out->y1 = a->y1 < b->y1 ? a->y1 : b->y1;
+	return out->x0 < out->x1 && out->y0 < out->y1;
+}
+
+static inline int framebuffer_bounds(framebuffer_t* fb, rect_t* bounds) {
+	// the part of the framebuffer line drawing may touch
+	rect_t all = {.x0 = 0, .y0 = 0, .x1 = fb->width, .y1 = fb->height};
+	return rect_intersect(bounds, &all, &fb->scissor);
+}
+
+int framebuffer_tile(framebuffer_t* fb, int tx, int ty, int create, framebuffer_t* view) {
+	int fresh;
+	void* px = sparse_tile(fb->tiles, tx, ty, create, &fresh);
+	if(!px)
+		return 0;
+	int ox = tx << SPARSE_TILE_SHIFT, oy = ty << SPARSE_TILE_SHIFT;
+	*view = *fb;
+	view->fb = px;
+	view->tiles = NULL;
+	view->width = SPARSE_TILE;
+	view->height = SPARSE_TILE;
+	view->capacity = (size_t) SPARSE_TILE * SPARSE_TILE;
+	// edge tiles hang over the canvas, the part outside is never drawn
+	rect_t canvas = {.x0 = 0, .y0 = 0, .x1 = fb->width - ox, .y1 = fb->height - oy};
+	rect_t scissor = {fb->scissor.x0 - ox, fb->scissor.y0 - oy, fb->scissor.x1 - ox, fb->scissor.y1 - oy};
+	if(!rect_intersect(&view->scissor, &scissor, &canvas))
+		view->scissor = (rect_t) {0, 0, 0, 0};
+	if(fresh)
+		framebuffer_fill(view, fb->tiles->clear);
+	return 1;
+}
+
+static inline unsigned stored_color(framebuffer_t* fb, unsigned color) {
+	// colors come in straight and are kept in the framebuffer's format
+	return fb->premultiplied ? premultiply(color) : color;
+}
+
+static inline unsigned quantize(float v, float max, float bias) {
+	// bias 0.5 rounds, anything else in [0, 1) dithers
+	v = v * max + bias;
+	return v <= 0 ? 0 : v >= max ? (unsigned) max : (unsigned) v;
+}
+
+static void load_f32(const framebuffer_t* fb, size_t i, size_t n, float* out) {
+	// n pixels from pixel i as straight alpha floats, in any format
+	if(fb->format == FB_FORMAT_RGBA32F) {
+		memcpy(out, (const float*) fb->fb + 4 * i, n * 4 * sizeof(float));
+	}
+	else if(fb->format == FB_FORMAT_RGBA16) {
+		const uint16_t* src = (const uint16_t*) fb->fb + 4 * i;
+		for(size_t j = 0; j < 4 * n; j++)
+			out[j] = src[j] * (1.0f / 65535);
+	}
+	else {
+		const unsigned* src = (const unsigned*) fb->fb + i;
+		for(size_t j = 0; j < n; j++) {
+			unsigned color = fb->premultiplied ? unpremultiply(src[j]) : src[j];
+			for(int c = 0; c < 4; c++)
+				out[4 * j + c] = ((color >> (8 * c)) & 0xff) * (1.0f / 255);
+		}
+	}
+}
+
+static void store_f32(framebuffer_t* fb, size_t i, size_t n, const float* in) {
+	// the inverse of load_f32, rounding to the nearest value
+	if(fb->format == FB_FORMAT_RGBA32F) {
+		memcpy((float*) fb->fb + 4 * i, in, n * 4 * sizeof(float));
+	}
+	else if(fb->format == FB_FORMAT_RGBA16) {
+		uint16_t* dst = (uint16_t*) fb->fb + 4 * i;
+		for(size_t j = 0; j < 4 * n; j++)
+			dst[j] = (uint16_t) quantize(in[j], 65535, 0.5f);
+	}
+	else {
+		unsigned* dst = (unsigned*) fb->fb + i;
+		for(size_t j = 0; j < n; j++) {
+			unsigned color = 0;
+			for(int c = 0; c < 4; c++)
+				color |= quantize(in[4 * j + c], 255, 0.5f) << (8 * c);
+			dst[j] = stored_color(fb, color);
+		}
+	}
+}
+
+static inline void widen(unsigned color, float* px) {
+	for(int c = 0; c < 4; c++)
+		px[c] = ((color >> (8 * c)) & 0xff) * (1.0f / 255);
+}
+
+static void store_color(framebuffer_t* fb, size_t i, unsigned color) {
+	// one straight rgba32 color into pixel i
+	if(fb->format == FB_FORMAT_RGBA8) {
+		((unsigned*) fb->fb)[i] = stored_color(fb, color);
+		return;
+	}
+	float px[4];
+	widen(color, px);
+	store_f32(fb, i, 1, px);
+}
+
+static void fill_wide(framebuffer_t* fb, size_t i, size_t n, unsigned color) {
+	// the first pixel is converted and copied along the run
+	size_t size = format_size(fb->format);
+	char* dst = (char*) fb->fb + i * size;
+	store_color(fb, i, color);
+	for(size_t j = 1; j < n; j++)
+		memcpy(dst + j * size, dst, size);
+}
+
 unsigned framebuffer_px(framebuffer_t* fb, point_t* px) {
 	if(framebuffer_overrun(fb, px))
 		return -1;
-	unsigned* fbuf = (unsigned*) fb->fb;
-	return fbuf[(fb->width * px->y) + px->x];
+	if(fb->tiles) {
+		framebuffer_t view;
+		if(!framebuffer_tile(fb, px->x >> SPARSE_TILE_SHIFT, px->y >> SPARSE_TILE_SHIFT, 0, &view))
+			return fb->tiles->clear;
+		point_t local = {px->x & (SPARSE_TILE - 1), px->y & (SPARSE_TILE - 1)};
+		return framebuffer_px(&view, &local);
+	}
+	size_t i = (size_t) fb->width * px->y + px->x;
+	if(fb->format == FB_FORMAT_RGBA8) {
+		unsigned color = ((unsigned*) fb->fb)[i];
+		return fb->premultiplied ? unpremultiply(color) : color;
+	}
+	float f[4];
+	load_f32(fb, i, 1, f);
+	unsigned color = 0;
+	for(int c = 0; c < 4; c++)
+		color |= quantize(f[c], 255, 0.5f) << (8 * c);
+	return color;
+}
+
+void framebuffer_blend_span(framebuffer_t* fb, int x, int y, const uint8_t* coverage, size_t n, unsigned color) {
+	if(fb->tiles) {
+		// split the run where it crosses into the next tile
+		framebuffer_t view;
+		while(n > 0) {
+			size_t len = SPARSE_TILE - (x & (SPARSE_TILE - 1));
+			len = len < n ? len : n;
+			if(!framebuffer_tile(fb, x >> SPARSE_TILE_SHIFT, y >> SPARSE_TILE_SHIFT, 1, &view))
+				return;
+			framebuffer_blend_span(&view, x & (SPARSE_TILE - 1), y & (SPARSE_TILE - 1), coverage, len, color);
+			x += (int) len;
+			n -= len;
+			coverage = coverage ? coverage + len : NULL;
+		}
+		return;
+	}
+	size_t i = (size_t) fb->width * y + x;
+	unsigned* dst = (unsigned*) fb->fb + i;
+	if(fb->format == FB_FORMAT_RGBA16)
+		blend_span_rgba16((uint16_t*) fb->fb + 4 * i, coverage, n, color);
+	else if(fb->format == FB_FORMAT_RGBA32F)
+		blend_span_f32((float*) fb->fb + 4 * i, coverage, n, color);
+	else if(fb->premultiplied)
+		blend_span_premul(dst, coverage, n, premultiply(color));
+	else if(fb->linear)
+		blend_span_linear(dst, coverage, n, color);
+	else
+		blend_span(dst, coverage, n, color);
+}
+
+void framebuffer_blend_image(framebuffer_t* fb, int x, int y, const unsigned* src, size_t n) {
+	if(fb->tiles) {
+		framebuffer_t view;
+		while(n > 0) {
+			size_t len = SPARSE_TILE - (x & (SPARSE_TILE - 1));
+			len = len < n ? len : n;
+			if(!framebuffer_tile(fb, x >> SPARSE_TILE_SHIFT, y >> SPARSE_TILE_SHIFT, 1, &view))
+				return;
+			framebuffer_blend_image(&view, x & (SPARSE_TILE - 1), y & (SPARSE_TILE - 1), src, len);
+			x += (int) len;
+			n -= len;
+			src += len;
+		}
+		return;
+	}
+	size_t i = (size_t) fb->width * y + x;
+	unsigned* dst = (unsigned*) fb->fb + i;
+	if(fb->format == FB_FORMAT_RGBA8 && !fb->premultiplied) {
+		if(fb->linear)
+			blend_span_image_linear(dst, src, n);
+		else
+			blend_span_image(dst, src, n);
+		return;
+	}
+	// the others convert a piece of the run at a time
+	unsigned tmp[256];
+	float under[256 * 4], over[256 * 4];
+	for(size_t j = 0; j < n; j += 256) {
+		size_t m = n - j < 256 ? n - j : 256;
+		if(fb->format == FB_FORMAT_RGBA8) {
+			for(size_t k = 0; k < m; k++)
+				tmp[k] = premultiply(src[j + k]);
+			blend_span_image_premul(dst + j, tmp, m);
+			continue;
+		}
+		for(size_t k = 0; k < m; k++)
+			widen(src[j + k], over + 4 * k);
+		load_f32(fb, i + j, m, under);
+		blend_span_image_f32(under, over, m);
+		store_f32(fb, i + j, m, under);
+	}
 }
 
 // these rgba32 functions assume the framebuffer is ordered ARGB
 // with 8 bits for each
 //
-// for 16 bit color, these could be duplicated as rgba16 functions,
-// stored as unsigned with empty upper bits, then slice them off 
-// when put into the framebuffer
+// colors stay rgba32 for the wide formats too, they are widened when
+// they are stored, see load_f32 and store_f32
 
 unsigned rgba32(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
 	return a << 24 | b << 16 | g << 8 | r;
@@ -74,23 +358,335 @@ unsigned alpha_over(unsigned top, unsigned bot) {
 void set_px(framebuffer_t* fb, unsigned color, point_t* px) {
 	if(framebuffer_overrun(fb, px))
 		return;
+	if(fb->tiles) {
+		framebuffer_t view;
+		if(framebuffer_tile(fb, px->x >> SPARSE_TILE_SHIFT, px->y >> SPARSE_TILE_SHIFT, 1, &view)) {
+			point_t local = {px->x & (SPARSE_TILE - 1), px->y & (SPARSE_TILE - 1)};
+			set_px(&view, color, &local);
+		}
+		return;
+	}
+	store_color(fb, (size_t) fb->width * px->y + px->x, color);
+}
+
+void framebuffer_fill(framebuffer_t* fb, unsigned color) {
+	// the buffer is contiguous, so this is one long row
+	if(fb->tiles) {
+		// every tile reads back as the new color without being touched
+		sparse_clear(fb->tiles, color);
+		return;
+	}
+	size_t n = (size_t) fb->width * fb->height;
+	if(fb->format != FB_FORMAT_RGBA8) {
+		fill_wide(fb, 0, n, color);
+		return;
+	}
+	fill_span((unsigned*) fb->fb, n, stored_color(fb, color), n * sizeof(unsigned) > FILL_STREAM_BYTES);
+}
+
+void framebuffer_fill_rect(framebuffer_t* fb, unsigned color, const rect_t* rect) {
+	rect_t r;
+	if(!framebuffer_bounds(fb, &r) || !rect_intersect(&r, &r, rect))
+		return;
+	if(fb->tiles) {
+		framebuffer_t view;
+		for(int ty = r.y0 >> SPARSE_TILE_SHIFT; ty <= (r.y1 - 1) >> SPARSE_TILE_SHIFT; ty++) {
+			for(int tx = r.x0 >> SPARSE_TILE_SHIFT; tx <= (r.x1 - 1) >> SPARSE_TILE_SHIFT; tx++) {
+				if(!framebuffer_tile(fb, tx, ty, 1, &view))
+					return;
+				int ox = tx << SPARSE_TILE_SHIFT, oy = ty << SPARSE_TILE_SHIFT;
+				rect_t local = {r.x0 - ox, r.y0 - oy, r.x1 - ox, r.y1 - oy};
+				framebuffer_fill_rect(&view, color, &local);
+			}
+		}
+		return;
+	}
+	size_t w = r.x1 - r.x0;
+	if(fb->format != FB_FORMAT_RGBA8) {
+		for(int y = r.y0; y < r.y1; y++)
+			fill_wide(fb, (size_t) fb->width * y + r.x0, w, color);
+		return;
+	}
 	unsigned* fbuf = (unsigned*) fb->fb;
-	fbuf[(fb->width * px->y) + px->x] = color;
+	color = stored_color(fb, color);
+	int stream = w * (r.y1 - r.y0) * sizeof(unsigned) > FILL_STREAM_BYTES;
+	for(int y = r.y0; y < r.y1; y++)
+		fill_span(&fbuf[((size_t) fb->width * y) + r.x0], w, color, stream);
+}
+
+static void blit_wide(framebuffer_t* dst, framebuffer_t* src, const rect_t* s, const rect_t* d, int mode) {
+	// any format to any other through straight floats, a piece of a row
+	// at a time. blending here is always in the stored values, linear
+	// light or not
+	float tmp[256 * 4], under[256 * 4];
+	size_t w = d->x1 - d->x0;
+	for(int row = 0; row < d->y1 - d->y0; row++) {
+		size_t si = (size_t) src->width * (s->y0 + row) + s->x0;
+		size_t di = (size_t) dst->width * (d->y0 + row) + d->x0;
+		for(size_t i = 0; i < w; i += 256) {
+			size_t n = w - i < 256 ? w - i : 256;
+			load_f32(src, si + i, n, tmp);
+			if(mode == BLIT_BLEND) {
+				load_f32(dst, di + i, n, under);
+				blend_span_image_f32(under, tmp, n);
+				store_f32(dst, di + i, n, under);
+			}
+			else {
+				store_f32(dst, di + i, n, tmp);
+			}
+		}
+	}
+}
+
+static void blit_sparse(framebuffer_t* dst, framebuffer_t* src, const rect_t* s, const rect_t* d, int mode) {
+	// row by row as straight rgba32, wide formats lose their extra bits
+	unsigned* scratch = malloc((size_t) src->width * sizeof(unsigned));
+	if(!scratch)
+		return;
+	size_t w = d->x1 - d->x0;
+	for(int row = 0; row < d->y1 - d->y0; row++) {
+		const unsigned* srow = framebuffer_row(src, s->y0 + row, scratch) + s->x0;
+		if(mode == BLIT_BLEND) {
+			framebuffer_blend_image(dst, d->x0, d->y0 + row, srow, w);
+			continue;
+		}
+		for(size_t i = 0; i < w; i++) {
+			point_t px = {d->x0 + (int) i, d->y0 + row};
+			set_px(dst, srow[i], &px);
+		}
+	}
+	free(scratch);
+}
+
+void framebuffer_blit(framebuffer_t* dst, framebuffer_t* src, const rect_t* src_rect, int x, int y, int mode) {
+	rect_t s = {.x0 = 0, .y0 = 0, .x1 = src->width, .y1 = src->height};
+	if(src_rect && !rect_intersect(&s, &s, src_rect))
+		return;
+	// clip the destination and move the source rect by the same amount
+	rect_t d = {.x0 = x, .y0 = y, .x1 = x + (s.x1 - s.x0), .y1 = y + (s.y1 - s.y0)};
+	rect_t bounds;
+	if(!framebuffer_bounds(dst, &bounds) || !rect_intersect(&d, &d, &bounds))
+		return;
+	s.x0 += d.x0 - x;
+	s.y0 += d.y0 - y;
+	if(src->tiles || dst->tiles) {
+		blit_sparse(dst, src, &s, &d, mode);
+		return;
+	}
+	if(src->format != FB_FORMAT_RGBA8 || dst->format != FB_FORMAT_RGBA8) {
+		blit_wide(dst, src, &s, &d, mode);
+		return;
+	}
+	size_t w = d.x1 - d.x0;
+	unsigned* dbuf = (unsigned*) dst->fb;
+	unsigned* sbuf = (unsigned*) src->fb;
+	unsigned tmp[256];
+	for(int row = 0; row < d.y1 - d.y0; row++) {
+		unsigned* drow = &dbuf[((size_t) dst->width * (d.y0 + row)) + d.x0];
+		unsigned* srow = &sbuf[((size_t) src->width * (s.y0 + row)) + s.x0];
+		if(src->premultiplied == dst->premultiplied) {
+			if(mode != BLIT_BLEND)
+				memcpy(drow, srow, w * sizeof(unsigned));
+			else if(dst->premultiplied)
+				blend_span_image_premul(drow, srow, w);
+			else if(dst->linear)
+				blend_span_image_linear(drow, srow, w);
+			else
+				blend_span_image(drow, srow, w);
+			continue;
+		}
+		// formats differ, convert a piece of the row at a time
+		for(size_t i = 0; i < w; i += 256) {
+			size_t n = w - i < 256 ? w - i : 256;
+			for(size_t j = 0; j < n; j++)
+				tmp[j] = dst->premultiplied ? premultiply(srow[i + j]) : unpremultiply(srow[i + j]);
+			if(mode != BLIT_BLEND)
+				memcpy(drow + i, tmp, n * sizeof(unsigned));
+			else if(dst->premultiplied)
+				blend_span_image_premul(drow + i, tmp, n);
+			else if(dst->linear)
+				blend_span_image_linear(drow + i, tmp, n);
+			else
+				blend_span_image(drow + i, tmp, n);
+		}
+	}
+}
+
+const unsigned* framebuffer_row(framebuffer_t* fb, int y, unsigned* scratch) {
+	if(fb->tiles) {
+		framebuffer_t view;
+		unsigned tmp[SPARSE_TILE];
+		for(int x = 0; x < fb->width; x += SPARSE_TILE) {
+			size_t n = fb->width - x < SPARSE_TILE ? fb->width - x : SPARSE_TILE;
+			if(!framebuffer_tile(fb, x >> SPARSE_TILE_SHIFT, y >> SPARSE_TILE_SHIFT, 0, &view)) {
+				for(size_t i = 0; i < n; i++)
+					scratch[x + i] = fb->tiles->clear;
+				continue;
+			}
+			memcpy(scratch + x, framebuffer_row(&view, y & (SPARSE_TILE - 1), tmp), n * sizeof(unsigned));
+		}
+		return scratch;
+	}
+	size_t i = (size_t) fb->width * y;
+	if(fb->format == FB_FORMAT_RGBA8) {
+		const unsigned* row = (const unsigned*) fb->fb + i;
+		if(!fb->premultiplied)
+			return row;
+		for(int x = 0; x < fb->width; x++)
+			scratch[x] = unpremultiply(row[x]);
+		return scratch;
+	}
+	float f[256 * 4];
+	for(int x = 0; x < fb->width; x += 256) {
+		size_t n = fb->width - x < 256 ? fb->width - x : 256;
+		load_f32(fb, i + x, n, f);
+		for(size_t j = 0; j < n; j++) {
+			unsigned color = 0;
+			for(int c = 0; c < 4; c++)
+				color |= quantize(f[4 * j + c], 255, 0.5f) << (8 * c);
+			scratch[x + j] = color;
+		}
+	}
+	return scratch;
 }
 
 void framebuffer_repr(framebuffer_t* fb) {
-	unsigned* fbuf = (unsigned*) fb->fb;
 	printf("%dx%d\n", fb->width, fb->height);
 	for(int i = 0; i < fb->height; i++) {
 		for(int j = 0; j < fb->width; j++) {
-			printf("%u", fbuf[i * fb->width + j]);
+			point_t px = {j, i};
+			printf("%u", framebuffer_px(fb, &px));
 		}
 		putchar('\n');
 	}
 }
 
 void write_bmp(framebuffer_t* fb) {
-	stbi_write_bmp("framebuffer.bmp", fb->width, fb->height, 4, fb->fb);
+	framebuffer_write(fb, "framebuffer.bmp");
+}
+
+static const char* path_ext(const char* path) {
+	const char* ext = strrchr(path, '.');
+	return ext ? ext + 1 : "";
+}
+
+static int is_jpeg(const char* ext) {
+	return strcmp(ext, "jpg") == 0 || strcmp(ext, "jpeg") == 0;
+}
+
+static int is_bmp(const char* ext) {
+	return strcmp(ext, "png") != 0 && !is_jpeg(ext)
+		&& strcmp(ext, "tga") != 0 && strcmp(ext, "hdr") != 0 && strcmp(ext, "qoi") != 0;
+}
+
+static int write_pixels(const char* path, int w, int h, const void* pixels) {
+	const char* ext = path_ext(path);
+	if(strcmp(ext, "png") == 0)
+		return stbi_write_png(path, w, h, 4, pixels, w * 4) != 0;
+	if(is_jpeg(ext))
+		return jpeg_write_pixels(path, w, h, (const unsigned*) pixels, JPEG_QUALITY, JPEG_SUBSAMPLING, NULL);
+	if(strcmp(ext, "tga") == 0)
+		return stbi_write_tga(path, w, h, 4, pixels) != 0;
+	if(strcmp(ext, "qoi") == 0)
+		return qoi_write_pixels(path, w, h, (const unsigned*) pixels);
+	return bmp_write_pixels(path, w, h, 24, (const unsigned*) pixels);
+}
+
+static int write_hdr(framebuffer_t* fb, const char* path) {
+	// radiance files hold linear light, the pixels are sRGB
+	size_t n = (size_t) fb->width * fb->height;
+	float* px = malloc(n * 4 * sizeof(float));
+	if(!px)
+		return 0;
+	load_f32(fb, 0, n, px);
+	for(size_t i = 0; i < n; i++) {
+		for(int c = 0; c < 3; c++) {
+			float v = px[4 * i + c];
+			px[4 * i + c] = v <= 0.04045f ? v * (1.0f / 12.92f) : powf((v + 0.055f) * (1.0f / 1.055f), 2.4f);
+		}
+	}
+	int ok = stbi_write_hdr(path, fb->width, fb->height, 4, px) != 0;
+	free(px);
+	return ok;
+}
+
+static int write_dithered(framebuffer_t* fb, const char* path) {
+	// wide formats down to 8 bits with a 4x4 ordered dither, so smooth
+	// gradients do not band
+	static const uint8_t bayer[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+	size_t w = fb->width;
+	unsigned* out = malloc(w * fb->height * sizeof(unsigned));
+	float* row = malloc(w * 4 * sizeof(float));
+	if(!out || !row) {
+		free(out);
+		free(row);
+		return 0;
+	}
+	for(int y = 0; y < fb->height; y++) {
+		load_f32(fb, w * y, w, row);
+		for(size_t x = 0; x < w; x++) {
+			float bias = (bayer[y & 3][x & 3] + 0.5f) * (1.0f / 16);
+			unsigned color = 0;
+			for(int c = 0; c < 4; c++)
+				color |= quantize(row[4 * x + c], 255, bias) << (8 * c);
+			out[w * y + x] = color;
+		}
+	}
+	int ok = write_pixels(path, fb->width, fb->height, out);
+	free(out);
+	free(row);
+	return ok;
+}
+
+static int write_rows(framebuffer_t* fb, const char* path) {
+	// the writers want the whole image in memory
+	size_t w = fb->width;
+	unsigned* out = malloc(w * fb->height * sizeof(unsigned));
+	if(!out)
+		return 0;
+	for(int y = 0; y < fb->height; y++) {
+		const unsigned* row = framebuffer_row(fb, y, out + w * y);
+		if(row != out + w * y)
+			memcpy(out + w * y, row, w * sizeof(unsigned));
+	}
+	int ok = write_pixels(path, fb->width, fb->height, out);
+	free(out);
+	return ok;
+}
+
+int framebuffer_write(framebuffer_t* fb, const char* path) {
+	return framebuffer_write_mt(fb, path, PNG_PROFILE, NULL);
+}
+
+int framebuffer_write_mt(framebuffer_t* fb, const char* path, int png_profile, threadpool_t* pool) {
+	// png, jpeg, bmp and qoi are written a row at a time, there is never a second copy
+	if(strcmp(path_ext(path), "png") == 0 && (fb->tiles || fb->format == FB_FORMAT_RGBA8))
+		return png_write_framebuffer_mt(fb, path, png_profile, pool);
+	if(is_jpeg(path_ext(path)) && (fb->tiles || fb->format == FB_FORMAT_RGBA8))
+		return jpeg_write_framebuffer(fb, path, JPEG_QUALITY, JPEG_SUBSAMPLING, pool);
+	if(is_bmp(path_ext(path)) && (fb->tiles || fb->format == FB_FORMAT_RGBA8))
+		return bmp_write_framebuffer(fb, path, 24);
+	if(strcmp(path_ext(path), "qoi") == 0 && (fb->tiles || fb->format == FB_FORMAT_RGBA8))
+		return qoi_write_framebuffer(fb, path);
+	if(fb->tiles)
+		return strcmp(path_ext(path), "hdr") != 0 && write_rows(fb, path);
+	if(strcmp(path_ext(path), "hdr") == 0)
+		return write_hdr(fb, path);
+	if(fb->format != FB_FORMAT_RGBA8)
+		return write_dithered(fb, path);
+	if(!fb->premultiplied)
+		return write_pixels(path, fb->width, fb->height, fb->fb);
+	// the writers expect straight alpha
+	size_t n = (size_t) fb->width * fb->height;
+	unsigned* straight = malloc(n * sizeof(unsigned));
+	if(!straight)
+		return 0;
+	const unsigned* src = (const unsigned*) fb->fb;
+	for(size_t i = 0; i < n; i++)
+		straight[i] = unpremultiply(src[i]);
+	int ok = write_pixels(path, fb->width, fb->height, straight);
+	free(straight);
+	return ok;
 }
 
 unsigned multiply_alpha(unsigned color, double alpha) {
@@ -107,8 +703,11 @@ static inline double frac_part(double x) {
 	return x - int_part(x);
 }
 
-int draw_aaline_steep(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2) {
+int draw_aaline_steep_double(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2) {
 	// antialiased line drawing using Xiaolin Wu's algorithm
+	// this is the original double precision version, draw_aaline uses
+	// the fixed point kernels below and this is kept to compare against
+	//
 	// dy and dx are computed twice, they could be stashed
 	// somewhere during draw_aaline
 	double dx = p2->x - p1->x;
@@ -140,30 +739,45 @@ int draw_aaline_steep(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p
 	return 1;
 }
 
-int draw_line_vertical(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2) {
-	point_t line_px = {.x = p1->x, .y = -1};
-	unsigned color_blended = -1;
-	for(int t = p1->y; t <= p2->y; t++) {
-		line_px.y = t;
-		color_blended = alpha_over(color, framebuffer_px(fb, &line_px));
-		set_px(fb, color_blended, &line_px);
+int draw_line_vertical(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2, const rect_t* clip) {
+	if(p1->x < clip->x0 || p1->x >= clip->x1)
+		return 1;
+	int t0 = p1->y < clip->y0 ? clip->y0 : p1->y;
+	int t1 = p2->y >= clip->y1 ? clip->y1 - 1 : p2->y;
+	unsigned* fbuf = (unsigned*) fb->fb;
+	int premul = fb->premultiplied, linear = fb->linear, format = fb->format;
+	color = stored_color(fb, color);
+	for(int t = t0; t <= t1; t++) {
+		size_t i = (size_t) fb->width * t + p1->x;
+		unsigned* dst = &fbuf[i];
+		if(format == FB_FORMAT_RGBA16)
+			blend_px_rgba16((uint16_t*) fb->fb + 4 * i, color, 255);
+		else if(format == FB_FORMAT_RGBA32F)
+			blend_px_f32((float*) fb->fb + 4 * i, color, 255);
+		else if(premul)
+			*dst = blend_px_premul(*dst, color, 255);
+		else if(linear)
+			*dst = blend_px_linear(*dst, color, 255);
+		else
+			*dst = blend_px(*dst, color, 255);
 	}	
 	return 1;
 }
 
-int draw_line_horizontal(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2) {
+int draw_line_horizontal(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2, const rect_t* clip) {
 	// XXX: this generates a little stumble pixel at the start
-	point_t line_px = {.x = -1, .y = p1->y};
-	unsigned color_blended = -1;
-	for(int t = p1->x; t <= p2->x; t++) {
-		line_px.x = t;
-		color_blended = alpha_over(color, framebuffer_px(fb, &line_px));
-		set_px(fb, color_blended, &line_px);
-	}	
+	// the row is contiguous so it goes through the span blender
+	if(p1->y < clip->y0 || p1->y >= clip->y1)
+		return 1;
+	int x0 = p1->x < clip->x0 ? clip->x0 : p1->x;
+	int x1 = p2->x >= clip->x1 ? clip->x1 - 1 : p2->x;
+	if(x0 > x1)
+		return 1;
+	framebuffer_blend_span(fb, x0, p1->y, NULL, x1 - x0 + 1, color);
 	return 1;
 }
 
-int draw_aaline_shallow(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2) {
+int draw_aaline_shallow_double(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2) {
 	// this is largely the same as draw_aaline_steep
 	// maybe a clever person could use one function, it would be easy with objects
 	double dx = p2->x - p1->x;
@@ -195,82 +809,593 @@ int draw_aaline_shallow(framebuffer_t* fb, unsigned color, point_t* p1, point_t*
 	return 1;
 }
 
-int draw_aaline(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2) {
+// the fixed point kernels keep the minor axis position as 32.32 in an int64
+// 16.16 drifts by len/65536 pixels over a line, which is several coverage
+// LSBs on long lines, while 32 fraction bits keep the error under one LSB
+// for any line that fits in a framebuffer
+//
+// the step is rounded down and the start is nudged up by WU_BIAS so that
+// positions landing exactly on a pixel boundary (1/3 + 1/3 + 1/3) do not
+// truncate into the previous pixel
+#define WU_FRAC_BITS 32
+#define WU_ONE ((int64_t) 1 << WU_FRAC_BITS)
+#define WU_BIAS ((int64_t) 1 << (WU_FRAC_BITS - 12))
+#define WU_COVERAGE(pos) ((unsigned) ((uint64_t) (pos) >> (WU_FRAC_BITS - 8)) & 0xff)
+
+static inline int64_t wu_step(int64_t minor, int64_t major) {
+	// minor / major as 32.32, rounded towards -inf
+	// major is always positive here
+	int64_t num = minor * WU_ONE;
+	int64_t step = num / major;
+	if(num % major < 0)
+		step--;
+	return step;
+}
+
+static inline int64_t floor_div64(int64_t a, int64_t b) {
+	// b is always positive here
+	int64_t q = a / b;
+	if(a % b < 0)
+		q--;
+	return q;
+}
+
+static inline void wu_range(int64_t start, int64_t step, int64_t lo, int64_t hi, int64_t* k0, int64_t* k1) {
+	// narrow [k0, k1] to the steps k where lo <= start + k * step < hi
+	// this is the Liang-Barsky test for one pair of clip edges, done on
+	// the fixed point positions the walk will actually produce
+	int64_t a, b;
+	if(step > 0) {
+		a = -floor_div64(start - lo, step);
+		b = floor_div64(hi - 1 - start, step);
+	}
+	else if(step < 0) {
+		a = -floor_div64(hi - 1 - start, -step);
+		b = floor_div64(start - lo, -step);
+	}
+	else {
+		if(start < lo || start >= hi)
+			*k0 = *k1 + 1;
+		return;
+	}
+	if(a > *k0)
+		*k0 = a;
+	if(b < *k1)
+		*k1 = b;
+}
+
+// a Wu walk in terms of its own axes, the major axis advances one pixel
+// per step and the minor axis is the fixed point position
+typedef struct {
+	int major_lo; /**< clip rect along the major axis, hi exclusive */
+	int major_hi;
+	int minor_lo; /**< clip rect along the minor axis, hi exclusive */
+	int minor_hi;
+	ptrdiff_t major_stride; /**< pixels between neighbours on each axis */
+	ptrdiff_t minor_stride;
+} wu_axes_t;
+
+static inline void wu_axes(wu_axes_t* ax, framebuffer_t* fb, const rect_t* clip, int steep) {
+	if(steep) {
+		*ax = (wu_axes_t) {clip->y0, clip->y1, clip->x0, clip->x1, fb->width, 1};
+	}
+	else {
+		*ax = (wu_axes_t) {clip->x0, clip->x1, clip->y0, clip->y1, 1, fb->width};
+	}
+}
+
+// the walk is only fast with op folded into it, which gcc will not do
+// on its own once there are more than a few copies
+#if defined(__GNUC__)
+#define WU_INLINE static inline __attribute__((always_inline))
+#else
+#define WU_INLINE static inline
+#endif
+
+// what a Wu walk does with a pixel's coverage, WU_ADD treats the pixels
+// as uint32 counts, see density.h
+enum {
+	WU_BLEND,
+	WU_BLEND_PREMUL, /**< the color is premultiplied already */
+	WU_BLEND_LINEAR, /**< blend in linear light */
+	WU_BLEND_RGBA16,
+	WU_BLEND_F32,
+	WU_ADD
+};
+
+static inline int blend_op(framebuffer_t* fb) {
+	// the op that blends in fb's format
+	if(fb->format == FB_FORMAT_RGBA16)
+		return WU_BLEND_RGBA16;
+	if(fb->format == FB_FORMAT_RGBA32F)
+		return WU_BLEND_F32;
+	return fb->premultiplied ? WU_BLEND_PREMUL : fb->linear ? WU_BLEND_LINEAR : WU_BLEND;
+}
+
+WU_INLINE void wu_apply(void* buf, ptrdiff_t i, unsigned color, unsigned coverage, int op) {
+	// pixel i of buf, whose layout the op implies
+	unsigned* dst = (unsigned*) buf + i;
+	if(op == WU_BLEND_RGBA16)
+		blend_px_rgba16((uint16_t*) buf + 4 * i, color, coverage);
+	else if(op == WU_BLEND_F32)
+		blend_px_f32((float*) buf + 4 * i, color, coverage);
+	else if(op == WU_ADD)
+		*dst += coverage;
+	else if(op == WU_BLEND_PREMUL)
+		*dst = blend_px_premul(*dst, color, coverage);
+	else if(op == WU_BLEND_LINEAR)
+		*dst = blend_px_linear(*dst, color, coverage);
+	else
+		*dst = blend_px(*dst, color, coverage);
+}
+
+WU_INLINE void wu_plot(framebuffer_t* fb, unsigned color, const wu_axes_t* ax, int major, int minor, unsigned coverage, int op) {
+	if(major < ax->major_lo || major >= ax->major_hi || minor < ax->minor_lo || minor >= ax->minor_hi)
+		return;
+	wu_apply(fb->fb, major * ax->major_stride + minor * ax->minor_stride, color, coverage, op);
+}
+
+WU_INLINE void wu_walk(framebuffer_t* fb, unsigned color, const wu_axes_t* ax, int major_first, int64_t count,
+		int64_t pos, int64_t step, int shift, int op) {
+	// fixed point Xiaolin Wu shared by every line kernel, the top byte of
+	// the fraction is used directly as the coverage of the second pixel,
+	// which sits shift pixels away on the minor axis. op is a constant at
+	// every call site so each one gets its own copy of the loops
+	//
+	// step k in [0, count) draws major_first + k at minor position
+	// pos + k * step. the range of k is clipped once up front: the head
+	// and tail steps have one of their two pixels outside the clip rect
+	// and are checked, the steps in between are drawn unchecked
+	int lo_shift = shift < 0 ? shift : 0;
+	int hi_shift = shift > 0 ? shift : 0;
+
+	int64_t k0 = 0, k1 = count - 1;
+	if((int64_t) ax->major_lo - major_first > k0)
+		k0 = (int64_t) ax->major_lo - major_first;
+	if((int64_t) ax->major_hi - 1 - major_first < k1)
+		k1 = (int64_t) ax->major_hi - 1 - major_first;
+	// steps with at least one pixel inside the rect. minor coordinates
+	// can be negative, so they are scaled by multiplying, not shifting
+	wu_range(pos, step, (ax->minor_lo - hi_shift) * WU_ONE, (ax->minor_hi - lo_shift) * WU_ONE, &k0, &k1);
+	if(k0 > k1)
+		return;
+	// steps with both pixels inside the rect
+	int64_t b0 = k0, b1 = k1;
+	wu_range(pos, step, (ax->minor_lo - lo_shift) * WU_ONE, (ax->minor_hi - hi_shift) * WU_ONE, &b0, &b1);
+	if(b0 > b1) {
+		b0 = k1 + 1;
+		b1 = k1;
+	}
+
+	ptrdiff_t second = shift * ax->minor_stride;
+	int64_t p;
+	unsigned coverage;
+	int m;
+	for(int64_t k = k0; k < b0; k++) {
+		p = pos + k * step;
+		coverage = WU_COVERAGE(p);
+		m = (int) (p >> WU_FRAC_BITS);
+		wu_plot(fb, color, ax, (int) (major_first + k), m, 255 - coverage, op);
+		wu_plot(fb, color, ax, (int) (major_first + k), m + shift, coverage, op);
+	}
+	p = pos + b0 * step;
+	for(int64_t k = b0; k <= b1; k++) {
+		coverage = WU_COVERAGE(p);
+		m = (int) (p >> WU_FRAC_BITS);
+		ptrdiff_t i = (major_first + k) * ax->major_stride + m * ax->minor_stride;
+		wu_apply(fb->fb, i, color, 255 - coverage, op);
+		wu_apply(fb->fb, i + second, color, coverage, op);
+		p += step;
+	}
+	for(int64_t k = b1 + 1; k <= k1; k++) {
+		p = pos + k * step;
+		coverage = WU_COVERAGE(p);
+		m = (int) (p >> WU_FRAC_BITS);
+		wu_plot(fb, color, ax, (int) (major_first + k), m, 255 - coverage, op);
+		wu_plot(fb, color, ax, (int) (major_first + k), m + shift, coverage, op);
+	}
+}
+
+static inline void wu_walk_any(framebuffer_t* fb, unsigned color, const wu_axes_t* ax, int major_first, int64_t count,
+		int64_t pos, int64_t step, int shift, int op) {
+	// wu_walk for an op only known at run time, each value still gets
+	// its own copy of the loops
+	switch(op) {
+	case WU_ADD:
+		wu_walk(fb, color, ax, major_first, count, pos, step, shift, WU_ADD);
+		break;
+	case WU_BLEND_PREMUL:
+		wu_walk(fb, color, ax, major_first, count, pos, step, shift, WU_BLEND_PREMUL);
+		break;
+	case WU_BLEND_LINEAR:
+		wu_walk(fb, color, ax, major_first, count, pos, step, shift, WU_BLEND_LINEAR);
+		break;
+	case WU_BLEND_RGBA16:
+		wu_walk(fb, color, ax, major_first, count, pos, step, shift, WU_BLEND_RGBA16);
+		break;
+	case WU_BLEND_F32:
+		wu_walk(fb, color, ax, major_first, count, pos, step, shift, WU_BLEND_F32);
+		break;
+	default:
+		wu_walk(fb, color, ax, major_first, count, pos, step, shift, WU_BLEND);
+		break;
+	}
+}
+
+static inline void wu_line(framebuffer_t* fb, unsigned color, const wu_axes_t* ax, int major0, int major1, int minor0, int64_t dminor, int op) {
+	// integer endpoints, the walk steps before it draws so the first
+	// pixel is already one step along
+	int64_t step = wu_step(dminor, major1 - major0);
+	// lines may start off the canvas, minor0 * WU_ONE keeps a negative
+	// start defined where a shift would not
+	int64_t start = minor0 * WU_ONE + WU_BIAS;
+	int shift;
+	if(step > WU_ONE)
+		shift = 1;
+	else
+		shift = -1;
+	wu_walk_any(fb, color, ax, major0, (int64_t) major1 - major0 + 1, start + step, step, shift, op);
+}
+
+int draw_aaline_steep(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2, const rect_t* clip) {
+	// walks y, p1->y <= p2->y
+	wu_axes_t ax;
+	wu_axes(&ax, fb, clip, 1);
+	wu_line(fb, stored_color(fb, color), &ax, p1->y, p2->y, p1->x, p2->x - p1->x, blend_op(fb));
+	return 1;
+}
+
+int draw_aaline_shallow(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2, const rect_t* clip) {
+	// same as draw_aaline_steep with the axes swapped, p1->x <= p2->x
+	wu_axes_t ax;
+	wu_axes(&ax, fb, clip, 0);
+	wu_line(fb, stored_color(fb, color), &ax, p1->x, p2->x, p1->y, p2->y - p1->y, blend_op(fb));
+	return 1;
+}
+
+// a segment can draw up to this many pixels past its bounding box, one
+// for the second Wu pixel and one for the walk overshooting the end
+#define SEGMENT_MARGIN 2
+
+size_t segments_visible(const segment_t* segs, size_t n, const rect_t* rect, uint8_t* visible) {
+	size_t count = 0;
+	int x0 = rect->x0 - SEGMENT_MARGIN, y0 = rect->y0 - SEGMENT_MARGIN;
+	int x1 = rect->x1 + SEGMENT_MARGIN, y1 = rect->y1 + SEGMENT_MARGIN;
+	size_t i = 0;
+#ifdef __SSE2__
+	// both endpoints are the first four ints of a segment_t, so each one
+	// is a single load and two compares, the movemask bits are x1 y1 x2 y2
+	__m128i lo = _mm_setr_epi32(x0, y0, x0, y0);
+	__m128i hi = _mm_setr_epi32(x1 - 1, y1 - 1, x1 - 1, y1 - 1);
+	for(; i < n; i++) {
+		__m128i v = _mm_loadu_si128((const __m128i*) &segs[i]);
+		int below = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(v, lo)));
+		int above = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, hi)));
+		int out = (below & (below >> 2)) | (above & (above >> 2));
+		visible[i] = (out & 3) == 0;
+		count += visible[i];
+	}
+#endif
+	for(; i < n; i++) {
+		const segment_t* seg = &segs[i];
+		int out = (seg->p1.x < x0 && seg->p2.x < x0) || (seg->p1.x >= x1 && seg->p2.x >= x1)
+			|| (seg->p1.y < y0 && seg->p2.y < y0) || (seg->p1.y >= y1 && seg->p2.y >= y1);
+		visible[i] = !out;
+		count += visible[i];
+	}
+	return count;
+}
+
+static int draw_sparse(framebuffer_t* fb, unsigned color, const point_t* p1, const point_t* p2,
+		const pointfx_t* f1, const pointfx_t* f2, const rect_t* bounds) {
+	// the line is drawn into every tile it comes within SEGMENT_MARGIN of,
+	// clipped to the tile, which draws the same pixels as one dense call.
+	// either the integer or the fixed point endpoints are given
+	double x0 = p1 ? p1->x : (double) f1->x / FX_ONE, y0 = p1 ? p1->y : (double) f1->y / FX_ONE;
+	double x1 = p1 ? p2->x : (double) f2->x / FX_ONE, y1 = p1 ? p2->y : (double) f2->y / FX_ONE;
+	double ylo = (y0 < y1 ? y0 : y1) - SEGMENT_MARGIN, yhi = (y0 < y1 ? y1 : y0) + SEGMENT_MARGIN;
+	int ty0 = (ylo > bounds->y0 ? (int) ylo : bounds->y0) >> SPARSE_TILE_SHIFT;
+	int ty1 = (yhi < bounds->y1 - 1 ? (int) yhi : bounds->y1 - 1) >> SPARSE_TILE_SHIFT;
+	framebuffer_t view;
+	for(int ty = ty0; ty <= ty1; ty++) {
+		// the part of the line within reach of this row of tiles
+		double xa = x0, xb = x1;
+		if(y0 != y1) {
+			double ta = (((ty << SPARSE_TILE_SHIFT) - SEGMENT_MARGIN) - y0) / (y1 - y0);
+			double tb = ((((ty + 1) << SPARSE_TILE_SHIFT) + SEGMENT_MARGIN) - y0) / (y1 - y0);
+			ta = ta < 0 ? 0 : ta > 1 ? 1 : ta;
+			tb = tb < 0 ? 0 : tb > 1 ? 1 : tb;
+			xa = x0 + (x1 - x0) * ta;
+			xb = x0 + (x1 - x0) * tb;
+		}
+		double xlo = (xa < xb ? xa : xb) - SEGMENT_MARGIN, xhi = (xa < xb ? xb : xa) + SEGMENT_MARGIN;
+		if(xhi < bounds->x0 || xlo >= bounds->x1)
+			continue;
+		int tx0 = (xlo > bounds->x0 ? (int) xlo : bounds->x0) >> SPARSE_TILE_SHIFT;
+		int tx1 = (xhi < bounds->x1 - 1 ? (int) xhi : bounds->x1 - 1) >> SPARSE_TILE_SHIFT;
+		for(int tx = tx0; tx <= tx1; tx++) {
+			if(!framebuffer_tile(fb, tx, ty, 1, &view))
+				return 0;
+			int ox = tx << SPARSE_TILE_SHIFT, oy = ty << SPARSE_TILE_SHIFT;
+			rect_t local = {bounds->x0 - ox, bounds->y0 - oy, bounds->x1 - ox, bounds->y1 - oy};
+			if(p1) {
+				point_t q1 = {p1->x - ox, p1->y - oy}, q2 = {p2->x - ox, p2->y - oy};
+				draw_aaline_clip(&view, color, &q1, &q2, &local);
+			}
+			else {
+				pointfx_t q1 = {f1->x - ox * FX_ONE, f1->y - oy * FX_ONE};
+				pointfx_t q2 = {f2->x - ox * FX_ONE, f2->y - oy * FX_ONE};
+				draw_aaline_fx_clip(&view, color, &q1, &q2, &local);
+			}
+		}
+	}
+	return 1;
+}
+
+int draw_aaline_clip(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2, const rect_t* clip) {
 	// this function dispatches to others to do the actual drawing based
 	// on the flavor of the line
 	//
 	// p1 and p2 must be ordered so that p1 < p2 
+	rect_t bounds;
+	if(!framebuffer_bounds(fb, &bounds))
+		return 1;
+	if(clip && !rect_intersect(&bounds, &bounds, clip))
+		return 1;
+	if(fb->tiles)
+		return draw_sparse(fb, color, p1, p2, NULL, NULL, &bounds);
 	double dx = p2->x - p1->x;
 	double dy = p2->y - p1->y;
 	if(dx == 0.0) {
 		// the line is vertical
 		// this also handles the degenerate case of p1 == p2
 		if(dy > 0) 
-			return draw_line_vertical(fb, color, p1, p2);
+			return draw_line_vertical(fb, color, p1, p2, &bounds);
 		else
-			return draw_line_vertical(fb, color, p2, p1);
+			return draw_line_vertical(fb, color, p2, p1, &bounds);
 	}
 	if(dy == 0.0) {
 		// the line is horizontal
 		if(dx > 0)
-			return draw_line_horizontal(fb, color, p1, p2);
+			return draw_line_horizontal(fb, color, p1, p2, &bounds);
 		else
-			return draw_line_horizontal(fb, color, p2, p1);
+			return draw_line_horizontal(fb, color, p2, p1, &bounds);
 	}
 	if(fabs(dx) > fabs(dy)) {
 		// the slope is in [-1, 1]
 		// the line is drawn as y(x)
 		if(p2->x < p1->x)
-			return draw_aaline_shallow(fb, color, p2, p1);
+			return draw_aaline_shallow(fb, color, p2, p1, &bounds);
 		else
-			return draw_aaline_shallow(fb, color, p1, p2);
+			return draw_aaline_shallow(fb, color, p1, p2, &bounds);
 	}
 	else {
 		// the slope is not in [-1, 1]
 		// the line is drawn as x(y)
 		if(p2->y < p1->y)
-			return draw_aaline_steep(fb, color, p2, p1);
+			return draw_aaline_steep(fb, color, p2, p1, &bounds);
 		else
-			return draw_aaline_steep(fb, color, p1, p2);
+			return draw_aaline_steep(fb, color, p1, p2, &bounds);
 	}
 }
 
-int draw_aaline_thick(framebuffer_t* fb, unsigned color, unsigned thickness, point_t* p1, point_t* p2) {
-	// this function draws lines alternating on either side of the specified line to give thickness
-	// XXX: this sometimes has strange striping on the line
-	int sign = 1;
-	int retval = 1;
-	point_t p1_shifted = {.x = p1->x, .y = p1->y};
-	point_t p2_shifted = {.x = p2->x, .y = p2->y};
-	for(int i = 0; i < thickness; i++) {
-		p1_shifted.y += i * sign;
-		p2_shifted.y += i * sign;
-		retval &= draw_aaline(fb, color, &p1_shifted, &p2_shifted);
-		sign *= -1;
+int draw_aaline(framebuffer_t* fb, unsigned color, point_t* p1, point_t* p2) {
+	return draw_aaline_clip(fb, color, p1, p2, NULL);
+}
+
+int draw_aaline_fx_clip(framebuffer_t* fb, unsigned color, pointfx_t* p1, pointfx_t* p2, const rect_t* clip) {
+	// Xiaolin Wu with proper endpoint handling: each end pixel is weighted
+	// by how much of it the line spans along the major axis, and the
+	// second pixel of every pair is the next one along the minor axis
+	rect_t bounds;
+	if(!framebuffer_bounds(fb, &bounds))
+		return 1;
+	if(clip && !rect_intersect(&bounds, &bounds, clip))
+		return 1;
+	if(fb->tiles)
+		return draw_sparse(fb, color, NULL, NULL, p1, p2, &bounds);
+	int64_t x0 = p1->x, y0 = p1->y, x1 = p2->x, y1 = p2->y, tmp;
+	int steep = llabs(y1 - y0) > llabs(x1 - x0);
+	if(steep) {
+		tmp = x0; x0 = y0; y0 = tmp;
+		tmp = x1; x1 = y1; y1 = tmp;
+	}
+	if(x0 > x1) {
+		tmp = x0; x0 = x1; x1 = tmp;
+		tmp = y0; y0 = y1; y1 = tmp;
+	}
+	wu_axes_t ax;
+	wu_axes(&ax, fb, &bounds, steep);
+	int op = blend_op(fb);
+	color = stored_color(fb, color);
+	int64_t dx = x1 - x0;
+	int64_t step = dx == 0 ? 0 : wu_step(y1 - y0, dx);
+	// round the endpoints to the pixel whose center is nearest and move
+	// the minor position along the line to that center
+	int xend0 = (int) ((x0 + FX_ONE / 2) >> FX_SHIFT);
+	int xend1 = (int) ((x1 + FX_ONE / 2) >> FX_SHIFT);
+	int64_t yend0 = y0 * (WU_ONE / FX_ONE) + ((step * ((int64_t) xend0 * FX_ONE - x0)) >> FX_SHIFT);
+	int64_t yend1 = y1 * (WU_ONE / FX_ONE) + ((step * ((int64_t) xend1 * FX_ONE - x1)) >> FX_SHIFT);
+	unsigned f;
+	if(xend0 == xend1) {
+		// both ends in the same pixel, weight it by the length inside
+		int64_t ymid = (yend0 + yend1) / 2;
+		unsigned gap = (unsigned) dx;
+		f = WU_COVERAGE(ymid);
+		wu_plot(fb, color, &ax, xend0, (int) (ymid >> WU_FRAC_BITS), ((255 - f) * gap) >> FX_SHIFT, op);
+		wu_plot(fb, color, &ax, xend0, (int) (ymid >> WU_FRAC_BITS) + 1, (f * gap) >> FX_SHIFT, op);
+		return 1;
 	}
-	return retval;
+	// the first pixel is covered from x0 to its right edge, the last one
+	// from its left edge to x1
+	unsigned gap0 = FX_ONE - ((x0 + FX_ONE / 2) & (FX_ONE - 1));
+	unsigned gap1 = (x1 + FX_ONE / 2) & (FX_ONE - 1);
+	f = WU_COVERAGE(yend0);
+	wu_plot(fb, color, &ax, xend0, (int) (yend0 >> WU_FRAC_BITS), ((255 - f) * gap0) >> FX_SHIFT, op);
+	wu_plot(fb, color, &ax, xend0, (int) (yend0 >> WU_FRAC_BITS) + 1, (f * gap0) >> FX_SHIFT, op);
+	f = WU_COVERAGE(yend1);
+	wu_plot(fb, color, &ax, xend1, (int) (yend1 >> WU_FRAC_BITS), ((255 - f) * gap1) >> FX_SHIFT, op);
+	wu_plot(fb, color, &ax, xend1, (int) (yend1 >> WU_FRAC_BITS) + 1, (f * gap1) >> FX_SHIFT, op);
+	wu_walk_any(fb, color, &ax, xend0 + 1, (int64_t) xend1 - xend0 - 1, yend0 + step, step, 1, op);
+	return 1;
+}
+
+int draw_aaline_fx(framebuffer_t* fb, unsigned color, pointfx_t* p1, pointfx_t* p2) {
+	return draw_aaline_fx_clip(fb, color, p1, p2, NULL);
 }
 
+int density_aaline_clip(framebuffer_t* plane, point_t* p1, point_t* p2, const rect_t* clip) {
+	// draw_aaline_clip with the coverage added to uint32 counts instead of
+	// blended, so the order lines arrive in does not matter
+	rect_t bounds;
+	if(!framebuffer_bounds(plane, &bounds))
+		return 1;
+	if(clip && !rect_intersect(&bounds, &bounds, clip))
+		return 1;
+	int steep = llabs((int64_t) p2->x - p1->x) <= llabs((int64_t) p2->y - p1->y);
+	if(steep ? p2->y < p1->y : p2->x < p1->x) {
+		point_t* tmp = p1;
+		p1 = p2;
+		p2 = tmp;
+	}
+	int major0 = steep ? p1->y : p1->x;
+	int major1 = steep ? p2->y : p2->x;
+	int minor0 = steep ? p1->x : p1->y;
+	int minor1 = steep ? p2->x : p2->y;
+	wu_axes_t ax;
+	wu_axes(&ax, plane, &bounds, steep);
+	if(minor0 == minor1) {
+		// axis aligned or a single point, a walk with no step covers the
+		// same pixels as draw_line_vertical and draw_line_horizontal
+		wu_walk(plane, 0, &ax, major0, (int64_t) major1 - major0 + 1, minor0 * WU_ONE, 0, 1, WU_ADD);
+		return 1;
+	}
+	wu_line(plane, 0, &ax, major0, major1, minor0, (int64_t) minor1 - minor0, WU_ADD);
+	return 1;
+}
+
+// batches are classified and drawn in chunks this big, so the bucket
+// indices fit on the stack and the chunk's segments stay in cache
+#define BATCH_CHUNK 1024
+
+enum {
+	SEGMENT_VERTICAL,
+	SEGMENT_HORIZONTAL,
+	SEGMENT_SHALLOW,
+	SEGMENT_STEEP,
+	SEGMENT_KINDS
+};
+
+static inline int segment_kind(const segment_t* seg) {
+	int dx = seg->p2.x - seg->p1.x;
+	int dy = seg->p2.y - seg->p1.y;
+	if(dx == 0)
+		return SEGMENT_VERTICAL;
+	if(dy == 0)
+		return SEGMENT_HORIZONTAL;
+	if(abs(dx) > abs(dy))
+		return SEGMENT_SHALLOW;
+	return SEGMENT_STEEP;
+}
+
+int draw_aaline_batch(framebuffer_t* fb, const segment_t* segs, size_t n) {
+	// same result as calling draw_aaline on every segment, except that
+	// within a chunk the segments are drawn bucket by bucket, so the
+	// blend order of overlapping segments of different kinds can change
+	uint16_t bucket[SEGMENT_KINDS][BATCH_CHUNK];
+	uint8_t visible[BATCH_CHUNK];
+	rect_t bounds;
+	if(!framebuffer_bounds(fb, &bounds))
+		return 1;
+	if(fb->tiles) {
+		// the kernels below want dense framebuffers
+		point_t p1, p2;
+		for(size_t i = 0; i < n; i++) {
+			p1 = segs[i].p1;
+			p2 = segs[i].p2;
+			if(!draw_aaline_clip(fb, segs[i].color, &p1, &p2, NULL))
+				return 0;
+		}
+		return 1;
+	}
+	size_t bucket_n[SEGMENT_KINDS];
+	point_t p1, p2;
+	for(size_t base = 0; base < n; base += BATCH_CHUNK) {
+		size_t chunk = n - base < BATCH_CHUNK ? n - base : BATCH_CHUNK;
+		const segment_t* cs = segs + base;
+		memset(bucket_n, 0, sizeof(bucket_n));
+		// in zoomed in renders most segments miss the canvas entirely,
+		// drop them before they are classified
+		if(!segments_visible(cs, chunk, &bounds, visible))
+			continue;
+		for(size_t i = 0; i < chunk; i++) {
+			if(!visible[i])
+				continue;
+			int kind = segment_kind(&cs[i]);
+			bucket[kind][bucket_n[kind]++] = (uint16_t) i;
+		}
+		// each loop below only ever calls one kernel, with the endpoints
+		// swapped into the order that kernel expects
+		for(size_t i = 0; i < bucket_n[SEGMENT_VERTICAL]; i++) {
+			const segment_t* seg = &cs[bucket[SEGMENT_VERTICAL][i]];
+			int swap = seg->p2.y < seg->p1.y;
+			p1 = swap ? seg->p2 : seg->p1;
+			p2 = swap ? seg->p1 : seg->p2;
+			draw_line_vertical(fb, seg->color, &p1, &p2, &bounds);
+		}
+		for(size_t i = 0; i < bucket_n[SEGMENT_HORIZONTAL]; i++) {
+			const segment_t* seg = &cs[bucket[SEGMENT_HORIZONTAL][i]];
+			int swap = seg->p2.x < seg->p1.x;
+			p1 = swap ? seg->p2 : seg->p1;
+			p2 = swap ? seg->p1 : seg->p2;
+			draw_line_horizontal(fb, seg->color, &p1, &p2, &bounds);
+		}
+		for(size_t i = 0; i < bucket_n[SEGMENT_SHALLOW]; i++) {
+			const segment_t* seg = &cs[bucket[SEGMENT_SHALLOW][i]];
+			int swap = seg->p2.x < seg->p1.x;
+			p1 = swap ? seg->p2 : seg->p1;
+			p2 = swap ? seg->p1 : seg->p2;
+			draw_aaline_shallow(fb, seg->color, &p1, &p2, &bounds);
+		}
+		for(size_t i = 0; i < bucket_n[SEGMENT_STEEP]; i++) {
+			const segment_t* seg = &cs[bucket[SEGMENT_STEEP][i]];
+			int swap = seg->p2.y < seg->p1.y;
+			p1 = swap ? seg->p2 : seg->p1;
+			p2 = swap ? seg->p1 : seg->p2;
+			draw_aaline_steep(fb, seg->color, &p1, &p2, &bounds);
+		}
+	}
+	return 1;
+}
+
+int draw_aaline_thick(framebuffer_t* fb, unsigned color, unsigned thickness, point_t* p1, point_t* p2) {
+	// one pixel wide lines are cheaper as plain Wu lines
+	if(thickness == 1)
+		return draw_aaline(fb, color, p1, p2);
+	pointfx_t q1 = {p1->x * FX_ONE, p1->y * FX_ONE};
+	pointfx_t q2 = {p2->x * FX_ONE, p2->y * FX_ONE};
+	return draw_stroke(fb, color, thickness, CAP_BUTT, &q1, &q2);
+}
+
+#ifndef AALINE_NO_MAIN
+// the benchmark links the library with its own main
 int main(int argc, char** argv) {
 	// argument parsing
 	// expect the argument format x0 y0 x1 y1
-	framebuffer_t* fb = framebuffer_init(100, 100);
-	if(argc != 6) {
-		printf("missing arguments\n%s x0 y0 x1 y1\n", argv[0]);
+	// or --serve to keep running and read commands, see server.h
+	if(argc > 1 && strcmp(argv[1], "--serve") == 0)
+		return server_main(argc - 2, argv + 2);
+	if(argc != 5) {
+		printf("missing arguments\n%s x0 y0 x1 y1\n%s --serve [--threads n] [--socket path]\n", argv[0], argv[0]);
 		return 0;
 	}
+	framebuffer_t* fb = framebuffer_init_flags(100, 100, FB_NO_CLEAR);
 	point_t px1 = {.x = atoi(argv[1]), .y = atoi(argv[2])};
 	point_t px2 = {.x = atoi(argv[3]), .y = atoi(argv[4])};
 	//make the background red 
-	point_t pxi;
-	for(int i = 0; i < fb->width; i++) {
-		for(int j = 0; j < fb->height; j++) {
-			pxi.x = i;
-			pxi.y = j;
-			set_px(fb, rgba32(255, 0, 0, 255), &pxi);
-		}
-	}
+	framebuffer_fill(fb, rgba32(255, 0, 0, 255));
 	draw_aaline(fb, rgba32(255, 255, 255, 255), &px1, &px2);
 	write_bmp(fb);
 	return 0;
 }
+#endif
@@ -0,0 +1,605 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "png.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PNG_X86 1
+#include <immintrin.h>
+#endif
+
+// segments are binned into every band their bounding box comes within
+// this many pixels of, like the tiles of draw_aaline_batch_mt
+#define BAND_MARGIN 2
+
+// png_write_framebuffer_mt gives every job about this many filtered bytes
+#define PNG_BAND_BYTES ((size_t) 1 << 20)
+
+// the balanced profile tries every filter on every this many rows of a
+// group and filters the whole group with the one that did best
+#define PNG_SAMPLE_STEP 4
+
+// deflate level of every profile
+static const int profile_level[3] = {1, 6, 9};
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_fill(void) {
+	for(uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for(int k = 0; k < 8; k++)
+			c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		crc_table[i] = c;
+	}
+}
+
+uint32_t crc32_scalar(uint32_t crc, const void* data, size_t n) {
+	const uint8_t* p = (const uint8_t*) data;
+	// the table is filled the first time it is needed, by whichever
+	// thread gets there first
+	pthread_once(&crc_once, crc_fill);
+	crc = ~crc;
+	while(n--)
+		crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+#if defined(PNG_X86)
+__attribute__((target("pclmul,sse4.1"))) uint32_t crc32_pclmul(uint32_t crc, const void* data, size_t n) {
+	// folding with carry-less multiplies, from Intel's "Fast CRC
+	// Computation for Generic Polynomials Using PCLMULQDQ". four 16-byte
+	// lanes are folded 64 bytes ahead at a time, then into one lane, then
+	// reduced to 32 bits with Barrett's method. the constants are powers
+	// of x mod the bit reflected polynomial
+	const uint8_t* p = (const uint8_t*) data;
+	if(n < 64)
+		return crc32_scalar(crc, p, n);
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1 = _mm_loadu_si128((const __m128i*) p);
+	__m128i x2 = _mm_loadu_si128((const __m128i*) (p + 16));
+	__m128i x3 = _mm_loadu_si128((const __m128i*) (p + 32));
+	__m128i x4 = _mm_loadu_si128((const __m128i*) (p + 48));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) ~crc));
+	p += 64;
+	n -= 64;
+	for(; n >= 64; p += 64, n -= 64) {
+		__m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		__m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		__m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		__m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*) p));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*) (p + 16)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*) (p + 32)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*) (p + 48)));
+	}
+	// the four lanes into one, then the rest 16 bytes at a time
+	__m128i next[3] = {x2, x3, x4};
+	for(int i = 0; i < 3; i++) {
+		__m128i lo = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, lo), next[i]);
+	}
+	for(; n >= 16; p += 16, n -= 16) {
+		__m128i lo = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, lo), _mm_loadu_si128((const __m128i*) p));
+	}
+	// 128 bits to 64
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	// 64 bits to 32
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, low32), poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	crc = ~(uint32_t) _mm_extract_epi32(x1, 1);
+	return crc32_scalar(crc, p, n);
+}
+#else
+uint32_t crc32_pclmul(uint32_t crc, const void* data, size_t n) {
+	return crc32_scalar(crc, data, n);
+}
+#endif
+
+static uint32_t crc32_detect(uint32_t crc, const void* data, size_t n);
+
+// resolved on first use. threads that race here store the same value,
+// so relaxed atomics are enough
+static uint32_t (*crc32_impl)(uint32_t, const void*, size_t) = crc32_detect;
+
+static uint32_t crc32_detect(uint32_t crc, const void* data, size_t n) {
+#if defined(PNG_X86)
+	uint32_t (*impl)(uint32_t, const void*, size_t) = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1") ? crc32_pclmul : crc32_scalar;
+#else
+	uint32_t (*impl)(uint32_t, const void*, size_t) = crc32_scalar;
+#endif
+	__atomic_store_n(&crc32_impl, impl, __ATOMIC_RELAXED);
+	return impl(crc, data, n);
+}
+
+uint32_t crc32(uint32_t crc, const void* data, size_t n) {
+	return __atomic_load_n(&crc32_impl, __ATOMIC_RELAXED)(crc, data, n);
+}
+
+static inline void put_be32(uint8_t* p, uint32_t v) {
+	p[0] = (uint8_t) (v >> 24);
+	p[1] = (uint8_t) (v >> 16);
+	p[2] = (uint8_t) (v >> 8);
+	p[3] = (uint8_t) v;
+}
+
+static void write_chunk(png_writer_t* png, const char* type, const uint8_t* data, size_t n) {
+	uint8_t head[8], tail[4];
+	put_be32(head, (uint32_t) n);
+	memcpy(head + 4, type, 4);
+	put_be32(tail, crc32(crc32(0, head + 4, 4), data, n));
+	// IEND has no payload and no data pointer, fwrite must not see NULL
+	if(fwrite(head, 1, 8, png->f) != 8 || (n && fwrite(data, 1, n, png->f) != n) || fwrite(tail, 1, 4, png->f) != 4)
+		png->ok = 0;
+}
+
+static void write_idat(png_writer_t* png, size_t min) {
+	// the deflate output is taken once enough of it has piled up
+	deflate_t* z = png->z;
+	if(z->out_len < min || z->out_len == 0)
+		return;
+	write_chunk(png, "IDAT", z->out, z->out_len);
+	z->out_len = 0;
+}
+
+static png_writer_t* png_create(const char* path, int w, int h) {
+	// just the file and its header, png_open adds the row state
+	static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	if(w <= 0 || h <= 0)
+		return NULL;
+	png_writer_t* png = calloc(1, sizeof(png_writer_t));
+	if(!png)
+		return NULL;
+	png->width = w;
+	png->height = h;
+	png->ok = 1;
+	if(!(png->f = fopen(path, "wb"))) {
+		free(png);
+		return NULL;
+	}
+	// 8 bits per channel rgba, no interlacing
+	uint8_t ihdr[13];
+	put_be32(ihdr, (uint32_t) w);
+	put_be32(ihdr + 4, (uint32_t) h);
+	ihdr[8] = 8;
+	ihdr[9] = 6;
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+	if(fwrite(signature, 1, 8, png->f) != 8)
+		png->ok = 0;
+	write_chunk(png, "IHDR", ihdr, sizeof(ihdr));
+	return png;
+}
+
+int png_profile_parse(const char* name) {
+	static const char* names[3] = {"fastest", "balanced", "smallest"};
+	for(int i = 0; i < 3; i++)
+		if(strcmp(name, names[i]) == 0)
+			return i;
+	return -1;
+}
+
+png_writer_t* png_open(const char* path, int w, int h, int profile) {
+	if(profile < PNG_FASTEST || profile > PNG_SMALLEST)
+		return NULL;
+	png_writer_t* png = png_create(path, w, h);
+	if(!png)
+		return NULL;
+	size_t stride = (size_t) w * 4;
+	png->profile = profile;
+	// the row above the first one counts as zeros
+	png->prev = calloc(stride, 1);
+	png->group = malloc(stride * PNG_FILTER_ROWS);
+	png->filtered[0] = malloc(stride + 1);
+	png->filtered[1] = malloc(stride + 1);
+	png->z = deflate_init(profile_level[profile]);
+	if(!png->prev || !png->group || !png->filtered[0] || !png->filtered[1] || !png->z) {
+		png->ok = 0;
+		png_close(png);
+		return NULL;
+	}
+	return png;
+}
+
+static inline int paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if(pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+static void filter_row(int type, const uint8_t* cur, const uint8_t* prev, size_t n, uint8_t* out) {
+	// a loop per type so the simple ones vectorize. the first pixel has no
+	// left neighbour, which counts as zeros
+	out[0] = (uint8_t) type;
+	out++;
+	switch(type) {
+	case 0:
+		memcpy(out, cur, n);
+		break;
+	case 1:
+		memcpy(out, cur, 4);
+		for(size_t i = 4; i < n; i++)
+			out[i] = (uint8_t) (cur[i] - cur[i - 4]);
+		break;
+	case 2:
+		for(size_t i = 0; i < n; i++)
+			out[i] = (uint8_t) (cur[i] - prev[i]);
+		break;
+	case 3:
+		for(size_t i = 0; i < 4; i++)
+			out[i] = (uint8_t) (cur[i] - (prev[i] >> 1));
+		for(size_t i = 4; i < n; i++)
+			out[i] = (uint8_t) (cur[i] - ((cur[i - 4] + prev[i]) >> 1));
+		break;
+	case 4:
+		for(size_t i = 0; i < 4; i++)
+			out[i] = (uint8_t) (cur[i] - prev[i]);
+		for(size_t i = 4; i < n; i++)
+			out[i] = (uint8_t) (cur[i] - paeth(cur[i - 4], prev[i], prev[i - 4]));
+		break;
+	}
+}
+
+static unsigned filter_cost(const uint8_t* filtered, size_t n) {
+	// the bytes that differ from the same channel of the pixel before.
+	// the usual guess, the sum of the bytes taken as signed, favors filters
+	// that turn a white background into zeros, but deflate does as well
+	// with runs of any byte, and on line art the filters that make zeros
+	// also smear every line over more bytes
+	unsigned breaks = 0;
+	for(size_t i = 5; i <= n; i++)
+		breaks += filtered[i] != filtered[i - 4];
+	return breaks;
+}
+
+static const uint8_t* filter_best(const uint8_t* cur, const uint8_t* prev, size_t stride, uint8_t** filtered) {
+	// tries every filter, the winner ends up in filtered[0]
+	filter_row(0, cur, prev, stride, filtered[0]);
+	unsigned best = filter_cost(filtered[0], stride);
+	for(int type = 1; type <= 4; type++) {
+		filter_row(type, cur, prev, stride, filtered[1]);
+		unsigned cost = filter_cost(filtered[1], stride);
+		if(cost < best) {
+			uint8_t* t = filtered[0];
+			filtered[0] = filtered[1];
+			filtered[1] = t;
+			best = cost;
+		}
+	}
+	return filtered[0];
+}
+
+static int group_filter(int profile, const uint8_t* const* rows, int n, size_t stride, uint8_t* scratch) {
+	// rows[0] is the row above the group, rows[1] to rows[n] the group.
+	// returns the filter of every row of the group, -1 for the best of
+	// each row on its own
+	if(profile == PNG_FASTEST)
+		return 0;
+	if(profile == PNG_SMALLEST)
+		return -1;
+	uint64_t cost[5] = {0};
+	for(int i = 1; i <= n; i += PNG_SAMPLE_STEP) {
+		for(int type = 0; type <= 4; type++) {
+			filter_row(type, rows[i], rows[i - 1], stride, scratch);
+			cost[type] += filter_cost(scratch, stride);
+		}
+	}
+	int best = 0;
+	for(int type = 1; type <= 4; type++)
+		best = cost[type] < cost[best] ? type : best;
+	return best;
+}
+
+static const uint8_t* filter_apply(int type, const uint8_t* cur, const uint8_t* prev, size_t stride, uint8_t** filtered) {
+	if(type < 0)
+		return filter_best(cur, prev, stride, filtered);
+	filter_row(type, cur, prev, stride, filtered[0]);
+	return filtered[0];
+}
+
+static int write_group(png_writer_t* png, int n) {
+	// filters and compresses the n rows gathered in group
+	size_t stride = (size_t) png->width * 4;
+	const uint8_t* rows[PNG_FILTER_ROWS + 1];
+	rows[0] = png->prev;
+	for(int i = 0; i < n; i++)
+		rows[i + 1] = png->group + stride * i;
+	int type = group_filter(png->profile, rows, n, stride, png->filtered[1]);
+	for(int i = 1; png->ok && i <= n; i++) {
+		const uint8_t* filtered = filter_apply(type, rows[i], rows[i - 1], stride, png->filtered);
+		if(!deflate_write(png->z, filtered, stride + 1))
+			png->ok = 0;
+		write_idat(png, PNG_IDAT_SIZE);
+	}
+	memcpy(png->prev, rows[n], stride);
+	return png->ok;
+}
+
+int png_write_row(png_writer_t* png, const unsigned* row) {
+	if(!png->ok || !png->z || png->y >= png->height)
+		return 0;
+	size_t stride = (size_t) png->width * 4;
+	// rgba32 is r, g, b, a in memory, which is what PNG wants. rows wait
+	// in group until it is full, the balanced profile picks their filter
+	// from all of them
+	memcpy(png->group + stride * (png->y % PNG_FILTER_ROWS), row, stride);
+	png->y++;
+	if(png->y % PNG_FILTER_ROWS == 0 || png->y == png->height)
+		return write_group(png, (png->y - 1) % PNG_FILTER_ROWS + 1);
+	return 1;
+}
+
+int png_close(png_writer_t* png) {
+	if(!png)
+		return 0;
+	int ok = png->ok && png->y == png->height;
+	if(ok && png->z) {
+		if(!deflate_finish(png->z))
+			png->ok = 0;
+		write_idat(png, 0);
+	}
+	if(ok) {
+		write_chunk(png, "IEND", NULL, 0);
+		ok = png->ok;
+	}
+	if(png->f && fclose(png->f) != 0)
+		ok = 0;
+	deflate_free(png->z);
+	free(png->prev);
+	free(png->group);
+	free(png->filtered[0]);
+	free(png->filtered[1]);
+	free(png);
+	return ok;
+}
+
+int png_write_framebuffer(framebuffer_t* fb, const char* path, int profile) {
+	unsigned* scratch = malloc((size_t) fb->width * sizeof(unsigned));
+	png_writer_t* png = scratch ? png_open(path, fb->width, fb->height, profile) : NULL;
+	for(int y = 0; png && y < fb->height; y++)
+		if(!png_write_row(png, framebuffer_row(fb, y, scratch)))
+			break;
+	free(scratch);
+	return png_close(png);
+}
+
+typedef struct {
+	uint8_t* data; /**< raw deflate stream, the first band's with the zlib header */
+	size_t len;
+	uint32_t adler; /**< of the band's filtered rows alone */
+	uint64_t in_len; /**< filtered bytes in the band */
+	int ok;
+} png_band_t;
+
+typedef struct {
+	framebuffer_t* fb;
+	int profile;
+	int rows; /**< rows per band, a multiple of PNG_FILTER_ROWS */
+	int nbands;
+	int first; /**< band of bands[0] */
+	png_band_t* bands;
+} png_job_t;
+
+static void encode_band(void* ctx, int job_index, int worker) {
+	// the filters of the first row need the row above it and the
+	// dictionary needs the last DEFLATE_WSIZE filtered bytes before the
+	// band, both come from the band before and are simply made again,
+	// from the start of a filter group so they come out the same
+	png_job_t* job = (png_job_t*) ctx;
+	png_band_t* out = &job->bands[job_index];
+	framebuffer_t* fb = job->fb;
+	int b = job->first + job_index;
+	size_t stride = (size_t) fb->width * 4;
+	int y0 = b * job->rows;
+	int y1 = y0 + job->rows < fb->height ? y0 + job->rows : fb->height;
+	int ydict = y0 - (int) ((DEFLATE_WSIZE + stride) / (stride + 1));
+	ydict = ydict > 0 ? ydict - ydict % PNG_FILTER_ROWS : 0;
+
+	// a group and the row above it are needed at once, row y goes in
+	// slot y % (PNG_FILTER_ROWS + 1)
+	unsigned* scratch = malloc(stride * (PNG_FILTER_ROWS + 1));
+	uint8_t* filtered[2] = {malloc(stride + 1), malloc(stride + 1)};
+	uint8_t* zeros = calloc(stride, 1);
+	uint8_t* dict = malloc((size_t) (y0 - ydict) * (stride + 1) + 1);
+	int level = profile_level[job->profile];
+	deflate_t* z = b == 0 ? deflate_init(level) : deflate_init_raw(level);
+	out->ok = scratch && filtered[0] && filtered[1] && zeros && dict && z;
+
+	const uint8_t* rows[PNG_FILTER_ROWS + 1];
+	rows[0] = zeros;
+	if(out->ok && ydict > 0)
+		rows[0] = (const uint8_t*) framebuffer_row(fb, ydict - 1, scratch + (size_t) fb->width * ((ydict - 1) % (PNG_FILTER_ROWS + 1)));
+	for(int g = ydict; out->ok && g < y1; g += PNG_FILTER_ROWS) {
+		int n = y1 - g < PNG_FILTER_ROWS ? y1 - g : PNG_FILTER_ROWS;
+		for(int i = 1; i <= n; i++)
+			rows[i] = (const uint8_t*) framebuffer_row(fb, g + i - 1, scratch + (size_t) fb->width * ((g + i - 1) % (PNG_FILTER_ROWS + 1)));
+		int type = group_filter(job->profile, rows, n, stride, filtered[1]);
+		for(int i = 1; out->ok && i <= n; i++) {
+			const uint8_t* f = filter_apply(type, rows[i], rows[i - 1], stride, filtered);
+			int y = g + i - 1;
+			if(y < y0) {
+				memcpy(dict + (size_t) (y - ydict) * (stride + 1), f, stride + 1);
+				continue;
+			}
+			if(y == y0 && y0 > ydict)
+				deflate_set_dictionary(z, dict, (size_t) (y0 - ydict) * (stride + 1));
+			out->ok = deflate_write(z, f, stride + 1);
+		}
+		rows[0] = rows[n];
+	}
+	// only the last band ends the stream, the others end on a byte
+	// boundary so the next one can follow
+	if(out->ok)
+		out->ok = b == job->nbands - 1 ? deflate_finish(z) : deflate_flush(z);
+	if(out->ok) {
+		out->data = z->out;
+		out->len = z->out_len;
+		out->adler = z->adler;
+		out->in_len = (uint64_t) (y1 - y0) * (stride + 1);
+		z->out = NULL;
+	}
+	deflate_free(z);
+	free(dict);
+	free(zeros);
+	free(filtered[0]);
+	free(filtered[1]);
+	free(scratch);
+}
+
+int png_write_framebuffer_mt(framebuffer_t* fb, const char* path, int profile, threadpool_t* pool) {
+	// bands are compressed on their own, pigz style, and written in order
+	// as one zlib stream. a few bands per thread are in flight at a time,
+	// which bounds the compressed data held
+	int threads = threadpool_size(pool);
+	size_t stride = (size_t) fb->width * 4 + 1;
+	int rows = (int) (PNG_BAND_BYTES / stride);
+	rows = (rows + PNG_FILTER_ROWS - 1) / PNG_FILTER_ROWS * PNG_FILTER_ROWS;
+	rows = rows > 0 ? rows : PNG_FILTER_ROWS;
+	int nbands = (fb->height + rows - 1) / rows;
+	if(threads == 1 || nbands <= 1 || profile < PNG_FASTEST || profile > PNG_SMALLEST)
+		return png_write_framebuffer(fb, path, profile);
+	int wave = threads * 2;
+	png_band_t* bands = calloc(wave, sizeof(png_band_t));
+	png_writer_t* png = bands ? png_create(path, fb->width, fb->height) : NULL;
+	if(!png) {
+		free(bands);
+		return 0;
+	}
+	png_job_t job = {.fb = fb, .profile = profile, .rows = rows, .nbands = nbands, .bands = bands};
+	uint32_t adler = 1;
+	for(job.first = 0; png->ok && job.first < nbands; job.first += wave) {
+		int count = nbands - job.first < wave ? nbands - job.first : wave;
+		threadpool_run(pool, count, encode_band, &job);
+		for(int i = 0; i < count; i++) {
+			png_band_t* band = &bands[i];
+			if(!band->ok)
+				png->ok = 0;
+			if(png->ok) {
+				adler = job.first + i == 0 ? band->adler : adler32_combine(adler, band->adler, band->in_len);
+				// the last band has no checksum of its own, the one of the
+				// whole stream goes after it
+				if(job.first + i == nbands - 1) {
+					uint8_t* data = realloc(band->data, band->len + 4);
+					if(data) {
+						band->data = data;
+						put_be32(data + band->len, adler);
+						band->len += 4;
+					}
+					else {
+						png->ok = 0;
+					}
+				}
+				if(png->ok)
+					write_chunk(png, "IDAT", band->data, band->len);
+			}
+			free(band->data);
+			band->data = NULL;
+		}
+	}
+	png->y = png->ok ? png->height : 0;
+	free(bands);
+	return png_close(png);
+}
+
+static int band_range(const segment_t* seg, int w, int h, int band_height, int* b0, int* b1) {
+	// the bands a segment can draw into, none if it misses the image
+	int x0 = seg->p1.x < seg->p2.x ? seg->p1.x : seg->p2.x;
+	int x1 = seg->p1.x < seg->p2.x ? seg->p2.x : seg->p1.x;
+	int y0 = seg->p1.y < seg->p2.y ? seg->p1.y : seg->p2.y;
+	int y1 = seg->p1.y < seg->p2.y ? seg->p2.y : seg->p1.y;
+	if(x1 < -BAND_MARGIN || x0 >= w + BAND_MARGIN || y1 < -BAND_MARGIN || y0 >= h + BAND_MARGIN)
+		return 0;
+	y0 = y0 - BAND_MARGIN < 0 ? 0 : y0 - BAND_MARGIN;
+	y1 = y1 + BAND_MARGIN >= h ? h - 1 : y1 + BAND_MARGIN;
+	*b0 = y0 / band_height;
+	*b1 = y1 / band_height;
+	return 1;
+}
+
+int png_render_banded(const char* path, int w, int h, int band_height, unsigned background, const segment_t* segs, size_t n, int profile, threadpool_t* pool) {
+	if(w <= 0 || h <= 0 || band_height <= 0)
+		return 0;
+	band_height = band_height < h ? band_height : h;
+	int nbands = (h + band_height - 1) / band_height;
+
+	// count the segments of every band, then list them in submission order
+	size_t* start = calloc(nbands + 1, sizeof(size_t));
+	size_t* cursor = malloc(nbands * sizeof(size_t));
+	if(!start || !cursor) {
+		free(start);
+		free(cursor);
+		return 0;
+	}
+	int b0, b1;
+	for(size_t i = 0; i < n; i++)
+		if(band_range(&segs[i], w, h, band_height, &b0, &b1))
+			for(int b = b0; b <= b1; b++)
+				start[b + 1]++;
+	size_t most = 0;
+	for(int b = 0; b < nbands; b++) {
+		most = start[b + 1] > most ? start[b + 1] : most;
+		start[b + 1] += start[b];
+		cursor[b] = start[b];
+	}
+	size_t* list = malloc(start[nbands] * sizeof(size_t) + 1);
+	segment_t* band_segs = malloc(most * sizeof(segment_t) + 1);
+	framebuffer_t* band = framebuffer_init_flags(w, band_height, FB_NO_CLEAR);
+	png_writer_t* png = list && band_segs && band ? png_open(path, w, h, profile) : NULL;
+	int ok = png != NULL;
+	if(ok) {
+		for(size_t i = 0; i < n; i++)
+			if(band_range(&segs[i], w, h, band_height, &b0, &b1))
+				for(int b = b0; b <= b1; b++)
+					list[cursor[b]++] = i;
+	}
+
+	for(int b = 0; ok && b < nbands; b++) {
+		// the band is drawn as a framebuffer of its own, with the segments
+		// moved up by the rows above it
+		int y0 = b * band_height;
+		int rows = h - y0 < band_height ? h - y0 : band_height;
+		if(rows != band->height && !framebuffer_resize(band, w, rows)) {
+			ok = 0;
+			break;
+		}
+		framebuffer_fill(band, background);
+		size_t m = 0;
+		for(size_t i = start[b]; i < start[b + 1]; i++) {
+			band_segs[m] = segs[list[i]];
+			band_segs[m].p1.y -= y0;
+			band_segs[m++].p2.y -= y0;
+		}
+		if(!draw_aaline_batch_mt(band, band_segs, m, pool)) {
+			ok = 0;
+			break;
+		}
+		for(int y = 0; ok && y < rows; y++)
+			ok = png_write_row(png, (const unsigned*) band->fb + (size_t) w * y);
+	}
+
+	ok = png_close(png) && ok;
+	framebuffer_free(band);
+	free(band_segs);
+	free(list);
+	free(cursor);
+	free(start);
+	return ok;
+}
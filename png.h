@@ -0,0 +1,179 @@
+#ifndef PNG_H
+#define PNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "deflate.h"
+#include "framebuffer.h"
+#include "threadpool.h"
+
+// streaming PNG writer
+//
+// rows go in one at a time from the top, are filtered against the row
+// above and deflated a few at a time, and the compressed bytes go to the
+// file in IDAT chunks as they come. only PNG_FILTER_ROWS rows and the
+// deflate state are held, so an image of any height can be written a band
+// at a time
+//
+// a profile picks the filters and the deflate level. trying all five
+// filters on every row, as libpng and stb_image_write do, is most of the
+// work of writing line art, which is flat background with thin lines and
+// comes out about as small with one filter for many rows
+
+#define PNG_FASTEST 0 /**< no filtering, deflate level 1 */
+#define PNG_BALANCED 1 /**< one filter per group of rows, picked from a few of them, deflate level 6 */
+#define PNG_SMALLEST 2 /**< the best filter for every row, deflate level 9 */
+
+// profile of framebuffer_write
+#define PNG_PROFILE PNG_BALANCED
+
+// rows filtered together, the balanced profile picks a filter for each group
+#define PNG_FILTER_ROWS 16
+
+// compressed bytes gathered before an IDAT chunk is written
+#define PNG_IDAT_SIZE 65536
+
+/**
+ * @brief A PNG file being written
+ */
+typedef struct {
+	FILE* f;
+	int width;
+	int height;
+	int y; /**< rows written so far */
+	int ok; /**< cleared by the first failed write */
+	int profile; /**< PNG_FASTEST, PNG_BALANCED or PNG_SMALLEST */
+	uint8_t* prev; /**< last row of the group before, as it was passed in */
+	uint8_t* group; /**< rows of the group being gathered */
+	uint8_t* filtered[2]; /**< filter byte and filtered row, the best so far and the one being tried */
+	deflate_t* z;
+} png_writer_t;
+
+/**
+ * @brief Create a PNG file and write its header
+ *
+ * @param path file to write
+ * @param w width in pixels
+ * @param h height in pixels
+ * @param profile PNG_FASTEST, PNG_BALANCED or PNG_SMALLEST
+ *
+ * @return a pointer to the writer, NULL if the file could not be created or memory allocated
+ */
+png_writer_t* png_open(const char* path, int w, int h, int profile);
+
+/**
+ * @brief Look up a profile by name
+ *
+ * @param name "fastest", "balanced" or "smallest"
+ *
+ * @return the PNG_* profile, -1 if there is none by that name
+ */
+int png_profile_parse(const char* name);
+
+/**
+ * @brief Filter, compress and write the next row
+ *
+ * Rows are written PNG_FILTER_ROWS at a time, and the last group when
+ * the last row comes in.
+ *
+ * @param png writer to add to
+ * @param row width straight alpha rgba32 pixels
+ *
+ * @return 1 on success, 0 on failure or if all rows were written already
+ */
+int png_write_row(png_writer_t* png, const unsigned* row);
+
+/**
+ * @brief Finish the file and free the writer
+ *
+ * @param png writer to close, may be NULL
+ *
+ * @return 1 if every row was written and the file is complete, 0 otherwise
+ */
+int png_close(png_writer_t* png);
+
+/**
+ * @brief Update a CRC-32 as used by PNG chunks, reference table driven version
+ *
+ * @param crc checksum so far, 0 to start
+ * @param data bytes to add
+ * @param n number of bytes
+ *
+ * @return the new checksum
+ */
+uint32_t crc32_scalar(uint32_t crc, const void* data, size_t n);
+
+/**
+ * @brief PCLMULQDQ version of crc32_scalar, 64 bytes per iteration
+ *
+ * Only call this when the cpu supports PCLMULQDQ and SSE4.1, crc32 checks for you.
+ */
+uint32_t crc32_pclmul(uint32_t crc, const void* data, size_t n);
+
+/**
+ * @brief Update a CRC-32 with the fastest version the cpu supports
+ *
+ * @param crc checksum so far, 0 to start
+ * @param data bytes to add
+ * @param n number of bytes
+ *
+ * @return the new checksum
+ */
+uint32_t crc32(uint32_t crc, const void* data, size_t n);
+
+/**
+ * @brief Write any framebuffer as a PNG, one framebuffer_row at a time
+ *
+ * @param fb framebuffer to write
+ * @param path file to write
+ * @param profile PNG_FASTEST, PNG_BALANCED or PNG_SMALLEST
+ *
+ * @return 1 on success, 0 on failure
+ */
+int png_write_framebuffer(framebuffer_t* fb, const char* path, int profile);
+
+/**
+ * @brief Write any framebuffer as a PNG, compressing bands of rows in parallel
+ *
+ * Each job filters and deflates about 1 MB of rows on its own, with the
+ * end of the band before as its dictionary, and ends on a byte boundary
+ * so the bands join into one zlib stream, whose checksum is put together
+ * from theirs. The file is a standard PNG, a little larger than what
+ * png_write_framebuffer makes. Without a pool, or for small images, this
+ * is png_write_framebuffer.
+ *
+ * @param fb framebuffer to write, it must not change until this returns
+ * @param path file to write
+ * @param profile PNG_FASTEST, PNG_BALANCED or PNG_SMALLEST
+ * @param pool threads to compress with, may be NULL
+ *
+ * @return 1 on success, 0 on failure
+ */
+int png_write_framebuffer_mt(framebuffer_t* fb, const char* path, int profile, threadpool_t* pool);
+
+/**
+ * @brief Draw segments straight into a PNG file, one band of rows at a time
+ *
+ * The segments are binned by the bands they touch, then every band is
+ * filled with the background, drawn with draw_aaline_batch_mt and written
+ * out before the next one is drawn, so only one band of pixels is ever
+ * held. The image is the same as drawing every segment in order with
+ * draw_aaline into a w by h framebuffer filled with the background.
+ *
+ * @param path file to write
+ * @param w width of the image
+ * @param h height of the image
+ * @param band_height rows drawn at a time
+ * @param background straight alpha rgba32 color under the lines
+ * @param segs array of segments
+ * @param n number of segments
+ * @param profile PNG_FASTEST, PNG_BALANCED or PNG_SMALLEST
+ * @param pool threads to draw with, NULL to draw on the calling thread
+ *
+ * @return 1 on success, 0 on failure
+ */
+int png_render_banded(const char* path, int w, int h, int band_height, unsigned background, const segment_t* segs, size_t n, int profile, threadpool_t* pool);
+
+#endif
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qoi.h"
+
+// a file is a 14 byte header, the ops, and an end marker of seven zero
+// bytes and a one. pixels are rgba32, so r is the low byte
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+
+#define QOI_HEADER 14
+
+// pixels one run op covers, 63 and 64 would be the RGB and RGBA tags
+#define QOI_RUN_MAX 62
+
+static const uint8_t qoi_end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+static inline unsigned qoi_hash(unsigned px) {
+	// (r * 3 + g * 5 + b * 7 + a * 11) % 64 in one multiply: the channels
+	// are spread 16 bits apart and every product that lands in the top
+	// byte is one of the four terms, the rest stay below it
+	uint64_t v = (px & 0x00ff00ffu) | (uint64_t) (px & 0xff00ff00u) << 24;
+	return (unsigned) ((v * 0x0300070005000b00ull) >> 56) & 63;
+}
+
+typedef struct {
+	unsigned index[64]; /**< pixels seen before, by qoi_hash */
+	unsigned prev; /**< last pixel */
+	unsigned run; /**< pixels equal to prev not written yet */
+} qoi_state_t;
+
+static uint8_t* encode_row(qoi_state_t* s, uint8_t* p, const unsigned* row, int w) {
+	// writes at most 5 * w + 1 bytes. runs go on from one row to the next,
+	// the last one is written by the caller
+	unsigned prev = s->prev, run = s->run;
+	for(int x = 0; x < w;) {
+		unsigned px = row[x];
+		if(px == prev) {
+			// background, counted in one scan
+			int start = x;
+			while(++x < w && row[x] == prev);
+			run += x - start;
+			for(; run >= QOI_RUN_MAX; run -= QOI_RUN_MAX)
+				*p++ = QOI_OP_RUN | (QOI_RUN_MAX - 1);
+			continue;
+		}
+		x++;
+		if(run) {
+			*p++ = QOI_OP_RUN | (run - 1);
+			run = 0;
+		}
+		unsigned h = qoi_hash(px);
+		if(s->index[h] == px) {
+			*p++ = QOI_OP_INDEX | h;
+			prev = px;
+			continue;
+		}
+		s->index[h] = px;
+		if((px ^ prev) >> 24) {
+			*p++ = QOI_OP_RGBA;
+			memcpy(p, &px, 4);
+			p += 4;
+			prev = px;
+			continue;
+		}
+		signed char dr = (signed char) (px - prev);
+		signed char dg = (signed char) ((px >> 8) - (prev >> 8));
+		signed char db = (signed char) ((px >> 16) - (prev >> 16));
+		signed char dr_dg = (signed char) (dr - dg);
+		signed char db_dg = (signed char) (db - dg);
+		if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+			*p++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+		}
+		else if(dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+			*p++ = QOI_OP_LUMA | (dg + 32);
+			*p++ = (dr_dg + 8) << 4 | (db_dg + 8);
+		}
+		else {
+			*p++ = QOI_OP_RGB;
+			memcpy(p, &px, 3);
+			p += 3;
+		}
+		prev = px;
+	}
+	s->prev = prev;
+	s->run = run;
+	return p;
+}
+
+typedef struct {
+	int w;
+	const unsigned* pixels; /**< whole image, for qoi_write_pixels and qoi_encode */
+	framebuffer_t* fb; /**< for qoi_write_framebuffer */
+} qoi_source_t;
+
+typedef struct {
+	FILE* f; /**< file the buffer goes to when it fills, NULL to grow the buffer instead */
+	uint8_t* buf;
+	size_t fill;
+	size_t cap;
+} qoi_out_t;
+
+static uint8_t* reserve(qoi_out_t* out, size_t n) {
+	// room for n more bytes, NULL if it could not be made
+	if(out->fill + n > out->cap) {
+		if(out->f) {
+			if(fwrite(out->buf, 1, out->fill, out->f) != out->fill)
+				return NULL;
+			out->fill = 0;
+		}
+		else {
+			size_t cap = out->cap * 2 > out->fill + n ? out->cap * 2 : out->fill + n;
+			uint8_t* buf = realloc(out->buf, cap);
+			if(!buf)
+				return NULL;
+			out->buf = buf;
+			out->cap = cap;
+		}
+	}
+	return out->buf + out->fill;
+}
+
+static void put_be32(uint8_t* p, uint32_t v) {
+	p[0] = (uint8_t) (v >> 24);
+	p[1] = (uint8_t) (v >> 16);
+	p[2] = (uint8_t) (v >> 8);
+	p[3] = (uint8_t) v;
+}
+
+static int encode_source(int w, int h, qoi_source_t* src, qoi_out_t* out) {
+	// file buffers must hold a row of worst case ops, 5 * w + 1 bytes
+	unsigned* scratch = src->fb ? malloc((size_t) w * sizeof(unsigned)) : NULL;
+	if(src->fb && !scratch)
+		return 0;
+	uint8_t* p = reserve(out, QOI_HEADER);
+	int ok = p != NULL;
+	if(ok) {
+		memcpy(p, "qoif", 4);
+		put_be32(p + 4, (uint32_t) w);
+		put_be32(p + 8, (uint32_t) h);
+		p[12] = 4;
+		p[13] = 0;
+		out->fill += QOI_HEADER;
+	}
+	qoi_state_t s = {.prev = 0xff000000u};
+	for(int y = 0; ok && y < h; y++) {
+		p = reserve(out, (size_t) w * 5 + 1);
+		ok = p != NULL;
+		if(ok) {
+			const unsigned* row = src->fb ? framebuffer_row(src->fb, y, scratch) : src->pixels + (size_t) w * y;
+			out->fill = encode_row(&s, p, row, w) - out->buf;
+		}
+	}
+	p = ok ? reserve(out, 1 + sizeof(qoi_end)) : NULL;
+	ok = p != NULL;
+	if(ok) {
+		if(s.run)
+			*p++ = QOI_OP_RUN | (s.run - 1);
+		memcpy(p, qoi_end, sizeof(qoi_end));
+		out->fill = p + sizeof(qoi_end) - out->buf;
+	}
+	free(scratch);
+	return ok;
+}
+
+static int valid_size(int w, int h) {
+	return w > 0 && h > 0 && (uint64_t) w * h <= QOI_MAX_PIXELS;
+}
+
+uint8_t* qoi_encode(int w, int h, const unsigned* pixels, size_t* len) {
+	if(!valid_size(w, h))
+		return NULL;
+	// the buffer doubles as needed, line art is well under a byte per pixel
+	qoi_source_t src = {.w = w, .pixels = pixels};
+	qoi_out_t out = {.cap = QOI_CHUNK};
+	out.buf = malloc(out.cap);
+	if(!out.buf || !encode_source(w, h, &src, &out)) {
+		free(out.buf);
+		return NULL;
+	}
+	*len = out.fill;
+	return out.buf;
+}
+
+static int write_qoi_source(const char* path, int w, int h, qoi_source_t* src) {
+	if(!valid_size(w, h))
+		return 0;
+	size_t cap = (size_t) w * 5 + 1 > QOI_CHUNK ? (size_t) w * 5 + 1 : QOI_CHUNK;
+	qoi_out_t out = {.cap = cap};
+	out.buf = malloc(cap);
+	out.f = out.buf ? fopen(path, "wb") : NULL;
+	if(!out.f) {
+		free(out.buf);
+		return 0;
+	}
+	int ok = encode_source(w, h, src, &out);
+	ok = ok && fwrite(out.buf, 1, out.fill, out.f) == out.fill;
+	ok = fclose(out.f) == 0 && ok;
+	free(out.buf);
+	return ok;
+}
+
+int qoi_write_pixels(const char* path, int w, int h, const unsigned* pixels) {
+	qoi_source_t src = {.w = w, .pixels = pixels};
+	return write_qoi_source(path, w, h, &src);
+}
+
+int qoi_write_framebuffer(framebuffer_t* fb, const char* path) {
+	qoi_source_t src = {.w = fb->width, .fb = fb};
+	return write_qoi_source(path, fb->width, fb->height, &src);
+}
+
+static uint32_t get_be32(const uint8_t* p) {
+	return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+unsigned* qoi_decode(const uint8_t* data, size_t len, int* w, int* h) {
+	if(len < QOI_HEADER + sizeof(qoi_end) || memcmp(data, "qoif", 4) != 0)
+		return NULL;
+	uint32_t width = get_be32(data + 4), height = get_be32(data + 8);
+	if(width > INT32_MAX || height > INT32_MAX || !valid_size((int) width, (int) height)
+		|| (data[12] != 3 && data[12] != 4) || data[13] > 1)
+		return NULL;
+	size_t n = (size_t) width * height;
+	unsigned* pixels = malloc(n * sizeof(unsigned));
+	if(!pixels)
+		return NULL;
+	// a file that ends early, or whose runs go past the last pixel, is
+	// rejected rather than padded out
+	unsigned index[64] = {0};
+	unsigned px = 0xff000000u;
+	const uint8_t* p = data + QOI_HEADER;
+	const uint8_t* end = data + len - sizeof(qoi_end);
+	size_t i = 0;
+	while(i < n && p < end) {
+		unsigned op = *p++;
+		if(op == QOI_OP_RGB) {
+			if(end - p < 3)
+				break;
+			px = (px & 0xff000000u) | p[0] | p[1] << 8 | p[2] << 16;
+			p += 3;
+		}
+		else if(op == QOI_OP_RGBA) {
+			if(end - p < 4)
+				break;
+			px = p[0] | p[1] << 8 | p[2] << 16 | (unsigned) p[3] << 24;
+			p += 4;
+		}
+		else if(op < QOI_OP_DIFF) {
+			px = index[op];
+		}
+		else if(op < QOI_OP_LUMA) {
+			unsigned r = (px + (op >> 4 & 3) - 2) & 0xff;
+			unsigned g = ((px >> 8) + (op >> 2 & 3) - 2) & 0xff;
+			unsigned b = ((px >> 16) + (op & 3) - 2) & 0xff;
+			px = (px & 0xff000000u) | b << 16 | g << 8 | r;
+		}
+		else if(op < QOI_OP_RUN) {
+			if(p >= end)
+				break;
+			unsigned dg = (op & 63) - 32, b2 = *p++;
+			unsigned r = (px + dg + (b2 >> 4) - 8) & 0xff;
+			unsigned g = ((px >> 8) + dg) & 0xff;
+			unsigned b = ((px >> 16) + dg + (b2 & 15) - 8) & 0xff;
+			px = (px & 0xff000000u) | b << 16 | g << 8 | r;
+		}
+		else {
+			// runs leave the index alone
+			size_t run = (op & 63) + 1;
+			if(run > n - i)
+				break;
+			for(size_t j = 0; j < run; j++)
+				pixels[i + j] = px;
+			i += run;
+			continue;
+		}
+		index[qoi_hash(px)] = px;
+		pixels[i++] = px;
+	}
+	if(i < n) {
+		free(pixels);
+		return NULL;
+	}
+	*w = (int) width;
+	*h = (int) height;
+	return pixels;
+}
+
+unsigned* qoi_read(const char* path, int* w, int* h) {
+	FILE* f = fopen(path, "rb");
+	if(!f)
+		return NULL;
+	uint8_t* data = NULL;
+	long len = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+	if(len > 0 && fseek(f, 0, SEEK_SET) == 0)
+		data = malloc((size_t) len);
+	unsigned* pixels = NULL;
+	if(data && fread(data, 1, (size_t) len, f) == (size_t) len)
+		pixels = qoi_decode(data, (size_t) len, w, h);
+	fclose(f);
+	free(data);
+	return pixels;
+}
@@ -0,0 +1,83 @@
+#ifndef QOI_H
+#define QOI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "framebuffer.h"
+
+// QOI reader and writer, https://qoiformat.org
+//
+// lossless rgba for frames our own tools read back soon after. every pixel
+// becomes a run of the one before, a slot of a 64 entry table of recently
+// seen pixels, a small difference from the one before, or the pixel
+// itself, in a single pass with no entropy coding. frames of line art are
+// mostly runs of background, which cost one byte per 62 pixels, so they
+// come out a little larger than a png and are written many times faster
+//
+// files are 4 channels, straight alpha, tagged sRGB
+
+// bytes gathered before they are written
+#define QOI_CHUNK ((size_t) 1 << 20)
+
+// the most pixels the format allows
+#define QOI_MAX_PIXELS 400000000u
+
+/**
+ * @brief Encode rgba32 pixels as QOI in memory
+ *
+ * @param w width in pixels
+ * @param h height in pixels
+ * @param pixels w * h straight alpha rgba32 pixels, row by row from the top
+ * @param len set to the number of bytes returned
+ *
+ * @return the encoded file, to be freed by the caller, NULL if it could not be allocated
+ */
+uint8_t* qoi_encode(int w, int h, const unsigned* pixels, size_t* len);
+
+/**
+ * @brief Decode a QOI file in memory
+ *
+ * @param data file contents
+ * @param len number of bytes
+ * @param w set to the width in pixels
+ * @param h set to the height in pixels
+ *
+ * @return w * h straight alpha rgba32 pixels, to be freed by the caller, NULL if the data is not a valid QOI file or memory ran out
+ */
+unsigned* qoi_decode(const uint8_t* data, size_t len, int* w, int* h);
+
+/**
+ * @brief Write rgba32 pixels as a QOI file
+ *
+ * @param path file to write
+ * @param w width in pixels
+ * @param h height in pixels
+ * @param pixels w * h straight alpha rgba32 pixels, row by row from the top
+ *
+ * @return 1 on success, 0 on failure
+ */
+int qoi_write_pixels(const char* path, int w, int h, const unsigned* pixels);
+
+/**
+ * @brief Write any framebuffer as a QOI file, one framebuffer_row at a time
+ *
+ * @param fb framebuffer to write
+ * @param path file to write
+ *
+ * @return 1 on success, 0 on failure
+ */
+int qoi_write_framebuffer(framebuffer_t* fb, const char* path);
+
+/**
+ * @brief Read a QOI file
+ *
+ * @param path file to read
+ * @param w set to the width in pixels
+ * @param h set to the height in pixels
+ *
+ * @return w * h straight alpha rgba32 pixels, to be freed by the caller, NULL on failure
+ */
+unsigned* qoi_read(const char* path, int* w, int* h);
+
+#endif
@@ -0,0 +1,121 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "segfile.h"
+
+// the direct path relies on records and segment_t lining up
+typedef char segment_layout_check[sizeof(segment_t) == 20 ? 1 : -1];
+
+// segments handed to draw_aaline_batch_mt at once, bounds its tile lists
+#define SEGFILE_WINDOW ((size_t) 1 << 24)
+
+static uint16_t read_u16(const unsigned char* p) {
+	return (uint16_t) (p[0] | p[1] << 8);
+}
+
+static uint32_t read_u32(const unsigned char* p) {
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t read_u64(const unsigned char* p) {
+	return (uint64_t) read_u32(p) | (uint64_t) read_u32(p + 4) << 32;
+}
+
+segfile_t* segfile_open(const char* path) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return NULL;
+	struct stat st;
+	if(fstat(fd, &st) < 0 || st.st_size < SEGFILE_HEADER_SIZE) {
+		close(fd);
+		return NULL;
+	}
+	size_t len = (size_t) st.st_size;
+	void* map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping stays valid after the descriptor is closed
+	close(fd);
+	if(map == MAP_FAILED)
+		return NULL;
+	const unsigned char* h = (const unsigned char*) map;
+	segfile_t* sf = malloc(sizeof(segfile_t));
+	if(!sf || memcmp(h, "AASG", 4) != 0 || read_u16(h + 4) != SEGFILE_VERSION) {
+		free(sf);
+		munmap(map, len);
+		return NULL;
+	}
+	sf->map = map;
+	sf->map_len = len;
+	sf->flags = read_u16(h + 6);
+	sf->color = read_u32(h + 8);
+	sf->count = read_u64(h + 16);
+	sf->records = h + SEGFILE_HEADER_SIZE;
+	sf->stride = sf->flags & SEGFILE_COLOR ? 20 : 16;
+	if(sf->count > (len - SEGFILE_HEADER_SIZE) / sf->stride) {
+		segfile_close(sf);
+		return NULL;
+	}
+	posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+	return sf;
+}
+
+void segfile_close(segfile_t* sf) {
+	if(!sf)
+		return;
+	munmap((void*) sf->map, sf->map_len);
+	free(sf);
+}
+
+const segment_t* segfile_segments(segfile_t* sf) {
+	if((sf->flags & (SEGFILE_COLOR | SEGFILE_FIXED)) != SEGFILE_COLOR)
+		return NULL;
+	return (const segment_t*) sf->records;
+}
+
+int segfile_draw(framebuffer_t* fb, segfile_t* sf, threadpool_t* pool) {
+	const segment_t* segs = segfile_segments(sf);
+	if(segs) {
+		for(uint64_t base = 0; base < sf->count; base += SEGFILE_WINDOW) {
+			size_t n = sf->count - base < SEGFILE_WINDOW ? (size_t) (sf->count - base) : SEGFILE_WINDOW;
+			if(!draw_aaline_batch_mt(fb, segs + base, n, pool))
+				return 0;
+		}
+		return 1;
+	}
+	// records are 4 byte aligned, the header is 32 bytes and strides are
+	// 16 or 20, so they can be read in place
+	for(uint64_t i = 0; i < sf->count; i++) {
+		const int32_t* r = (const int32_t*) (sf->records + i * sf->stride);
+		unsigned color = sf->flags & SEGFILE_COLOR ? (unsigned) r[4] : sf->color;
+		if(sf->flags & SEGFILE_FIXED) {
+			pointfx_t p1 = {r[0], r[1]};
+			pointfx_t p2 = {r[2], r[3]};
+			draw_aaline_fx(fb, color, &p1, &p2);
+		}
+		else {
+			point_t p1 = {r[0], r[1]};
+			point_t p2 = {r[2], r[3]};
+			draw_aaline(fb, color, &p1, &p2);
+		}
+	}
+	return 1;
+}
+
+int segfile_write(const char* path, const segment_t* segs, size_t n) {
+	FILE* f = fopen(path, "wb");
+	if(!f)
+		return 0;
+	unsigned char h[SEGFILE_HEADER_SIZE] = {'A', 'A', 'S', 'G', SEGFILE_VERSION, 0, SEGFILE_COLOR, 0};
+	for(int i = 0; i < 8; i++)
+		h[16 + i] = (unsigned char) ((uint64_t) n >> (8 * i));
+	int ok = fwrite(h, 1, sizeof(h), f) == sizeof(h);
+	// segment_t is already the record layout on little endian hosts
+	ok = ok && fwrite(segs, sizeof(segment_t), n, f) == n;
+	return fclose(f) == 0 && ok;
+}
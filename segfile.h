@@ -0,0 +1,97 @@
+#ifndef SEGFILE_H
+#define SEGFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "framebuffer.h"
+
+// binary segment files, read through mmap so drawing needs no parse step
+// and the input is bounded by address space instead of memory
+//
+// all fields are little endian. the 32 byte header is
+//
+//   char     magic[4]       "AASG"
+//   uint16_t version        SEGFILE_VERSION
+//   uint16_t flags          SEGFILE_* below
+//   uint32_t color          rgba32 color for files without SEGFILE_COLOR
+//   uint32_t reserved
+//   uint64_t count          number of records
+//   uint64_t reserved
+//
+// followed by count records of int32 x0, y0, x1, y1 and, with
+// SEGFILE_COLOR, a uint32 rgba32 color. with SEGFILE_COLOR set and
+// SEGFILE_FIXED clear a record has the same layout as segment_t and the
+// mapping is drawn directly
+
+#define SEGFILE_VERSION 1
+#define SEGFILE_HEADER_SIZE 32
+
+#define SEGFILE_COLOR 0x1 /**< every record carries its own color */
+#define SEGFILE_FIXED 0x2 /**< endpoints are 24.8 fixed point, see pointfx_t */
+
+/**
+ * @brief An open, mapped segment file
+ */
+typedef struct {
+	const void* map; /**< whole file */
+	size_t map_len;
+	unsigned flags; /**< SEGFILE_* */
+	unsigned color; /**< color of segments without their own */
+	uint64_t count; /**< number of records */
+	const unsigned char* records; /**< first record */
+	size_t stride; /**< bytes per record */
+} segfile_t;
+
+/**
+ * @brief Map a segment file and check its header
+ *
+ * @param path file to open
+ *
+ * @return a pointer to the open file, NULL if it is missing, truncated or not a segment file
+ */
+segfile_t* segfile_open(const char* path);
+
+/**
+ * @brief Unmap a segment file
+ *
+ * @param sf file to close, may be NULL
+ */
+void segfile_close(segfile_t* sf);
+
+/**
+ * @brief The records as segment_t, when their layout allows it
+ *
+ * @param sf open file
+ *
+ * @return the mapped records, NULL if the file has fixed point endpoints or no colors
+ */
+const segment_t* segfile_segments(segfile_t* sf);
+
+/**
+ * @brief Draw every segment of a file, in file order
+ *
+ * Files laid out as segment_t go through draw_aaline_batch_mt straight
+ * from the mapping, a window at a time so the tile lists stay bounded.
+ * Other files are drawn record by record from the mapping.
+ *
+ * @param fb framebuffer to draw into
+ * @param sf open file
+ * @param pool threads for the batch path, may be NULL
+ *
+ * @return 1 on success, 0 if drawing ran out of memory
+ */
+int segfile_draw(framebuffer_t* fb, segfile_t* sf, threadpool_t* pool);
+
+/**
+ * @brief Write segments to a file in the segment_t layout
+ *
+ * @param path file to write
+ * @param segs segments to write
+ * @param n number of segments
+ *
+ * @return 1 on success, 0 on failure
+ */
+int segfile_write(const char* path, const segment_t* segs, size_t n);
+
+#endif
@@ -0,0 +1,387 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "framebuffer.h"
+#include "png.h"
+#include "segfile.h"
+#include "server.h"
+
+struct render_server {
+	framebuffer_t* fb;
+	threadpool_t* pool;
+	int png_profile; /**< PNG_* profile of flush and banded */
+	segment_t* segs; /**< batch buffer, kept between batches */
+	size_t segs_cap;
+	char* line; /**< getline buffer */
+	size_t line_cap;
+	unsigned long lineno;
+};
+
+render_server_t* server_init(int threads) {
+	render_server_t* server = calloc(1, sizeof(render_server_t));
+	if(!server)
+		return NULL;
+	server->pool = threadpool_init(threads);
+	server->fb = framebuffer_init(100, 100);
+	server->png_profile = PNG_PROFILE;
+	if(!server->pool || !server->fb) {
+		server_free(server);
+		return NULL;
+	}
+	return server;
+}
+
+void server_free(render_server_t* server) {
+	if(!server)
+		return;
+	framebuffer_free(server->fb);
+	threadpool_free(server->pool);
+	free(server->segs);
+	free(server->line);
+	free(server);
+}
+
+static int parse_color(const char* s, char** end, unsigned* color) {
+	// rrggbbaa
+	while(*s == ' ' || *s == '\t')
+		s++;
+	const char* start = s;
+	unsigned long v = strtoul(s, end, 16);
+	if(*end - start != 8)
+		return 0;
+	*color = rgba32(v >> 24, v >> 16, v >> 8, v);
+	return 1;
+}
+
+static int parse_numbers(const char* s, char** end, double* out, int n) {
+	for(int i = 0; i < n; i++) {
+		out[i] = strtod(s, end);
+		if(*end == s)
+			return 0;
+		s = *end;
+	}
+	return 1;
+}
+
+static int at_end(const char* s) {
+	while(*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
+		s++;
+	return *s == '\0';
+}
+
+static int parse_segment(const char* s, segment_t* seg, double* v) {
+	// v gets the raw coordinates, seg the rounded ones
+	char* end;
+	unsigned color;
+	if(!parse_numbers(s, &end, v, 4) || !parse_color(end, &end, &color) || !at_end(end))
+		return 0;
+	seg->p1.x = (int) v[0];
+	seg->p1.y = (int) v[1];
+	seg->p2.x = (int) v[2];
+	seg->p2.y = (int) v[3];
+	seg->color = color;
+	return 1;
+}
+
+static void reply_error(render_server_t* server, FILE* out, const char* msg) {
+	fprintf(out, "error %lu: %s\n", server->lineno, msg);
+	fflush(out);
+}
+
+static ssize_t read_line(render_server_t* server, FILE* in) {
+	ssize_t len = getline(&server->line, &server->line_cap, in);
+	if(len >= 0)
+		server->lineno++;
+	return len;
+}
+
+static void run_batch(render_server_t* server, FILE* in, FILE* out, size_t n) {
+	int room = n <= server->segs_cap;
+	if(!room) {
+		segment_t* segs = n <= SIZE_MAX / sizeof(segment_t) ? realloc(server->segs, n * sizeof(segment_t)) : NULL;
+		if(segs) {
+			server->segs = segs;
+			server->segs_cap = n;
+			room = 1;
+		}
+		else {
+			reply_error(server, out, "out of memory");
+		}
+	}
+	double v[4];
+	size_t count = 0;
+	int ok = 1;
+	// always consume all n lines so a bad one, or no room for them, does
+	// not desync the stream
+	for(size_t i = 0; i < n; i++) {
+		if(read_line(server, in) < 0) {
+			reply_error(server, out, "end of input inside batch");
+			return;
+		}
+		if(!room)
+			continue;
+		if(!parse_segment(server->line, &server->segs[count], v)) {
+			if(ok)
+				reply_error(server, out, "bad segment");
+			ok = 0;
+			continue;
+		}
+		count++;
+	}
+	if(room && !draw_aaline_batch_mt(server->fb, server->segs, count, server->pool))
+		reply_error(server, out, "out of memory");
+}
+
+static int run_command(render_server_t* server, FILE* in, FILE* out) {
+	// returns 1 when the server should stop
+	char* cmd = server->line;
+	while(*cmd == ' ' || *cmd == '\t')
+		cmd++;
+	if(*cmd == '#' || at_end(cmd))
+		return 0;
+	char* args = cmd;
+	while(*args && *args != ' ' && *args != '\t' && *args != '\r' && *args != '\n')
+		args++;
+	size_t cmd_len = args - cmd;
+	char* end;
+	double v[4];
+	unsigned color;
+
+	if(cmd_len == 4 && strncmp(cmd, "line", 4) == 0) {
+		segment_t seg;
+		if(!parse_segment(args, &seg, v)) {
+			reply_error(server, out, "usage: line X0 Y0 X1 Y1 COLOR");
+			return 0;
+		}
+		int whole = v[0] == seg.p1.x && v[1] == seg.p1.y && v[2] == seg.p2.x && v[3] == seg.p2.y;
+		if(whole) {
+			draw_aaline(server->fb, seg.color, &seg.p1, &seg.p2);
+		}
+		else {
+			pointfx_t p1 = {TO_FX(v[0]), TO_FX(v[1])};
+			pointfx_t p2 = {TO_FX(v[2]), TO_FX(v[3])};
+			draw_aaline_fx(server->fb, seg.color, &p1, &p2);
+		}
+	}
+	else if(cmd_len == 5 && strncmp(cmd, "batch", 5) == 0) {
+		if(!parse_numbers(args, &end, v, 1) || !at_end(end) || v[0] < 0) {
+			reply_error(server, out, "usage: batch N");
+			return 0;
+		}
+		run_batch(server, in, out, (size_t) v[0]);
+	}
+	else if(cmd_len == 8 && strncmp(cmd, "segments", 8) == 0) {
+		while(*args == ' ' || *args == '\t')
+			args++;
+		args[strcspn(args, "\r\n")] = '\0';
+		if(*args == '\0') {
+			reply_error(server, out, "usage: segments PATH");
+			return 0;
+		}
+		segfile_t* sf = segfile_open(args);
+		if(!sf) {
+			reply_error(server, out, "could not open segment file");
+			return 0;
+		}
+		if(!segfile_draw(server->fb, sf, server->pool))
+			reply_error(server, out, "out of memory");
+		segfile_close(sf);
+	}
+	else if(cmd_len == 6 && strncmp(cmd, "banded", 6) == 0) {
+		// two paths, so neither may contain blanks
+		const char* usage = "usage: banded W H ROWS COLOR SEGMENTS PATH";
+		if(!parse_numbers(args, &end, v, 3) || v[0] < 1 || v[1] < 1 || v[2] < 1 || !parse_color(end, &end, &color)) {
+			reply_error(server, out, usage);
+			return 0;
+		}
+		char* in_path = end + strspn(end, " \t");
+		char* out_path = in_path + strcspn(in_path, " \t\r\n");
+		if(*out_path)
+			*out_path++ = '\0';
+		out_path += strspn(out_path, " \t");
+		out_path[strcspn(out_path, " \t\r\n")] = '\0';
+		if(*in_path == '\0' || *out_path == '\0') {
+			reply_error(server, out, usage);
+			return 0;
+		}
+		segfile_t* sf = segfile_open(in_path);
+		const segment_t* segs = sf ? segfile_segments(sf) : NULL;
+		if(!segs) {
+			reply_error(server, out, sf ? "banded needs a segment file with colors and whole pixel endpoints" : "could not open segment file");
+			segfile_close(sf);
+			return 0;
+		}
+		int ok = png_render_banded(out_path, (int) v[0], (int) v[1], (int) v[2], color, segs, (size_t) sf->count, server->png_profile, server->pool);
+		segfile_close(sf);
+		if(!ok) {
+			reply_error(server, out, "could not write image");
+			return 0;
+		}
+		fprintf(out, "ok %s\n", out_path);
+		fflush(out);
+	}
+	else if(cmd_len == 5 && strncmp(cmd, "frame", 5) == 0) {
+		if(!parse_numbers(args, &end, v, 2) || !at_end(end) || v[0] < 1 || v[1] < 1) {
+			reply_error(server, out, "usage: frame W H");
+			return 0;
+		}
+		if(!framebuffer_resize(server->fb, (int) v[0], (int) v[1]))
+			reply_error(server, out, "out of memory");
+		else
+			framebuffer_fill(server->fb, 0);
+	}
+	else if(cmd_len == 5 && strncmp(cmd, "clear", 5) == 0) {
+		if(!parse_color(args, &end, &color) || !at_end(end)) {
+			reply_error(server, out, "usage: clear COLOR");
+			return 0;
+		}
+		framebuffer_fill(server->fb, color);
+	}
+	else if(cmd_len == 7 && strncmp(cmd, "scissor", 7) == 0) {
+		if(at_end(args)) {
+			framebuffer_set_scissor(server->fb, NULL);
+			return 0;
+		}
+		if(!parse_numbers(args, &end, v, 4) || !at_end(end)) {
+			reply_error(server, out, "usage: scissor [X0 Y0 X1 Y1]");
+			return 0;
+		}
+		rect_t r = {(int) v[0], (int) v[1], (int) v[2], (int) v[3]};
+		framebuffer_set_scissor(server->fb, &r);
+	}
+	else if(cmd_len == 3 && strncmp(cmd, "png", 3) == 0) {
+		char* name = args + strspn(args, " \t");
+		end = name + strcspn(name, " \t\r\n");
+		int trailing = !at_end(end);
+		*end = '\0';
+		int profile = png_profile_parse(name);
+		if(profile < 0 || trailing) {
+			reply_error(server, out, "usage: png fastest|balanced|smallest");
+			return 0;
+		}
+		server->png_profile = profile;
+	}
+	else if(cmd_len == 5 && strncmp(cmd, "flush", 5) == 0) {
+		while(*args == ' ' || *args == '\t')
+			args++;
+		args[strcspn(args, "\r\n")] = '\0';
+		if(*args == '\0') {
+			reply_error(server, out, "usage: flush PATH");
+			return 0;
+		}
+		if(!framebuffer_write_mt(server->fb, args, server->png_profile, server->pool)) {
+			reply_error(server, out, "could not write frame");
+			return 0;
+		}
+		fprintf(out, "ok %s\n", args);
+		fflush(out);
+	}
+	else if(cmd_len == 4 && strncmp(cmd, "quit", 4) == 0) {
+		return 1;
+	}
+	else {
+		reply_error(server, out, "unknown command");
+	}
+	return 0;
+}
+
+int server_run(render_server_t* server, FILE* in, FILE* out) {
+	while(read_line(server, in) >= 0) {
+		if(run_command(server, in, out))
+			return 1;
+		// nobody is reading the replies any more
+		if(ferror(out))
+			return 0;
+	}
+	return 0;
+}
+
+int server_listen(render_server_t* server, const char* path) {
+	struct sockaddr_un addr;
+	if(strlen(path) >= sizeof(addr.sun_path))
+		return 0;
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(sock < 0)
+		return 0;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if(bind(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(sock, 4) < 0) {
+		close(sock);
+		return 0;
+	}
+	// a client that hangs up before its replies are written ends its own
+	// connection, not the server
+	signal(SIGPIPE, SIG_IGN);
+	int quit = 0;
+	while(!quit) {
+		int conn = accept(sock, NULL, NULL);
+		if(conn < 0 && (errno == EINTR || errno == ECONNABORTED))
+			continue;
+		if(conn < 0)
+			break;
+		// one stream for commands and one for replies over the same socket
+		int conn_out = dup(conn);
+		FILE* in = fdopen(conn, "r");
+		FILE* out = conn_out >= 0 ? fdopen(conn_out, "w") : NULL;
+		if(in && out) {
+			server->lineno = 0;
+			quit = server_run(server, in, out);
+		}
+		if(in)
+			fclose(in);
+		else
+			close(conn);
+		if(out)
+			fclose(out);
+		else if(conn_out >= 0)
+			close(conn_out);
+	}
+	close(sock);
+	unlink(path);
+	return quit;
+}
+
+int server_main(int argc, char** argv) {
+	int threads = 0;
+	const char* socket_path = NULL;
+	for(int i = 0; i < argc; i++) {
+		if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+			socket_path = argv[++i];
+		}
+		else {
+			fprintf(stderr, "unknown server option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	render_server_t* server = server_init(threads);
+	if(!server) {
+		fprintf(stderr, "could not start server\n");
+		return 1;
+	}
+	int status = 0;
+	if(socket_path) {
+		if(!server_listen(server, socket_path)) {
+			fprintf(stderr, "could not listen on %s\n", socket_path);
+			status = 1;
+		}
+	}
+	else {
+		server_run(server, stdin, stdout);
+	}
+	server_free(server);
+	return status;
+}
@@ -0,0 +1,87 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+
+// render server: keeps a framebuffer and a thread pool alive across
+// frames and draws from a stream of text commands, one per line
+//
+//   frame W H                resize the frame, reusing its memory
+//   clear COLOR              fill the whole frame
+//   scissor X0 Y0 X1 Y1      restrict drawing, no arguments resets it
+//   line X0 Y0 X1 Y1 COLOR   draw one line, fractional coordinates are
+//                            drawn with sub-pixel endpoints
+//   batch N                  the next N lines are "X0 Y0 X1 Y1 COLOR"
+//                            segments, drawn on the thread pool
+//   segments PATH            draw a binary segment file, see segfile.h
+//   banded W H ROWS COLOR SEGMENTS PATH
+//                            draw a segment file straight into a W by H
+//                            png over COLOR, ROWS rows at a time, leaving
+//                            the frame alone, see png_render_banded
+//   png PROFILE              fastest, balanced or smallest, how flush and
+//                            banded write png files, balanced at first
+//   flush PATH               write the frame, format from the extension,
+//                            png compressed on the thread pool
+//   quit                     stop the server
+//
+// COLOR is rrggbbaa in hex. flush and banded answer "ok PATH", any
+// command that fails answers "error LINE: message". blank lines and
+// lines starting with # are ignored
+
+/**
+ * @brief Server state, one frame and one thread pool
+ */
+typedef struct render_server render_server_t;
+
+/**
+ * @brief Create a server
+ *
+ * @param threads worker threads for batches, 0 for one per cpu
+ *
+ * @return a pointer to the new server, NULL if it could not be created
+ */
+render_server_t* server_init(int threads);
+
+/**
+ * @brief Read and run commands until end of input or quit
+ *
+ * @param server server to run on, the frame is kept between calls
+ * @param in stream of commands
+ * @param out stream replies are written to
+ *
+ * @return 1 if a quit command was read, 0 at end of input or once replies can no longer be written
+ */
+int server_run(render_server_t* server, FILE* in, FILE* out);
+
+/**
+ * @brief Accept connections on a Unix socket and run each one's commands
+ *
+ * Connections are served one after another and share the server's frame.
+ * Returns when a connection sends quit, or when accepting fails for any
+ * reason other than an interrupt or a client that gave up.
+ *
+ * @param server server to run on
+ * @param path filesystem path of the socket, replaced if it exists
+ *
+ * @return 1 after quit, 0 if the socket could not be set up or accept failed
+ */
+int server_listen(render_server_t* server, const char* path);
+
+/**
+ * @brief Free a server, its frame and its threads
+ *
+ * @param server server to free, may be NULL
+ */
+void server_free(render_server_t* server);
+
+/**
+ * @brief Entry point for aaline --serve
+ *
+ * @param argc number of arguments after --serve
+ * @param argv [--threads n] [--socket path]
+ *
+ * @return process exit status
+ */
+int server_main(int argc, char** argv);
+
+#endif
@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sparse.h"
+
+sparse_tiles_t* sparse_init(int w, int h, size_t pixel_size) {
+	sparse_tiles_t* tiles = calloc(1, sizeof(sparse_tiles_t));
+	if(!tiles)
+		return NULL;
+	tiles->tiles_x = (w + SPARSE_TILE - 1) >> SPARSE_TILE_SHIFT;
+	tiles->tiles_y = (h + SPARSE_TILE - 1) >> SPARSE_TILE_SHIFT;
+	tiles->tile_bytes = (size_t) SPARSE_TILE * SPARSE_TILE * pixel_size;
+	tiles->tile = calloc((size_t) tiles->tiles_x * tiles->tiles_y, sizeof(void*));
+	if(!tiles->tile) {
+		free(tiles);
+		return NULL;
+	}
+	return tiles;
+}
+
+void sparse_free(sparse_tiles_t* tiles) {
+	if(!tiles)
+		return;
+	for(size_t i = 0; i < tiles->nslabs; i++)
+		free(tiles->slabs[i]);
+	free(tiles->slabs);
+	free(tiles->free_tiles);
+	free(tiles->tile);
+	free(tiles);
+}
+
+void sparse_clear(sparse_tiles_t* tiles, unsigned color) {
+	size_t n = (size_t) tiles->tiles_x * tiles->tiles_y;
+	for(size_t i = 0; i < n && tiles->used; i++) {
+		if(tiles->tile[i]) {
+			tiles->free_tiles[tiles->nfree++] = tiles->tile[i];
+			tiles->tile[i] = NULL;
+			tiles->used--;
+		}
+	}
+	tiles->clear = color;
+}
+
+static void* take_tile(sparse_tiles_t* tiles) {
+	// from the free list, then the rest of the last slab, then a new slab
+	if(tiles->nfree)
+		return tiles->free_tiles[--tiles->nfree];
+	if(!tiles->fresh) {
+		// free_tiles always has room for every tile there is, so clearing
+		// never allocates
+		size_t total = (tiles->nslabs + 1) * SPARSE_SLAB;
+		void** slabs = realloc(tiles->slabs, (tiles->nslabs + 1) * sizeof(void*));
+		if(!slabs)
+			return NULL;
+		tiles->slabs = slabs;
+		void** free_tiles = realloc(tiles->free_tiles, total * sizeof(void*));
+		if(!free_tiles)
+			return NULL;
+		tiles->free_tiles = free_tiles;
+		void* slab = malloc(tiles->tile_bytes * SPARSE_SLAB);
+		if(!slab)
+			return NULL;
+		tiles->slabs[tiles->nslabs++] = slab;
+		tiles->fresh = SPARSE_SLAB;
+	}
+	char* slab = tiles->slabs[tiles->nslabs - 1];
+	return slab + tiles->tile_bytes * (SPARSE_SLAB - tiles->fresh--);
+}
+
+void* sparse_tile(sparse_tiles_t* tiles, int tx, int ty, int create, int* fresh) {
+	if(fresh)
+		*fresh = 0;
+	if(tx < 0 || ty < 0 || tx >= tiles->tiles_x || ty >= tiles->tiles_y)
+		return NULL;
+	void** slot = &tiles->tile[(size_t) tiles->tiles_x * ty + tx];
+	if(*slot || !create)
+		return *slot;
+	*slot = take_tile(tiles);
+	if(*slot) {
+		tiles->used++;
+		if(fresh)
+			*fresh = 1;
+	}
+	return *slot;
+}
@@ -0,0 +1,81 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <stddef.h>
+
+// tile table behind FB_SPARSE framebuffers
+//
+// the canvas is cut into SPARSE_TILE square tiles that are allocated the
+// first time anything is drawn into them, the others read back as the
+// clear color. tiles come from slabs of SPARSE_SLAB and go back to a
+// free list when the framebuffer is cleared, so redrawing a frame does
+// not touch malloc. a 100000x100000 canvas needs a 4.9 MB table plus
+// 64 KB per 8-bit tile that was drawn into. smaller tiles waste less
+// around thin lines but make the table and the row reads slower
+
+// side of a tile in pixels, a power of two
+#define SPARSE_TILE 128
+#define SPARSE_TILE_SHIFT 7
+
+// tiles allocated at once
+#define SPARSE_SLAB 16
+
+/**
+ * @brief Tile table of a sparse framebuffer
+ */
+typedef struct sparse_tiles {
+	void** tile; /**< tiles_x * tiles_y pixel blocks, NULL where nothing was drawn */
+	int tiles_x;
+	int tiles_y;
+	size_t tile_bytes; /**< bytes of one tile */
+	unsigned clear; /**< straight rgba32 color of the tiles that are NULL */
+	void** slabs; /**< every block ever allocated, SPARSE_SLAB tiles each */
+	size_t nslabs;
+	void** free_tiles; /**< tiles given back by sparse_clear, room for every tile of every slab */
+	size_t nfree;
+	size_t fresh; /**< tiles of the last slab not handed out yet */
+	size_t used; /**< tiles in the table */
+} sparse_tiles_t;
+
+/**
+ * @brief Create an empty tile table
+ *
+ * @param w width of the canvas in pixels
+ * @param h height of the canvas in pixels
+ * @param pixel_size bytes per pixel
+ *
+ * @return a pointer to the new table, NULL if it could not be allocated
+ */
+sparse_tiles_t* sparse_init(int w, int h, size_t pixel_size);
+
+/**
+ * @brief Free a tile table and all its tiles
+ *
+ * @param tiles table to free, may be NULL
+ */
+void sparse_free(sparse_tiles_t* tiles);
+
+/**
+ * @brief Give every tile back to the pool
+ *
+ * @param tiles table to clear
+ * @param color new clear color, straight rgba32
+ */
+void sparse_clear(sparse_tiles_t* tiles, unsigned color);
+
+/**
+ * @brief Find a tile, or take one from the pool
+ *
+ * A new tile is uninitialized, the caller fills it with the clear color.
+ *
+ * @param tiles table to look in
+ * @param tx column of the tile
+ * @param ty row of the tile
+ * @param create take a tile from the pool if there is none yet
+ * @param fresh set to 1 if the tile was just taken from the pool, may be NULL
+ *
+ * @return the tile's pixels, NULL if there is none or it could not be allocated
+ */
+void* sparse_tile(sparse_tiles_t* tiles, int tx, int ty, int create, int* fresh);
+
+#endif
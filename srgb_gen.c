@@ -0,0 +1,68 @@
+#include <math.h>
+#include <stdio.h>
+
+// writes srgb.h to stdout, run by make srgb. the tables are checked in so
+// building never needs this, it is here to change the curves or check
+// that the header still matches them
+
+#define LINEAR_MAX 65520 /**< 4095 * 16, see srgb.h */
+#define ENCODE_SIZE 4096
+
+static double linear(double c) {
+	return c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+}
+
+static double srgb(double l) {
+	return l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1 / 2.4) - 0.055;
+}
+
+static void table(const char* decl, const int* v, int n, int pad, int per_line) {
+	// the last entry is repeated pad times
+	printf("%s = {\n", decl);
+	for(int i = 0; i < n + pad; i++) {
+		int last = i == n + pad - 1;
+		printf("%s%d%s", i % per_line ? " " : "\t", v[i < n ? i : n - 1], last ? "\n" : (i % per_line == per_line - 1 ? ",\n" : ","));
+	}
+	printf("};\n");
+}
+
+int main(void) {
+	int decode[256], encode[ENCODE_SIZE];
+	for(int c = 0; c < 256; c++)
+		decode[c] = (int) floor(LINEAR_MAX * linear(c / 255.0) + 0.5);
+	for(int i = 0; i < ENCODE_SIZE; i++)
+		encode[i] = (int) floor(255 * srgb(i / (ENCODE_SIZE - 1.0)) + 0.5);
+	// the kernels round the blended value to an index, (v * 256 + 2048) >> 12
+	for(int c = 0; c < 256; c++) {
+		int i = (decode[c] + 8) >> 4;
+		if(encode[i] != c) {
+			fprintf(stderr, "encode(decode(%d)) is %d\n", c, encode[i]);
+			return 1;
+		}
+	}
+
+	printf("#ifndef SRGB_H\n"
+		"#define SRGB_H\n"
+		"\n"
+		"#include <stdint.h>\n"
+		"\n"
+		"// sRGB transfer function tables for the linear light blend kernels\n"
+		"//\n"
+		"//   srgb_decode[c] = round(%d * linear(c / 255))\n"
+		"//   srgb_encode[i] = round(255 * srgb(i / %d))\n"
+		"//\n"
+		"// with linear and srgb the piecewise curves of IEC 61966-2-1. %d is\n"
+		"// %d * 16, so two decoded values blended with weights summing to 256\n"
+		"// shift down by 12 into an encode index, and encode(decode(c)) == c for\n"
+		"// every c. both tables carry padding past their last entry so 32-bit\n"
+		"// gathers of the last entry stay inside the array. srgb_gen.c writes\n"
+		"// this file, run make srgb after changing either curve\n"
+		"\n"
+		"#define SRGB_LINEAR_MAX %d /**< srgb_decode[255] */\n"
+		"\n", LINEAR_MAX, ENCODE_SIZE - 1, LINEAR_MAX, ENCODE_SIZE - 1, LINEAR_MAX);
+	table("static const uint16_t srgb_decode[256 + 1]", decode, 256, 1, 12);
+	printf("\n");
+	table("static const uint8_t srgb_encode[4096 + 3]", encode, ENCODE_SIZE, 3, 24);
+	printf("\n#endif\n");
+	return 0;
+}
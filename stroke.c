@@ -0,0 +1,539 @@
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framebuffer.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// single pass strokes
+//
+// the stroke is walked row by row over the pixels it can touch, and
+// every pixel gets its coverage from where its center lies relative to
+// the segment: u along the segment from p1, v across it. coverage is
+// the box filtered overlap of the pixel with the stroke on each axis, so
+// every pixel is blended exactly once whatever the width
+//
+// polylines draw their segments, joins and caps into a coverage mask
+// first, keeping the largest coverage any piece gives a pixel, and blend
+// the mask once when the path is done. pieces that meet inside the path
+// overlap by at least half a pixel so their edges never show. the mask
+// starts empty and grows by rows, and every row by columns, as pieces
+// land outside it, so it only ever holds the rows the path crosses and
+// the columns it reaches in each
+
+// pixels whose coverage is computed before they are blended as one span
+#define STROKE_SPAN 256
+
+// how far segment ends inside a path reach into the next piece
+#define JOIN_OVERLAP 0.5f
+
+// fewest rows, or columns of a row, a path mask grows by
+#define MASK_GROW 64
+
+typedef struct {
+	float x0, y0; /**< p1 in pixels */
+	float ux, uy; /**< unit direction from p1 to p2 */
+	float len;
+	float hw; /**< half the width */
+	float ext0; /**< how far the stroke reaches back past p1 */
+	float ext1; /**< how far the stroke reaches past p2 */
+	int round; /**< coverage from the distance to the segment, for round caps */
+} stroke_t;
+
+typedef struct {
+	uint8_t* coverage; /**< width bytes from column left, zero where nothing was drawn, NULL until the row is */
+	int left;
+	int width;
+	int x0; /**< first pixel drawn, INT_MAX for untouched rows */
+	int x1; /**< last pixel drawn */
+} mask_row_t;
+
+typedef struct {
+	mask_row_t* rows; /**< height rows from row top */
+	int top;
+	int height;
+	rect_t bounds; /**< the mask never grows past these */
+	int ok; /**< 0 once memory ran out, nothing more is drawn */
+} path_mask_t;
+
+static inline float box_overlap(float c, float lo, float hi) {
+	// length of [c - 0.5, c + 0.5] inside [lo, hi]
+	float a = c - 0.5f > lo ? c - 0.5f : lo;
+	float b = c + 0.5f < hi ? c + 0.5f : hi;
+	return b > a ? b - a : 0.0f;
+}
+
+#ifdef __SSE2__
+static inline __m128 box_overlap4(__m128 c, __m128 lo, __m128 hi) {
+	const __m128 half = _mm_set1_ps(0.5f);
+	__m128 a = _mm_max_ps(_mm_sub_ps(c, half), lo);
+	__m128 b = _mm_min_ps(_mm_add_ps(c, half), hi);
+	return _mm_max_ps(_mm_sub_ps(b, a), _mm_setzero_ps());
+}
+#endif
+
+static void stroke_coverage(const stroke_t* s, float u, float v, int n, uint8_t* coverage) {
+	// u and v at the first of n pixels along a row, coverage has room for
+	// n rounded up to a multiple of four
+	int i = 0;
+#ifdef __SSE2__
+	// four pixels at a time, rounded to bytes the same way as below. the
+	// pixels past n are junk that nobody reads
+	const __m128 steps = _mm_setr_ps(0, 1, 2, 3);
+	const __m128 scale = _mm_set1_ps(255.0f);
+	const __m128 round = _mm_set1_ps(0.5f);
+	const __m128 zero = _mm_setzero_ps();
+	__m128 hw = _mm_set1_ps(s->hw), neg_hw = _mm_set1_ps(-s->hw);
+	__m128 len = _mm_set1_ps(s->len);
+	__m128 ulo = _mm_set1_ps(-s->ext0), uhi = _mm_set1_ps(s->len + s->ext1);
+	__m128 du = _mm_set1_ps(s->ux), dv = _mm_set1_ps(s->uy);
+	for(; i < n; i += 4) {
+		__m128 k = _mm_add_ps(_mm_set1_ps((float) i), steps);
+		__m128 pu = _mm_add_ps(_mm_set1_ps(u), _mm_mul_ps(k, du));
+		__m128 pv = _mm_sub_ps(_mm_set1_ps(v), _mm_mul_ps(k, dv));
+		__m128 cov;
+		if(s->round) {
+			__m128 cu = _mm_add_ps(_mm_min_ps(pu, zero), _mm_max_ps(_mm_sub_ps(pu, len), zero));
+			__m128 d = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(cu, cu), _mm_mul_ps(pv, pv)));
+			cov = box_overlap4(d, neg_hw, hw);
+		}
+		else {
+			cov = _mm_mul_ps(box_overlap4(pv, neg_hw, hw), box_overlap4(pu, ulo, uhi));
+		}
+		__m128i c = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(cov, scale), round));
+		c = _mm_packs_epi32(c, c);
+		c = _mm_packus_epi16(c, c);
+		int32_t c4 = _mm_cvtsi128_si32(c);
+		__builtin_memcpy(coverage + i, &c4, 4);
+	}
+#endif
+	for(; i < n; i++) {
+		float pu = u + i * s->ux;
+		float pv = v - i * s->uy;
+		float cov;
+		if(s->round) {
+			// distance to the segment itself, the caps fall out of it
+			float cu = pu < 0 ? pu : (pu > s->len ? pu - s->len : 0);
+			cov = box_overlap(sqrtf(cu * cu + pv * pv), -s->hw, s->hw);
+		}
+		else {
+			cov = box_overlap(pv, -s->hw, s->hw) * box_overlap(pu, -s->ext0, s->len + s->ext1);
+		}
+		coverage[i] = (uint8_t) (cov * 255.0f + 0.5f);
+	}
+}
+
+typedef struct {
+	// where a * x + c(y) is inside (lo, hi) along each row, c(y) being
+	// linear in y, so the x range moves by a fixed step from row to row
+	int row_only; /**< a is zero, whole rows are in or out */
+	float x0, x1; /**< x range at the current row */
+	float step; /**< change of x0 and x1 per row */
+	float c, c_step, lo, hi; /**< for row_only bands */
+} band_t;
+
+static void band_setup(band_t* b, float a, float c, float c_step, float lo, float hi) {
+	// c is for the first row
+	b->row_only = fabsf(a) < 1e-6f;
+	b->c = c;
+	b->c_step = c_step;
+	b->lo = lo;
+	b->hi = hi;
+	if(b->row_only)
+		return;
+	b->x0 = (lo - c) / a;
+	b->x1 = (hi - c) / a;
+	if(a < 0) {
+		float t = b->x0;
+		b->x0 = b->x1;
+		b->x1 = t;
+	}
+	b->step = -c_step / a;
+}
+
+static inline int band_row(band_t* b, float* x0, float* x1) {
+	// narrows [x0, x1] to the band and moves on to the next row
+	int in;
+	if(b->row_only) {
+		in = b->c > b->lo && b->c < b->hi;
+		b->c += b->c_step;
+		return in;
+	}
+	*x0 = b->x0 > *x0 ? b->x0 : *x0;
+	*x1 = b->x1 < *x1 ? b->x1 : *x1;
+	b->x0 += b->step;
+	b->x1 += b->step;
+	return 1;
+}
+
+static int stroke_bounds(framebuffer_t* fb, const rect_t* clip, rect_t* bounds) {
+	*bounds = fb->scissor;
+	if(clip) {
+		bounds->x0 = clip->x0 > bounds->x0 ? clip->x0 : bounds->x0;
+		bounds->y0 = clip->y0 > bounds->y0 ? clip->y0 : bounds->y0;
+		bounds->x1 = clip->x1 < bounds->x1 ? clip->x1 : bounds->x1;
+		bounds->y1 = clip->y1 < bounds->y1 ? clip->y1 : bounds->y1;
+	}
+	if(bounds->x0 < 0)
+		bounds->x0 = 0;
+	if(bounds->y0 < 0)
+		bounds->y0 = 0;
+	if(bounds->x1 > fb->width)
+		bounds->x1 = fb->width;
+	if(bounds->y1 > fb->height)
+		bounds->y1 = fb->height;
+	return bounds->x0 < bounds->x1 && bounds->y0 < bounds->y1;
+}
+
+static void stroke_setup(stroke_t* s, float x0, float y0, float x1, float y1, float hw) {
+	float dx = x1 - x0, dy = y1 - y0;
+	s->x0 = x0;
+	s->y0 = y0;
+	s->len = sqrtf(dx * dx + dy * dy);
+	// a zero length stroke has no direction, square caps come out axis
+	// aligned
+	s->ux = s->len > 0 ? dx / s->len : 1.0f;
+	s->uy = s->len > 0 ? dy / s->len : 0.0f;
+	s->hw = hw;
+	s->ext0 = 0;
+	s->ext1 = 0;
+	s->round = 0;
+}
+
+static int mask_grow_rows(path_mask_t* mask, int y) {
+	// makes room for row y. the mask at least doubles towards it, so a
+	// path that keeps moving on costs amortized constant time per row
+	int more = mask->height > MASK_GROW ? mask->height : MASK_GROW;
+	int lo = mask->height ? mask->top : y;
+	int hi = mask->height ? mask->top + mask->height : y + 1;
+	if(!mask->height || y < lo)
+		lo = y - more > mask->bounds.y0 ? y - more : mask->bounds.y0;
+	if(!mask->height || y >= hi)
+		hi = y + 1 + more < mask->bounds.y1 ? y + 1 + more : mask->bounds.y1;
+	mask_row_t* rows = realloc(mask->rows, (size_t) (hi - lo) * sizeof(mask_row_t));
+	if(!rows)
+		return 0;
+	int shift = mask->height ? mask->top - lo : 0;
+	memmove(rows + shift, rows, (size_t) mask->height * sizeof(mask_row_t));
+	const mask_row_t empty = {NULL, 0, 0, INT_MAX, -1};
+	for(int i = 0; i < hi - lo; i++) {
+		if(i < shift || i >= shift + mask->height)
+			rows[i] = empty;
+	}
+	mask->rows = rows;
+	mask->top = lo;
+	mask->height = hi - lo;
+	return 1;
+}
+
+static int mask_grow_row(const path_mask_t* mask, mask_row_t* row, int x, int n) {
+	// makes room for columns x to x + n - 1 the same way
+	int more = row->width > MASK_GROW ? row->width : MASK_GROW;
+	int lo = row->coverage ? row->left : x;
+	int hi = row->coverage ? row->left + row->width : x + n;
+	if(!row->coverage || x < lo)
+		lo = x - more > mask->bounds.x0 ? x - more : mask->bounds.x0;
+	if(!row->coverage || x + n > hi)
+		hi = x + n + more < mask->bounds.x1 ? x + n + more : mask->bounds.x1;
+	uint8_t* coverage = realloc(row->coverage, hi - lo);
+	if(!coverage)
+		return 0;
+	int shift = row->coverage ? row->left - lo : 0;
+	memmove(coverage + shift, coverage, row->width);
+	memset(coverage, 0, shift);
+	memset(coverage + shift + row->width, 0, hi - lo - shift - row->width);
+	row->coverage = coverage;
+	row->left = lo;
+	row->width = hi - lo;
+	return 1;
+}
+
+static inline void mask_span(path_mask_t* mask, int y, int x, const uint8_t* coverage, int n) {
+	// pieces are clipped to the mask's bounds, so it can always grow to
+	// hold them unless memory runs out
+	if(!mask->ok)
+		return;
+	if((y < mask->top || y >= mask->top + mask->height) && !mask_grow_rows(mask, y)) {
+		mask->ok = 0;
+		return;
+	}
+	mask_row_t* row = &mask->rows[y - mask->top];
+	if((x < row->left || x + n > row->left + row->width) && !mask_grow_row(mask, row, x, n)) {
+		mask->ok = 0;
+		return;
+	}
+	uint8_t* dst = &row->coverage[x - row->left];
+	for(int i = 0; i < n; i++)
+		dst[i] = coverage[i] > dst[i] ? coverage[i] : dst[i];
+	if(x < row->x0)
+		row->x0 = x;
+	if(x + n - 1 > row->x1)
+		row->x1 = x + n - 1;
+}
+
+static void stroke_raster(const stroke_t* s, const rect_t* bounds, framebuffer_t* fb, unsigned color, path_mask_t* mask) {
+	// blends the stroke into fb, or with a mask keeps the coverage there
+	float reach_v = s->hw + 0.5f;
+	float reach_u0 = (s->round ? s->hw : s->ext0) + 0.5f;
+	float reach_u1 = (s->round ? s->hw : s->ext1) + 0.5f;
+	float pad = reach_v + (reach_u0 > reach_u1 ? reach_u0 : reach_u1);
+	float y_end = s->y0 + s->len * s->uy;
+	float ymin = (s->y0 < y_end ? s->y0 : y_end) - pad;
+	float ymax = (s->y0 < y_end ? y_end : s->y0) + pad;
+	int y0 = ymin > bounds->y0 ? (int) floorf(ymin) : bounds->y0;
+	int y1 = ymax < bounds->y1 - 1 ? (int) ceilf(ymax) : bounds->y1 - 1;
+
+	// u and v are linear in x along a row and from row to row, only the
+	// pixels where both are in reach are visited
+	float ry = y0 - s->y0;
+	float cu = -s->x0 * s->ux + ry * s->uy;
+	float cv = s->x0 * s->uy + ry * s->ux;
+	band_t bu, bv;
+	band_setup(&bv, -s->uy, cv, s->ux, -reach_v, reach_v);
+	band_setup(&bu, s->ux, cu, s->uy, -reach_u0, s->len + reach_u1);
+	uint8_t coverage[STROKE_SPAN + 4];
+	for(int y = y0; y <= y1; y++, cu += s->uy, cv += s->ux) {
+		float fx0 = (float) bounds->x0, fx1 = (float) (bounds->x1 - 1);
+		int in = band_row(&bv, &fx0, &fx1);
+		in &= band_row(&bu, &fx0, &fx1);
+		if(!in || fx0 > fx1)
+			continue;
+		// pixels right on the edge of reach get no coverage and are skipped,
+		// a limit that came from the clip is a pixel to draw
+		int x0 = fx0 > bounds->x0 ? (int) floorf(fx0) + 1 : bounds->x0;
+		int x1 = fx1 < bounds->x1 - 1 ? (int) ceilf(fx1) - 1 : bounds->x1 - 1;
+		for(int x = x0; x <= x1; x += STROKE_SPAN) {
+			int n = x1 - x + 1 < STROKE_SPAN ? x1 - x + 1 : STROKE_SPAN;
+			stroke_coverage(s, x * s->ux + cu, cv - x * s->uy, n, coverage);
+			if(mask)
+				mask_span(mask, y, x, coverage, n);
+			else
+				framebuffer_blend_span(fb, x, y, coverage, n, color);
+		}
+	}
+}
+
+static void polygon_raster(const float* pts, int n, const rect_t* bounds, path_mask_t* mask) {
+	// convex polygon of n (x, y) pairs in either winding, the coverage is
+	// the distance to the nearest edge, which rounds the corners a little
+	float nx[8], ny[8], c[8];
+	float area = 0;
+	for(int i = 0; i < n; i++) {
+		int j = (i + 1) % n;
+		area += pts[2 * i] * pts[2 * j + 1] - pts[2 * j] * pts[2 * i + 1];
+	}
+	float sign = area < 0 ? -1.0f : 1.0f;
+	float xmin = pts[0], xmax = pts[0], ymin = pts[1], ymax = pts[1];
+	for(int i = 0; i < n; i++) {
+		int j = (i + 1) % n;
+		float ex = pts[2 * j] - pts[2 * i], ey = pts[2 * j + 1] - pts[2 * i + 1];
+		float el = sqrtf(ex * ex + ey * ey);
+		if(el == 0) {
+			// repeated corner, an edge that never limits anything
+			nx[i] = ny[i] = 0;
+			c[i] = 1e30f;
+			continue;
+		}
+		// inward normal, distance inside is nx * x + ny * y + c
+		nx[i] = -ey / el * sign;
+		ny[i] = ex / el * sign;
+		c[i] = -(nx[i] * pts[2 * i] + ny[i] * pts[2 * i + 1]);
+		xmin = pts[2 * i] < xmin ? pts[2 * i] : xmin;
+		xmax = pts[2 * i] > xmax ? pts[2 * i] : xmax;
+		ymin = pts[2 * i + 1] < ymin ? pts[2 * i + 1] : ymin;
+		ymax = pts[2 * i + 1] > ymax ? pts[2 * i + 1] : ymax;
+	}
+	int x0 = xmin - 1 > bounds->x0 ? (int) floorf(xmin - 1) : bounds->x0;
+	int x1 = xmax + 1 < bounds->x1 - 1 ? (int) ceilf(xmax + 1) : bounds->x1 - 1;
+	int y0 = ymin - 1 > bounds->y0 ? (int) floorf(ymin - 1) : bounds->y0;
+	int y1 = ymax + 1 < bounds->y1 - 1 ? (int) ceilf(ymax + 1) : bounds->y1 - 1;
+	uint8_t coverage[STROKE_SPAN];
+	for(int y = y0; y <= y1; y++) {
+		for(int xs = x0; xs <= x1; xs += STROKE_SPAN) {
+			int count = x1 - xs + 1 < STROKE_SPAN ? x1 - xs + 1 : STROKE_SPAN;
+			int first = -1, last = -1;
+			for(int i = 0; i < count; i++) {
+				float d = 1e30f;
+				for(int e = 0; e < n; e++) {
+					float de = nx[e] * (xs + i) + ny[e] * y + c[e];
+					d = de < d ? de : d;
+				}
+				float cov = d + 0.5f;
+				cov = cov < 0 ? 0 : (cov > 1 ? 1 : cov);
+				coverage[i] = (uint8_t) (cov * 255.0f + 0.5f);
+				if(coverage[i]) {
+					if(first < 0)
+						first = i;
+					last = i;
+				}
+			}
+			if(first >= 0)
+				mask_span(mask, y, xs + first, &coverage[first], last - first + 1);
+		}
+	}
+}
+
+static void disc_raster(float x, float y, float hw, const rect_t* bounds, path_mask_t* mask) {
+	stroke_t s;
+	stroke_setup(&s, x, y, x, y, hw);
+	s.round = 1;
+	stroke_raster(&s, bounds, NULL, 0, mask);
+}
+
+int draw_stroke_clip(framebuffer_t* fb, unsigned color, double width, int cap, pointfx_t* p1, pointfx_t* p2, const rect_t* clip) {
+	rect_t bounds;
+	if(!stroke_bounds(fb, clip, &bounds) || !(width > 0))
+		return 1;
+	stroke_t s;
+	stroke_setup(&s, (float) p1->x / FX_ONE, (float) p1->y / FX_ONE, (float) p2->x / FX_ONE, (float) p2->y / FX_ONE, (float) width * 0.5f);
+	// butt caps on a zero length stroke draw nothing
+	if(cap == CAP_BUTT && s.len == 0)
+		return 1;
+	s.round = cap == CAP_ROUND;
+	s.ext0 = s.ext1 = cap == CAP_SQUARE ? s.hw : 0.0f;
+	stroke_raster(&s, &bounds, fb, color, NULL);
+	return 1;
+}
+
+int draw_stroke(framebuffer_t* fb, unsigned color, double width, int cap, pointfx_t* p1, pointfx_t* p2) {
+	return draw_stroke_clip(fb, color, width, cap, p1, p2, NULL);
+}
+
+static void join_raster(const stroke_t* a, const stroke_t* b, const stroke_style_t* style, const rect_t* bounds, path_mask_t* mask) {
+	// fills the gap on the outside of the turn from segment a into b, the
+	// polygon reaches back into both segments by the overlap
+	float vx = b->x0, vy = b->y0;
+	float cross = a->ux * b->uy - a->uy * b->ux;
+	float dot = a->ux * b->ux + a->uy * b->uy;
+	// the miter ratio 1 / cos(theta / 2) is sqrt(2 / (1 + dot))
+	float limit = style->miter_limit > 1 ? (float) style->miter_limit : 1.0f;
+	int miter = style->join == JOIN_MITER && 2 < limit * limit * (1 + dot);
+	// segment ends reach JOIN_OVERLAP past the vertex, so the outer
+	// corners of the join are already covered while they stay within
+	// that distance along the incoming segment. that is most vertices of
+	// dense thin paths
+	float reach;
+	if(miter)
+		reach = a->hw * fabsf(cross) / (1 + dot);
+	else if(style->join == JOIN_ROUND && dot <= 0)
+		reach = a->hw;
+	else
+		reach = a->hw * fabsf(cross);
+	if(reach <= JOIN_OVERLAP)
+		return;
+	if(style->join == JOIN_ROUND) {
+		disc_raster(vx, vy, a->hw, bounds, mask);
+		return;
+	}
+	// normals point left of the direction, the outside is the side the
+	// path turns away from
+	float side = cross > 0 ? -a->hw : a->hw;
+	float anx = -a->uy * side, any = a->ux * side;
+	float bnx = -b->uy * side, bny = b->ux * side;
+	float o = JOIN_OVERLAP;
+	float pts[14];
+	int n = 0;
+	pts[n++] = vx - a->ux * o;
+	pts[n++] = vy - a->uy * o;
+	pts[n++] = vx + anx - a->ux * o;
+	pts[n++] = vy + any - a->uy * o;
+	pts[n++] = vx + anx;
+	pts[n++] = vy + any;
+	if(miter) {
+		// the tip is hw / cos(theta / 2) out along the bisector and
+		// |an + bn| is 2 hw cos(theta / 2)
+		float mx = anx + bnx, my = any + bny;
+		float k = 2 * a->hw * a->hw / (mx * mx + my * my);
+		pts[n++] = vx + mx * k;
+		pts[n++] = vy + my * k;
+	}
+	pts[n++] = vx + bnx;
+	pts[n++] = vy + bny;
+	pts[n++] = vx + bnx + b->ux * o;
+	pts[n++] = vy + bny + b->uy * o;
+	pts[n++] = vx + b->ux * o;
+	pts[n++] = vy + b->uy * o;
+	polygon_raster(pts, n / 2, bounds, mask);
+}
+
+static void cap_raster(const stroke_t* s, int end, const stroke_style_t* style, const rect_t* bounds, path_mask_t* mask) {
+	// square caps are drawn by the segment reaching further
+	if(style->cap != CAP_ROUND)
+		return;
+	float x = end ? s->x0 + s->ux * s->len : s->x0;
+	float y = end ? s->y0 + s->uy * s->len : s->y0;
+	disc_raster(x, y, s->hw, bounds, mask);
+}
+
+static int polyline(framebuffer_t* fb, unsigned color, const point_t* pts, const pointfx_t* fx, size_t n, const stroke_style_t* style) {
+	rect_t bounds;
+	if(n == 0 || !stroke_bounds(fb, NULL, &bounds) || !(style->width > 0))
+		return 1;
+	path_mask_t mask = {.bounds = bounds, .ok = 1};
+
+	// one pass over the vertices, each segment is set up once and kept
+	// around for the join with the next one
+	float hw = (float) style->width * 0.5f;
+	float tail = style->cap == CAP_SQUARE ? hw : 0.0f;
+	stroke_t prev, cur;
+	int have_prev = 0;
+	float px = fx ? (float) fx[0].x / FX_ONE : (float) pts[0].x;
+	float py = fx ? (float) fx[0].y / FX_ONE : (float) pts[0].y;
+	for(size_t i = 1; i < n; i++) {
+		float x = fx ? (float) fx[i].x / FX_ONE : (float) pts[i].x;
+		float y = fx ? (float) fx[i].y / FX_ONE : (float) pts[i].y;
+		if(x == px && y == py)
+			continue;
+		stroke_setup(&cur, px, py, x, y, hw);
+		if(have_prev) {
+			join_raster(&prev, &cur, style, &bounds, &mask);
+			// the previous segment is only drawn now that its far end is
+			// known to be a join rather than the end of the path
+			prev.ext1 = JOIN_OVERLAP;
+			stroke_raster(&prev, &bounds, fb, color, &mask);
+			cur.ext0 = JOIN_OVERLAP;
+		}
+		else {
+			cur.ext0 = tail;
+			cap_raster(&cur, 0, style, &bounds, &mask);
+		}
+		prev = cur;
+		have_prev = 1;
+		px = x;
+		py = y;
+	}
+	if(have_prev) {
+		prev.ext1 = tail;
+		stroke_raster(&prev, &bounds, fb, color, &mask);
+		cap_raster(&prev, 1, style, &bounds, &mask);
+	}
+	else if(style->cap != CAP_BUTT) {
+		// a single point, or all points the same, is a dot
+		stroke_setup(&cur, px, py, px, py, hw);
+		cur.round = style->cap == CAP_ROUND;
+		cur.ext0 = cur.ext1 = hw;
+		stroke_raster(&cur, &bounds, fb, color, &mask);
+	}
+
+	// a path that ran out of memory is not drawn at all rather than in part
+	for(int y = 0; y < mask.height; y++) {
+		mask_row_t* row = &mask.rows[y];
+		if(mask.ok && row->x0 <= row->x1)
+			framebuffer_blend_span(fb, row->x0, mask.top + y, &row->coverage[row->x0 - row->left], row->x1 - row->x0 + 1, color);
+		free(row->coverage);
+	}
+	free(mask.rows);
+	return mask.ok;
+}
+
+int draw_polyline(framebuffer_t* fb, unsigned color, const point_t* pts, size_t n, const stroke_style_t* style) {
+	return polyline(fb, color, pts, NULL, n, style);
+}
+
+int draw_polyline_fx(framebuffer_t* fb, unsigned color, const pointfx_t* pts, size_t n, const stroke_style_t* style) {
+	return polyline(fb, color, NULL, pts, n, style);
+}
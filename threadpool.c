@@ -0,0 +1,158 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "threadpool.h"
+
+// one range of jobs per worker, padded so workers claiming jobs from
+// their own range do not share a cache line
+typedef struct {
+	long next;
+	long end;
+	char pad[64 - 2 * sizeof(long)];
+} job_range_t;
+
+typedef struct {
+	threadpool_t* pool;
+	int index;
+} worker_arg_t;
+
+struct threadpool {
+	int size;
+	pthread_t* threads;
+	worker_arg_t* args;
+	job_range_t* ranges;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	unsigned long generation; /**< bumped every time a loop is started */
+	int busy; /**< workers that have not finished the current loop */
+	int quit;
+	threadpool_fn fn;
+	void* ctx;
+};
+
+static long take_job(job_range_t* range) {
+	// owner and thieves all claim from the front, overshooting next is
+	// harmless because it is only compared against end
+	long job = __atomic_fetch_add(&range->next, 1, __ATOMIC_RELAXED);
+	return job < range->end ? job : -1;
+}
+
+static void work(threadpool_t* pool, int index) {
+	long job;
+	while((job = take_job(&pool->ranges[index])) >= 0)
+		pool->fn(pool->ctx, (int) job, index);
+	for(int i = 1; i < pool->size; i++) {
+		job_range_t* victim = &pool->ranges[(index + i) % pool->size];
+		while((job = take_job(victim)) >= 0)
+			pool->fn(pool->ctx, (int) job, index);
+	}
+}
+
+static void* worker_main(void* arg) {
+	worker_arg_t* wa = (worker_arg_t*) arg;
+	threadpool_t* pool = wa->pool;
+	unsigned long seen = 0;
+	pthread_mutex_lock(&pool->lock);
+	for(;;) {
+		while(pool->generation == seen && !pool->quit)
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		if(pool->quit)
+			break;
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+		work(pool, wa->index);
+		pthread_mutex_lock(&pool->lock);
+		if(--pool->busy == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+threadpool_t* threadpool_init(int nthreads) {
+	if(nthreads <= 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = online > 0 ? (int) online : 1;
+	}
+	threadpool_t* pool = calloc(1, sizeof(threadpool_t));
+	if(!pool)
+		return NULL;
+	pool->size = nthreads;
+	pool->threads = calloc(nthreads, sizeof(pthread_t));
+	pool->args = calloc(nthreads, sizeof(worker_arg_t));
+	pool->ranges = calloc(nthreads, sizeof(job_range_t));
+	if(!pool->threads || !pool->args || !pool->ranges) {
+		free(pool->threads);
+		free(pool->args);
+		free(pool->ranges);
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for(int i = 1; i < nthreads; i++) {
+		pool->args[i].pool = pool;
+		pool->args[i].index = i;
+		if(pthread_create(&pool->threads[i], NULL, worker_main, &pool->args[i]) != 0) {
+			// run with the workers that did start
+			pool->size = i;
+			break;
+		}
+	}
+	return pool;
+}
+
+int threadpool_size(threadpool_t* pool) {
+	return pool ? pool->size : 1;
+}
+
+void threadpool_run(threadpool_t* pool, int njobs, threadpool_fn fn, void* ctx) {
+	if(njobs <= 0)
+		return;
+	if(!pool || pool->size == 1 || njobs == 1) {
+		for(int i = 0; i < njobs; i++)
+			fn(ctx, i, 0);
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->fn = fn;
+	pool->ctx = ctx;
+	for(int i = 0; i < pool->size; i++) {
+		pool->ranges[i].next = (long) njobs * i / pool->size;
+		pool->ranges[i].end = (long) njobs * (i + 1) / pool->size;
+	}
+	pool->busy = pool->size - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	work(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while(pool->busy > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void threadpool_free(threadpool_t* pool) {
+	if(!pool)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+	for(int i = 1; i < pool->size; i++)
+		pthread_join(pool->threads[i], NULL);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->wake);
+	pthread_cond_destroy(&pool->done);
+	free(pool->threads);
+	free(pool->args);
+	free(pool->ranges);
+	free(pool);
+}
@@ -0,0 +1,59 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+/**
+ * @brief Fixed set of worker threads that run parallel for loops
+ */
+typedef struct threadpool threadpool_t;
+
+/**
+ * @brief Body of a parallel loop
+ *
+ * @param ctx pointer passed to threadpool_run
+ * @param job index of the job to run, in [0, njobs)
+ * @param worker index of the thread running the job, in [0, threadpool_size)
+ */
+typedef void (*threadpool_fn)(void* ctx, int job, int worker);
+
+/**
+ * @brief Start a thread pool
+ *
+ * The thread calling threadpool_run counts as worker 0, so nthreads - 1
+ * threads are started.
+ *
+ * @param nthreads number of workers, 0 for one per online cpu
+ *
+ * @return a pointer to the new pool, NULL if it could not be started
+ */
+threadpool_t* threadpool_init(int nthreads);
+
+/**
+ * @brief Number of workers in a pool, including the calling thread
+ *
+ * @param pool pool to query, NULL counts as a pool of one
+ */
+int threadpool_size(threadpool_t* pool);
+
+/**
+ * @brief Run fn for every job in [0, njobs) and wait for all of them
+ *
+ * Jobs are split into one contiguous range per worker. A worker that runs
+ * out of jobs steals from the ranges of the others, so uneven jobs still
+ * keep every thread busy. Passing a NULL pool runs the jobs in order on
+ * the calling thread.
+ *
+ * @param pool pool to run on
+ * @param njobs number of jobs
+ * @param fn loop body
+ * @param ctx passed through to fn
+ */
+void threadpool_run(threadpool_t* pool, int njobs, threadpool_fn fn, void* ctx);
+
+/**
+ * @brief Stop the workers and free the pool
+ *
+ * @param pool pool to free, may be NULL
+ */
+void threadpool_free(threadpool_t* pool);
+
+#endif
@@ -0,0 +1,209 @@
+#include "framebuffer.h"
+
+// draw_aaline_batch_mt builds a compact list of segment indices per tile
+//
+// binning runs in parallel over contiguous chunks of the input. every
+// chunk counts how many of its segments touch each tile, the counts are
+// turned into per chunk write cursors in chunk order, then every chunk
+// writes its indices. since chunks are contiguous and placed in order,
+// each tile list ends up in submission order without any sorting
+
+// keep the uint32 tile lists well clear of overflowing
+#define TILE_MAX_SEGMENTS ((size_t) 1 << 30)
+
+typedef struct {
+	framebuffer_t* fb;
+	const segment_t* segs;
+	size_t n;
+	rect_t bounds; /**< framebuffer clipped to the scissor */
+	int tiles_x;
+	int tiles_y;
+	size_t ntiles;
+	int nchunks;
+	uint32_t* cursor; /**< nchunks * ntiles counts, then write cursors */
+	size_t* tile_start; /**< ntiles + 1 offsets into list */
+	uint32_t* list;
+} tile_bins_t;
+
+static inline int64_t floor_div(int64_t a, int64_t b) {
+	// b is always positive here
+	int64_t q = a / b;
+	if(a % b < 0)
+		q--;
+	return q;
+}
+
+static inline void bin_tile(tile_bins_t* bins, int chunk, int tx, int ty, uint32_t idx) {
+	if(tx < 0 || tx >= bins->tiles_x || ty < 0 || ty >= bins->tiles_y)
+		return;
+	size_t tile = (size_t) ty * bins->tiles_x + tx;
+	uint32_t* c = &bins->cursor[(size_t) chunk * bins->ntiles + tile];
+	if(bins->list)
+		bins->list[bins->tile_start[tile] + (*c)++] = idx;
+	else
+		(*c)++;
+}
+
+static void bin_segment(tile_bins_t* bins, int chunk, uint32_t idx) {
+	// visit every tile the segment can draw into, in a fixed order so the
+	// counting and writing passes agree
+	//
+	// the major axis is walked one band of tiles at a time and the minor
+	// axis range of the line over that band is widened by two pixels,
+	// which covers the second Wu pixel and the rounding in the kernels
+	const segment_t* seg = &bins->segs[idx];
+	point_t p1 = seg->p1, p2 = seg->p2;
+	int64_t dx = p2.x - p1.x;
+	int64_t dy = p2.y - p1.y;
+	int steep = llabs(dy) >= llabs(dx);
+	if(steep ? p2.y < p1.y : p2.x < p1.x) {
+		point_t tmp = p1;
+		p1 = p2;
+		p2 = tmp;
+		dx = -dx;
+		dy = -dy;
+	}
+	int major0 = steep ? p1.y : p1.x;
+	int major1 = steep ? p2.y : p2.x;
+	int minor0 = steep ? p1.x : p1.y;
+	int64_t dmajor = steep ? dy : dx;
+	int64_t dminor = steep ? dx : dy;
+	int major_tiles = steep ? bins->tiles_y : bins->tiles_x;
+	int band0 = major0 < 0 ? 0 : major0 / TILE_SIZE;
+	int band1 = major1 < 0 ? -1 : major1 / TILE_SIZE;
+	if(band1 >= major_tiles)
+		band1 = major_tiles - 1;
+	for(int band = band0; band <= band1; band++) {
+		int a = band * TILE_SIZE > major0 ? band * TILE_SIZE : major0;
+		int b = band * TILE_SIZE + TILE_SIZE - 1 < major1 ? band * TILE_SIZE + TILE_SIZE - 1 : major1;
+		int64_t lo = minor0, hi = minor0;
+		if(dmajor != 0) {
+			int64_t ma = minor0 + floor_div((a - major0 + 1) * dminor, dmajor);
+			int64_t mb = minor0 + floor_div((b - major0 + 1) * dminor, dmajor);
+			lo = ma < mb ? ma : mb;
+			hi = ma < mb ? mb : ma;
+		}
+		lo -= 2;
+		hi += 2;
+		int t0 = lo < 0 ? 0 : (int) (lo / TILE_SIZE);
+		int t1 = hi < 0 ? -1 : (int) (hi / TILE_SIZE);
+		for(int t = t0; t <= t1; t++) {
+			if(steep)
+				bin_tile(bins, chunk, t, band, idx);
+			else
+				bin_tile(bins, chunk, band, t, idx);
+		}
+	}
+}
+
+static inline void chunk_range(tile_bins_t* bins, int chunk, size_t* start, size_t* end) {
+	*start = bins->n * chunk / bins->nchunks;
+	*end = bins->n * (chunk + 1) / bins->nchunks;
+}
+
+static void bin_chunk(void* ctx, int chunk, int worker) {
+	tile_bins_t* bins = (tile_bins_t*) ctx;
+	uint8_t visible[1024];
+	size_t start, end;
+	chunk_range(bins, chunk, &start, &end);
+	for(size_t base = start; base < end; base += sizeof(visible)) {
+		size_t count = end - base < sizeof(visible) ? end - base : sizeof(visible);
+		if(!segments_visible(bins->segs + base, count, &bins->bounds, visible))
+			continue;
+		for(size_t i = 0; i < count; i++)
+			if(visible[i])
+				bin_segment(bins, chunk, (uint32_t) (base + i));
+	}
+}
+
+static void draw_tile(void* ctx, int tile, int worker) {
+	tile_bins_t* bins = (tile_bins_t*) ctx;
+	int tx = tile % bins->tiles_x;
+	int ty = tile / bins->tiles_x;
+	rect_t clip = {
+		.x0 = tx * TILE_SIZE,
+		.y0 = ty * TILE_SIZE,
+		.x1 = tx * TILE_SIZE + TILE_SIZE,
+		.y1 = ty * TILE_SIZE + TILE_SIZE
+	};
+	point_t p1, p2;
+	for(size_t i = bins->tile_start[tile]; i < bins->tile_start[tile + 1]; i++) {
+		const segment_t* seg = &bins->segs[bins->list[i]];
+		p1 = seg->p1;
+		p2 = seg->p2;
+		draw_aaline_clip(bins->fb, seg->color, &p1, &p2, &clip);
+	}
+}
+
+static int draw_batch_tiled(framebuffer_t* fb, const segment_t* segs, size_t n, threadpool_t* pool) {
+	tile_bins_t bins = {.fb = fb, .segs = segs, .n = n};
+	bins.bounds = fb->scissor;
+	if(bins.bounds.x0 < 0)
+		bins.bounds.x0 = 0;
+	if(bins.bounds.y0 < 0)
+		bins.bounds.y0 = 0;
+	if(bins.bounds.x1 > fb->width)
+		bins.bounds.x1 = fb->width;
+	if(bins.bounds.y1 > fb->height)
+		bins.bounds.y1 = fb->height;
+	if(bins.bounds.x0 >= bins.bounds.x1 || bins.bounds.y0 >= bins.bounds.y1)
+		return 1;
+	bins.tiles_x = (fb->width + TILE_SIZE - 1) / TILE_SIZE;
+	bins.tiles_y = (fb->height + TILE_SIZE - 1) / TILE_SIZE;
+	bins.ntiles = (size_t) bins.tiles_x * bins.tiles_y;
+	// a few chunks per thread so stealing can even out the binning
+	bins.nchunks = threadpool_size(pool) * 4;
+	if((size_t) bins.nchunks > n / 1024 + 1)
+		bins.nchunks = (int) (n / 1024 + 1);
+	bins.cursor = calloc((size_t) bins.nchunks * bins.ntiles, sizeof(uint32_t));
+	bins.tile_start = malloc((bins.ntiles + 1) * sizeof(size_t));
+	if(!bins.cursor || !bins.tile_start) {
+		free(bins.cursor);
+		free(bins.tile_start);
+		return 0;
+	}
+
+	threadpool_run(pool, bins.nchunks, bin_chunk, &bins);
+
+	// turn the counts into write cursors, tile by tile then chunk by chunk
+	// the cursors are relative to the start of their tile so they fit in
+	// a uint32, a tile never sees a segment twice
+	size_t total = 0;
+	for(size_t t = 0; t < bins.ntiles; t++) {
+		bins.tile_start[t] = total;
+		for(int c = 0; c < bins.nchunks; c++) {
+			uint32_t* cur = &bins.cursor[(size_t) c * bins.ntiles + t];
+			uint32_t count = *cur;
+			*cur = (uint32_t) (total - bins.tile_start[t]);
+			total += count;
+		}
+	}
+	bins.tile_start[bins.ntiles] = total;
+	bins.list = malloc((total ? total : 1) * sizeof(uint32_t));
+	if(!bins.list) {
+		free(bins.cursor);
+		free(bins.tile_start);
+		return 0;
+	}
+
+	threadpool_run(pool, bins.nchunks, bin_chunk, &bins);
+	threadpool_run(pool, (int) bins.ntiles, draw_tile, &bins);
+
+	free(bins.cursor);
+	free(bins.tile_start);
+	free(bins.list);
+	return 1;
+}
+
+int draw_aaline_batch_mt(framebuffer_t* fb, const segment_t* segs, size_t n, threadpool_t* pool) {
+	// tiles of a sparse framebuffer are allocated as they are drawn into,
+	// which is not safe from several threads
+	if(fb->tiles)
+		return draw_aaline_batch(fb, segs, n);
+	for(size_t base = 0; base < n; base += TILE_MAX_SEGMENTS) {
+		size_t chunk = n - base < TILE_MAX_SEGMENTS ? n - base : TILE_MAX_SEGMENTS;
+		if(!draw_batch_tiled(fb, segs + base, chunk, pool))
+			return 0;
+	}
+	return 1;
+}